@@ -0,0 +1,229 @@
+#pragma once
+// 请求级内存池：单调分配，请求结束时一次性释放
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <atomic>
+#include <utility>
+
+namespace ns_arena
+{
+    // 全局分配统计
+    // requests: 经由arena完成的分配次数（未使用arena时每一次都是一次malloc）
+    // blocks  : arena真正向系统申请内存块的次数
+    struct ArenaStats
+    {
+        std::atomic<uint64_t> queries;
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> blocks;
+        ArenaStats() : queries(0), requests(0), blocks(0) {}
+    };
+
+    inline ArenaStats &GlobalStats()
+    {
+        static ArenaStats stats;
+        return stats;
+    }
+
+    class Arena
+    {
+    private:
+        struct Block
+        {
+            Block *prev;
+            std::size_t size; // 不含Block头部的可用字节数
+        };
+
+        static const std::size_t kInitSize = 64 * 1024;          // 首块大小
+        static const std::size_t kMaxRetain = 8 * 1024 * 1024;  // Reset后最多保留的容量，防止一次大查询长期占用内存
+
+        Block *current;
+        char *ptr;
+        char *end;
+        std::size_t capacity; // 所有块容量之和
+        uint64_t requests;
+        uint64_t blocks;
+
+    private:
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        static char *BlockBegin(Block *b) { return reinterpret_cast<char *>(b + 1); }
+
+        void NewBlock(std::size_t size)
+        {
+            Block *b = static_cast<Block *>(std::malloc(sizeof(Block) + size));
+            if (b == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            b->prev = current;
+            b->size = size;
+            current = b;
+            ptr = BlockBegin(b);
+            end = ptr + size;
+            capacity += size;
+            blocks++;
+        }
+
+        void FreeBlocks()
+        {
+            while (current != nullptr)
+            {
+                Block *prev = current->prev;
+                std::free(current);
+                current = prev;
+            }
+            ptr = end = nullptr;
+            capacity = 0;
+        }
+
+    public:
+        Arena() : current(nullptr), ptr(nullptr), end(nullptr), capacity(0), requests(0), blocks(0) {}
+        ~Arena() { FreeBlocks(); }
+
+        void *Allocate(std::size_t n, std::size_t align = alignof(std::max_align_t))
+        {
+            requests++;
+            std::uintptr_t p = reinterpret_cast<std::uintptr_t>(ptr);
+            std::uintptr_t aligned = (p + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+            if (current == nullptr || aligned + n > reinterpret_cast<std::uintptr_t>(end))
+            {
+                // 新块至少翻倍，保证分配次数为对数级
+                std::size_t size = capacity;
+                if (size == 0)
+                {
+                    size = kInitSize;
+                }
+                if (size < n + align)
+                {
+                    size = n + align;
+                }
+                NewBlock(size);
+                p = reinterpret_cast<std::uintptr_t>(ptr);
+                aligned = (p + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+            }
+            ptr = reinterpret_cast<char *>(aligned + n);
+            return reinterpret_cast<void *>(aligned);
+        }
+
+        // 一次性释放本轮所有分配
+        // 若本轮用到了多个块，则合并为一个足够大的块，后续相同规模的请求不再触发malloc
+        void Reset()
+        {
+            if (current == nullptr)
+            {
+                return;
+            }
+            if (current->prev != nullptr || capacity > kMaxRetain)
+            {
+                std::size_t size = capacity;
+                if (size > kMaxRetain)
+                {
+                    size = kMaxRetain;
+                }
+                FreeBlocks();
+                NewBlock(size);
+                return;
+            }
+            ptr = BlockBegin(current);
+        }
+
+        uint64_t Requests() const { return requests; }
+        uint64_t Blocks() const { return blocks; }
+
+        // 每个线程一个arena，httplib的工作线程之间互不竞争
+        static Arena &Local()
+        {
+            static thread_local Arena arena;
+            return arena;
+        }
+    };
+
+    // 每次查询的分配次数
+    struct QueryAllocs
+    {
+        uint64_t requests;
+        uint64_t blocks;
+        QueryAllocs() : requests(0), blocks(0) {}
+    };
+
+    // 作用域：进入时记录计数，离开时统计并释放本线程arena
+    // 支持嵌套，只有最外层作用域结束时才真正Reset
+    class ArenaScope
+    {
+    private:
+        uint64_t requests_begin;
+        uint64_t blocks_begin;
+
+        static int &Depth()
+        {
+            static thread_local int depth = 0;
+            return depth;
+        }
+
+    public:
+        ArenaScope()
+        {
+            Arena &arena = Arena::Local();
+            requests_begin = arena.Requests();
+            blocks_begin = arena.Blocks();
+            Depth()++;
+        }
+        ~ArenaScope()
+        {
+            Arena &arena = Arena::Local();
+            if (--Depth() != 0)
+            {
+                return;
+            }
+            QueryAllocs &last = Last();
+            last.requests = arena.Requests() - requests_begin;
+            last.blocks = arena.Blocks() - blocks_begin;
+
+            ArenaStats &stats = GlobalStats();
+            stats.queries.fetch_add(1, std::memory_order_relaxed);
+            stats.requests.fetch_add(last.requests, std::memory_order_relaxed);
+            stats.blocks.fetch_add(last.blocks, std::memory_order_relaxed);
+            arena.Reset();
+        }
+
+        // 本线程最近一次查询的分配情况
+        static QueryAllocs &Last()
+        {
+            static thread_local QueryAllocs last;
+            return last;
+        }
+    };
+
+    // 无状态的分配器，总是从当前线程的arena分配，deallocate为空操作
+    // 只能用于生命周期不超出ArenaScope的容器
+    template <class T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+
+        ArenaAllocator() {}
+        template <class U>
+        ArenaAllocator(const ArenaAllocator<U> &) {}
+
+        T *allocate(std::size_t n)
+        {
+            return static_cast<T *>(Arena::Local().Allocate(n * sizeof(T), alignof(T)));
+        }
+        void deallocate(T *, std::size_t) {}
+
+        template <class U>
+        struct rebind
+        {
+            typedef ArenaAllocator<U> other;
+        };
+    };
+
+    template <class T, class U>
+    bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+    template <class T, class U>
+    bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+}
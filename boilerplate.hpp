@@ -0,0 +1,295 @@
+#pragma once
+// 跨文档的模板文本去除：导航栏、页眉页脚、版权声明等在大量页面中逐字重复
+// 以源文件的一行为一块，用count-min sketch统计每块出现在多少个文档中，超过阈值的块视为模板，从正文中删掉
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include "mphf.hpp"
+#include "util.hpp"
+#include "log.hpp"
+
+namespace ns_boilerplate
+{
+    const char kSketchMagic[4] = {'B', 'S', 'K', '1'}; // Stripper::Save的文件头
+
+    // count-min sketch：depth行计数器，每行用不同的哈希位置；估计值只会偏大，不会偏小
+    class CountMinSketch
+    {
+    private:
+        static const int kDepth = 4;
+        std::size_t mask;
+        std::vector<uint32_t> counters; // kDepth * (mask + 1)
+
+        std::size_t Cell(uint64_t h, int row) const
+        {
+            // 双重哈希派生每行的位置
+            uint64_t x = h + static_cast<uint64_t>(row) * ns_mphf::Mix64(h ^ 0x9e3779b97f4a7c15ULL);
+            return static_cast<std::size_t>(row) * (mask + 1) + static_cast<std::size_t>(x & mask);
+        }
+
+    public:
+        // width向上取整为2的幂
+        explicit CountMinSketch(std::size_t width)
+        {
+            std::size_t w = 1;
+            while (w < width)
+            {
+                w <<= 1;
+            }
+            mask = w - 1;
+            counters.assign(kDepth * w, 0);
+        }
+
+        // 保守更新：只增加取最小值的计数器，减少高估
+        void Add(uint64_t h)
+        {
+            uint32_t est = Estimate(h) + 1;
+            for (int row = 0; row < kDepth; row++)
+            {
+                uint32_t &c = counters[Cell(h, row)];
+                c = std::max(c, est);
+            }
+        }
+
+        uint32_t Estimate(uint64_t h) const
+        {
+            uint32_t est = counters[Cell(h, 0)];
+            for (int row = 1; row < kDepth; row++)
+            {
+                est = std::min(est, counters[Cell(h, row)]);
+            }
+            return est;
+        }
+
+        std::size_t Bytes() const { return counters.size() * sizeof(uint32_t); }
+
+        bool Write(FILE *fp) const
+        {
+            uint64_t n = counters.size();
+            return fwrite(&n, sizeof(n), 1, fp) == 1 && fwrite(counters.data(), sizeof(uint32_t), n, fp) == n;
+        }
+
+        bool Read(FILE *fp)
+        {
+            uint64_t n = 0;
+            if (fread(&n, sizeof(n), 1, fp) != 1 || n == 0 || n % kDepth != 0 || ((n / kDepth) & (n / kDepth - 1)) != 0)
+            {
+                return false;
+            }
+            counters.resize(n);
+            mask = n / kDepth - 1;
+            return fread(&counters[0], sizeof(uint32_t), n, fp) == n;
+        }
+    };
+
+    struct StripOptions
+    {
+        std::size_t min_docs; // 至少出现在这么多文档中才算模板
+        double min_ratio;     // 或者至少出现在这个比例的文档中，两者取大
+        bool count_postings;  // 是否分词统计去掉的倒排元素数，需要加载词典
+        StripOptions() : min_docs(50), min_ratio(0.01), count_postings(true) {}
+    };
+
+    struct StripReport
+    {
+        std::size_t docs;
+        uint64_t blocks;           // 参与统计的块数（按文档去重后）
+        uint64_t removed_blocks;
+        uint64_t bytes_before;
+        uint64_t bytes_removed;
+        uint64_t postings_before;  // 每个文档不同词数之和，即建索引后的倒排元素数
+        uint64_t postings_removed;
+        StripReport() : docs(0), blocks(0), removed_blocks(0), bytes_before(0), bytes_removed(0), postings_before(0), postings_removed(0) {}
+
+        void Add(const StripReport &other)
+        {
+            docs += other.docs;
+            blocks += other.blocks;
+            removed_blocks += other.removed_blocks;
+            bytes_before += other.bytes_before;
+            bytes_removed += other.bytes_removed;
+            postings_before += other.postings_before;
+            postings_removed += other.postings_removed;
+        }
+    };
+
+    // 块的指纹：去掉首尾空白；没有字母、数字或非ASCII字符的块不产生词，返回0表示不参与统计
+    inline uint64_t BlockHash(const std::string &content, uint32_t begin, uint32_t end)
+    {
+        while (begin < end && std::isspace(static_cast<unsigned char>(content[begin])))
+        {
+            begin++;
+        }
+        while (end > begin && std::isspace(static_cast<unsigned char>(content[end - 1])))
+        {
+            end--;
+        }
+        bool word = false;
+        for (uint32_t i = begin; i < end && !word; i++)
+        {
+            unsigned char c = static_cast<unsigned char>(content[i]);
+            word = c >= 0x80 || std::isalnum(c);
+        }
+        if (!word)
+        {
+            return 0;
+        }
+        uint64_t h = ns_mphf::Hash64(content.data() + begin, end - begin, 0);
+        return h == 0 ? 1 : h;
+    }
+
+    // 标题和正文分词后的不同词数，与建索引时一个文档产生的倒排元素数一致
+    inline uint64_t CountTerms(const std::string &title, const std::string &content)
+    {
+        std::unordered_set<std::string> terms;
+        std::vector<std::string> words;
+        ns_util::JiebaUtil::CutString(title, &words);
+        ns_util::JiebaUtil::CutString(content, &words);
+        for (std::string &word : words)
+        {
+            boost::to_lower(word);
+            terms.insert(std::move(word));
+        }
+        return terms.size();
+    }
+
+    // 两遍流式处理，ends[i]为源文件第i行结束时正文的长度，相邻两个位置之间就是一块
+    // 第一遍按文档逐个Observe，统计每块的文档频率；Finish确定阈值
+    // 第二遍Strip删除高频块，删掉的块换成一个空格，避免前后的词粘连；只读，可并发调用
+    class Stripper
+    {
+    private:
+        static const std::size_t kSketchWidth = 1 << 20; // 每行1M个计数器，共16MB；阈值随文档数增长，碰撞始终远小于阈值
+        StripOptions options;
+        CountMinSketch sketch;
+        std::size_t docs;
+        uint64_t blocks;
+        uint32_t threshold;
+        std::vector<uint64_t> hashes; // Observe复用的缓冲
+
+    public:
+        explicit Stripper(const StripOptions &options = StripOptions())
+            : options(options), sketch(kSketchWidth), docs(0), blocks(0), threshold(0) {}
+
+        void Observe(const std::string &content, const std::vector<uint32_t> &ends)
+        {
+            hashes.clear();
+            uint32_t prev = 0;
+            for (std::size_t b = 0; b <= ends.size(); b++)
+            {
+                uint32_t e = b < ends.size() ? ends[b] : static_cast<uint32_t>(content.size());
+                uint64_t h = BlockHash(content, prev, e);
+                if (h != 0)
+                {
+                    hashes.push_back(h);
+                }
+                prev = e;
+            }
+            // 同一文档内重复的块只算一次
+            std::sort(hashes.begin(), hashes.end());
+            hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+            for (uint64_t h : hashes)
+            {
+                sketch.Add(h);
+            }
+            blocks += hashes.size();
+            docs++;
+        }
+
+        void Finish()
+        {
+            threshold = static_cast<uint32_t>(std::max<double>(options.min_docs, options.min_ratio * docs));
+            std::vector<uint64_t>().swap(hashes);
+        }
+
+        // 结果累加到report
+        void Strip(const std::string &title, std::string *content, const std::vector<uint32_t> &ends, StripReport *report) const
+        {
+            report->docs++;
+            report->bytes_before += content->size();
+            uint64_t terms = options.count_postings ? CountTerms(title, *content) : 0;
+            report->postings_before += terms;
+            std::string kept;
+            uint32_t prev = 0;
+            uint64_t removed = 0;
+            for (std::size_t b = 0; b <= ends.size(); b++)
+            {
+                uint32_t e = b < ends.size() ? ends[b] : static_cast<uint32_t>(content->size());
+                uint64_t h = BlockHash(*content, prev, e);
+                if (h != 0 && sketch.Estimate(h) >= threshold)
+                {
+                    kept.push_back(' ');
+                    removed++;
+                }
+                else
+                {
+                    kept.append(*content, prev, e - prev);
+                }
+                prev = e;
+            }
+            if (removed == 0)
+            {
+                return;
+            }
+            report->removed_blocks += removed;
+            report->bytes_removed += content->size() - kept.size();
+            content->swap(kept);
+            if (options.count_postings)
+            {
+                report->postings_removed += terms - CountTerms(title, *content);
+            }
+        }
+
+        void Log(const StripReport &report) const
+        {
+            LOG(NORMAL, "模板文本去除完成, 文档数: " + std::to_string(docs) + " 阈值: " + std::to_string(threshold) +
+                            " 块: " + std::to_string(blocks) + " 去掉: " + std::to_string(report.removed_blocks) +
+                            " 字节: " + std::to_string(report.bytes_removed) + "/" + std::to_string(report.bytes_before) +
+                            (options.count_postings ? " 倒排元素: " + std::to_string(report.postings_removed) + "/" + std::to_string(report.postings_before) : std::string()) +
+                            " sketch字节数: " + std::to_string(sketch.Bytes()));
+        }
+
+        uint64_t Blocks() const { return blocks; }
+
+        // 全量解析后保存统计结果，增量解析时直接加载，新文档按同样的阈值去模板；本机字节序
+        bool Save(const std::string &path) const
+        {
+            FILE *fp = fopen(path.c_str(), "wb");
+            if (fp == nullptr)
+            {
+                LOG(WARNING, "open " + path + " for write error");
+                return false;
+            }
+            uint64_t header[3] = {docs, blocks, threshold};
+            bool ok = fwrite(kSketchMagic, 1, 4, fp) == 4 && fwrite(header, sizeof(header), 1, fp) == 1 && sketch.Write(fp);
+            return fclose(fp) == 0 && ok;
+        }
+
+        bool Load(const std::string &path)
+        {
+            FILE *fp = fopen(path.c_str(), "rb");
+            if (fp == nullptr)
+            {
+                return false;
+            }
+            char magic[4];
+            uint64_t header[3];
+            bool ok = fread(magic, 1, 4, fp) == 4 && std::memcmp(magic, kSketchMagic, 4) == 0 &&
+                      fread(header, sizeof(header), 1, fp) == 1 && sketch.Read(fp);
+            fclose(fp);
+            if (!ok)
+            {
+                LOG(WARNING, path + " is not a boilerplate sketch");
+                return false;
+            }
+            docs = header[0];
+            blocks = header[1];
+            threshold = static_cast<uint32_t>(header[2]);
+            return true;
+        }
+    };
+}
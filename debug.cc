@@ -2,18 +2,470 @@
 #include <iostream>
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
+#include <new>
 #include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
 #include "mysql_operations.hpp"
 #include "searcher.hpp"
+#include "arena.hpp"
+#include "threadpool.hpp"
+#include "mphf.hpp"
 
-const std::string input = "data/raw_html/raw.txt";
+const std::string input = "data/raw_html/raw.bin";
 
-int main()
+// 统计整个进程经由operator new的堆分配次数，用于观察每次查询的分配情况；线程池中并行检索的分配也计入
+// 数组和带大小的形式一并替换，new/delete成对使用malloc/free；delete不内联，否则GCC把内联后的free误报为与new不匹配
+static std::atomic<uint64_t> heap_allocs(0);
+
+void *operator new(std::size_t size)
+{
+    heap_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = std::malloc(size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// 从文件中读取测试查询，一行一条
+static bool ReadQueries(const std::string &path, std::vector<std::string> *queries)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+    {
+        std::cerr << "open " << path << " failed!" << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (!line.empty())
+        {
+            queries->push_back(line);
+        }
+    }
+    return !queries->empty();
+}
+
+// 各打分策略的单个倒排元素平均耗时
+static void BenchScore(ns_searcher::Searcher *search, const std::vector<std::string> &queries, int rounds)
+{
+    std::vector<std::vector<std::string>> cut(queries.size());
+    for (std::size_t i = 0; i < queries.size(); i++)
+    {
+        search->CutQuery(queries[i], &cut[i]);
+    }
+    const ns_scorer::ScoreMode modes[] = {ns_scorer::SCORE_RAW, ns_scorer::SCORE_TFIDF, ns_scorer::SCORE_BM25, ns_scorer::SCORE_BM25F};
+    for (ns_scorer::ScoreMode mode : modes)
+    {
+        ns_searcher::SearchOptions options;
+        options.mode = mode;
+        std::size_t postings = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (auto &words : cut)
+            {
+                ns_arena::ArenaScope arena_scope;
+                ns_searcher::PrintList results;
+                postings += search->Retrieve(words, options, &results);
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << ns_scorer::ScoreModeName(mode) << ": postings=" << postings
+                  << " total=" << ns / 1e6 << "ms"
+                  << " per_posting=" << (postings ? ns / postings : 0) << "ns" << std::endl;
+    }
+}
+
+// 线程池压力测试：多个外部线程并发提交两种优先级的任务，任务内部再嵌套分叉/等待
+static bool StressPool(int rounds)
+{
+    ns_threadpool::ThreadPool *pool = ns_threadpool::ThreadPool::GetInstance();
+    const int submitters = 8;
+    const int fanout = 16;
+    std::atomic<uint64_t> done(0);
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < submitters; t++)
+    {
+        threads.emplace_back([&, t]
+                             {
+                                 ns_threadpool::Priority priority = t % 2 ? ns_threadpool::PRIORITY_BACKGROUND : ns_threadpool::PRIORITY_INTERACTIVE;
+                                 for (int r = 0; r < rounds; r++)
+                                 {
+                                     ns_threadpool::TaskGroup group(pool, priority);
+                                     for (int i = 0; i < fanout; i++)
+                                     {
+                                         group.Run([&, priority]
+                                                   {
+                                                       // 池内线程嵌套等待，验证不会死锁
+                                                       ns_threadpool::TaskGroup inner(pool, priority);
+                                                       for (int j = 0; j < 4; j++)
+                                                       {
+                                                           inner.Run([&]
+                                                                     { done++; });
+                                                       }
+                                                       inner.Wait();
+                                                   });
+                                     }
+                                     group.Wait();
+                                 }
+                             });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t expect = static_cast<uint64_t>(submitters) * rounds * fanout * 4;
+
+    ns_threadpool::PoolStats stats = pool->Stats();
+    std::cout << "stress-pool: leaf tasks=" << done << "/" << expect << " time=" << ms << "ms"
+              << " threads=" << stats.threads << " submitted=" << stats.submitted
+              << " executed=" << stats.executed << " steals=" << stats.steals << std::endl;
+    for (std::size_t i = 0; i < stats.threads; i++)
+    {
+        std::cout << "  worker " << i << " depth interactive=" << stats.queue_depth[ns_threadpool::PRIORITY_INTERACTIVE][i]
+                  << " background=" << stats.queue_depth[ns_threadpool::PRIORITY_BACKGROUND][i] << std::endl;
+    }
+    return done == expect;
+}
+
+// 查询词查找：unordered_map与完美哈希词典（含mmap加载）的对比
+static void BenchDict(ns_index::Index *index, int rounds)
 {
+    std::vector<std::string> terms;
+    index->ListTerms(&terms);
+    if (terms.empty())
+    {
+        std::cout << "index is empty" << std::endl;
+        return;
+    }
+    std::unordered_map<std::string, uint32_t> map;
+    std::vector<uint32_t> values(terms.size());
+    for (std::size_t i = 0; i < terms.size(); i++)
+    {
+        map[terms[i]] = values[i] = i;
+    }
+    ns_mphf::PerfectHashDict dict;
+    auto build_begin = std::chrono::steady_clock::now();
+    if (!dict.Build(terms, values))
+    {
+        return;
+    }
+    double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_begin).count();
+    const std::string path = "data/term_dict.bin";
+    ns_util::MappedFile file;
+    ns_mphf::PerfectHashDict mapped;
+    if (!dict.Save(path) || !file.Open(path, nullptr, MADV_RANDOM) || !mapped.Attach(file.data(), file.size()))
+    {
+        std::cout << "save/mmap " << path << " failed" << std::endl;
+        return;
+    }
+
+    // 打乱访问顺序，一半命中一半未命中
+    std::vector<std::string> probes(terms);
+    for (std::size_t i = 0; i < terms.size(); i++)
+    {
+        probes.push_back(terms[i] + "#");
+    }
+    std::random_shuffle(probes.begin(), probes.end());
+
+    uint64_t sink = 0;
+    auto run = [&](const char *name, std::function<bool(const std::string &, uint32_t *)> find)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t hits = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            for (auto &probe : probes)
+            {
+                uint32_t v = 0;
+                if (find(probe, &v))
+                {
+                    hits++;
+                    sink += v;
+                }
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << name << ": hits=" << hits << " per_lookup=" << ns / (probes.size() * rounds) << "ns" << std::endl;
+    };
+    std::cout << "terms=" << terms.size() << " mphf bytes=" << dict.Bytes() << " build=" << build_ms << "ms" << std::endl;
+    run("unordered_map", [&](const std::string &key, uint32_t *v)
+        {
+            auto iter = map.find(key);
+            if (iter == map.end())
+                return false;
+            *v = iter->second;
+            return true;
+        });
+    run("mphf", [&](const std::string &key, uint32_t *v)
+        { return dict.Find(key, v); });
+    run("mphf(mmap)", [&](const std::string &key, uint32_t *v)
+        { return mapped.Find(key, v); });
+    std::cout << "checksum=" << sink << std::endl;
+}
+
+// 检索并返回前k个doc_id
+static std::vector<uint64_t> TopDocs(ns_searcher::Searcher *search, const std::vector<std::string> &words,
+                                     const ns_searcher::SearchOptions &options, std::size_t *scanned)
+{
+    ns_arena::ArenaScope arena_scope;
+    ns_searcher::PrintList results;
+    *scanned = search->Retrieve(words, options, &results);
+    std::size_t k = std::min(options.top_k, results.size());
+    std::partial_sort(results.begin(), results.begin() + k, results.end(),
+                      [](const ns_searcher::InvertedElemPrint &e1, const ns_searcher::InvertedElemPrint &e2)
+                      { return e1.weight > e2.weight; });
+    std::vector<uint64_t> docs;
+    for (std::size_t i = 0; i < k; i++)
+    {
+        docs.push_back(results[i].doc_id);
+    }
+    return docs;
+}
+
+// 影响力分层提前终止 vs 穷举BM25：前k名召回率与耗时
+static void BenchEarly(ns_searcher::Searcher *search, const std::vector<std::string> &queries, std::size_t k)
+{
+    ns_searcher::SearchOptions exhaustive;
+    exhaustive.mode = ns_scorer::SCORE_BM25;
+    exhaustive.top_k = k;
+    ns_searcher::SearchOptions early = exhaustive;
+    early.early = true;
+
+    double exhaustive_ms = 0, early_ms = 0, recall = 0;
+    std::size_t exhaustive_scanned = 0, early_scanned = 0;
+    for (auto &query : queries)
+    {
+        std::vector<std::string> words;
+        search->CutQuery(query, &words);
+        std::size_t scanned = 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<uint64_t> truth = TopDocs(search, words, exhaustive, &scanned);
+        auto t1 = std::chrono::steady_clock::now();
+        exhaustive_scanned += scanned;
+        std::vector<uint64_t> got = TopDocs(search, words, early, &scanned);
+        auto t2 = std::chrono::steady_clock::now();
+        early_scanned += scanned;
+
+        exhaustive_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        early_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        std::size_t hit = 0;
+        for (uint64_t doc : got)
+        {
+            hit += std::count(truth.begin(), truth.end(), doc);
+        }
+        recall += truth.empty() ? 1.0 : static_cast<double>(hit) / truth.size();
+    }
+    std::size_t n = queries.size();
+    std::cout << "queries=" << n << " k=" << k << std::endl;
+    std::cout << "exhaustive: avg=" << exhaustive_ms / n << "ms postings=" << exhaustive_scanned << std::endl;
+    std::cout << "early     : avg=" << early_ms / n << "ms postings=" << early_scanned
+              << " recall@" << k << "=" << recall / n << std::endl;
+}
+
+// 词对索引：覆盖的查询比例，以及使用/不使用词对拉链的耗时
+static void BenchPair(ns_searcher::Searcher *search, const std::vector<std::string> &queries, int rounds)
+{
+    const ns_pair::PairIndex &pairs = search->GetPairIndex();
+    std::size_t covered = 0;
+    std::vector<std::vector<std::string>> cut(queries.size());
+    for (std::size_t i = 0; i < queries.size(); i++)
+    {
+        search->CutQuery(queries[i], &cut[i]);
+        bool hit = false;
+        for (std::size_t a = 0; a < cut[i].size() && !hit; a++)
+        {
+            for (std::size_t b = a + 1; b < cut[i].size() && !hit; b++)
+            {
+                bool swapped = false;
+                hit = pairs.Find(cut[i][a], cut[i][b], &swapped) != nullptr;
+            }
+        }
+        covered += hit ? 1 : 0;
+    }
+    std::cout << "pairs=" << pairs.Size() << " bytes=" << pairs.Bytes() << std::endl;
+    std::cout << "covered queries: " << covered << "/" << queries.size() << std::endl;
+
+    for (int use = 0; use < 2; use++)
+    {
+        ns_searcher::SearchOptions options;
+        options.pairs = use == 1;
+        std::size_t scanned = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (auto &words : cut)
+            {
+                ns_arena::ArenaScope arena_scope;
+                ns_searcher::PrintList results;
+                scanned += search->Retrieve(words, options, &results);
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (use ? "with pairs   : " : "without pairs: ") << "avg=" << ms / (rounds * cut.size())
+                  << "ms postings=" << scanned / rounds << std::endl;
+    }
+    ns_pair::PairCoverage coverage = pairs.Coverage();
+    std::cout << "runtime coverage: " << coverage.covered << "/" << coverage.queries << " multi-term queries" << std::endl;
+}
+
+// 阶段计时的开销：同一组查询交替关闭、打开统计各跑一轮，比较平均耗时，最后输出各阶段分位数
+static void BenchMetrics(ns_searcher::Searcher *search, const std::vector<std::string> &queries, int rounds)
+{
+    ns_metrics::Registry &registry = ns_metrics::Registry::Instance();
+    // 慢查询日志也会计时，测量期间关闭，使off一组完全不计时
+    double slow_ms = search->GetSlowQueryThreshold();
+    search->SetSlowQueryThreshold(0);
+    std::string json_string;
+    double seconds[2] = {0, 0};
+    for (int r = 0; r < rounds * 2; r++)
+    {
+        bool on = r % 2 == 1;
+        registry.SetEnabled(on);
+        auto start = std::chrono::steady_clock::now();
+        for (auto &query : queries)
+        {
+            search->Search(query, &json_string);
+        }
+        seconds[on] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    registry.SetEnabled(true);
+    search->SetSlowQueryThreshold(slow_ms);
+    double n = static_cast<double>(rounds) * queries.size();
+    std::cout << "off: " << seconds[0] / n * 1e6 << "us/query  on: " << seconds[1] / n * 1e6
+              << "us/query  overhead: " << (seconds[1] / seconds[0] - 1) * 100 << "%" << std::endl;
+    for (int s = 0; s < ns_metrics::STAGE_COUNT; s++)
+    {
+        ns_metrics::Summary sum = registry.Summarize(s);
+        if (sum.count == 0)
+        {
+            continue;
+        }
+        std::cout << ns_metrics::StageName(s) << ": count=" << sum.count << " avg=" << sum.sum / sum.count * 1e6
+                  << "us p50=" << sum.p50 * 1e6 << "us p99=" << sum.p99 * 1e6 << "us max=" << sum.max * 1e6 << "us" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // ./debug stress-pool [rounds] [threads]
+    if (argc >= 2 && std::string(argv[1]) == "stress-pool")
+    {
+        ns_threadpool::PoolOptions options;
+        options.threads = argc >= 4 ? std::atoi(argv[3]) : 0;
+        ns_threadpool::ThreadPool::Configure(options);
+        return StressPool(argc >= 3 ? std::atoi(argv[2]) : 1000) ? 0 : 1;
+    }
+
     // test
     ns_searcher::Searcher *search = new ns_searcher::Searcher();
     search->InitSearcher(input);
 
+    // ./debug bench-dict [rounds]
+    if (argc >= 2 && std::string(argv[1]) == "bench-dict")
+    {
+        BenchDict(ns_index::Index::GetInstance(), argc >= 3 ? std::atoi(argv[2]) : 10);
+        return 0;
+    }
+
+    // ./debug bench-early queries.txt [k]
+    if (argc >= 3 && std::string(argv[1]) == "bench-early")
+    {
+        std::vector<std::string> queries;
+        if (!ReadQueries(argv[2], &queries))
+        {
+            return 1;
+        }
+        BenchEarly(search, queries, argc >= 4 ? std::atoi(argv[3]) : 10);
+        return 0;
+    }
+
+    // ./debug bench-pair queries.txt [budget_mb] [cooc]
+    // 默认以queries.txt作为查询日志重建词对索引，指定cooc时按共现统计建立
+    if (argc >= 3 && std::string(argv[1]) == "bench-pair")
+    {
+        std::vector<std::string> queries;
+        if (!ReadQueries(argv[2], &queries))
+        {
+            return 1;
+        }
+        ns_pair::PairOptions options;
+        if (argc >= 4)
+        {
+            options.budget = static_cast<std::size_t>(std::atoi(argv[3])) << 20;
+        }
+        if (argc < 5 || std::string(argv[4]) != "cooc")
+        {
+            options.query_log = argv[2];
+        }
+        search->BuildPairs(options);
+        BenchPair(search, queries, 10);
+        return 0;
+    }
+
+    // ./debug bench-score queries.txt [rounds]
+    if (argc >= 3 && std::string(argv[1]) == "bench-score")
+    {
+        std::vector<std::string> queries;
+        if (!ReadQueries(argv[2], &queries))
+        {
+            return 1;
+        }
+        BenchScore(search, queries, argc >= 4 ? std::atoi(argv[3]) : 10);
+        return 0;
+    }
+
+    // ./debug bench-metrics queries.txt [rounds]
+    if (argc >= 3 && std::string(argv[1]) == "bench-metrics")
+    {
+        std::vector<std::string> queries;
+        if (!ReadQueries(argv[2], &queries))
+        {
+            return 1;
+        }
+        BenchMetrics(search, queries, argc >= 4 ? std::atoi(argv[3]) : 10);
+        return 0;
+    }
+
     std::string query;
     std::string json_string;
     char buffer[1024];
@@ -23,8 +475,18 @@ int main()
         fgets(buffer, sizeof(buffer) - 1, stdin);
         buffer[strlen(buffer) - 1] = 0;
         query = buffer;
+        uint64_t heap_begin = heap_allocs;
         search->Search(query, &json_string);
+        uint64_t heap = heap_allocs - heap_begin;
         std::cout << json_string << std::endl;
+
+        // before: 不使用arena时，arena承接的每次分配都会落到malloc上
+        // after : 实际的堆分配次数 = 仍走operator new的 + arena新申请的内存块
+        const ns_arena::QueryAllocs &allocs = ns_arena::ArenaScope::Last();
+        std::cout << "allocs per query: before=" << heap + allocs.requests
+                  << " after=" << heap + allocs.blocks
+                  << " (heap=" << heap << ", arena requests=" << allocs.requests
+                  << ", arena blocks=" << allocs.blocks << ")" << std::endl;
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,212 @@
+#pragma once
+// 分面：文档URL由url_head加data/input下的相对路径拼成，从路径中解析库名、文档分区和版本
+// 每个分面取值对应一张压缩位图，过滤在打分前做位图交集，分面计数按位图求交集基数
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include "index.hpp"
+#include "roaring.hpp"
+#include "log.hpp"
+
+namespace ns_facet
+{
+    enum FacetField
+    {
+        FACET_LIB,     // 库名，如asio
+        FACET_SECTION, // 库内的文档分区，如reference；库的首页为main
+        FACET_VERSION, // 如1_83_0
+        FACET_FIELDS
+    };
+
+    inline const char *FacetName(int field)
+    {
+        static const char *const names[FACET_FIELDS] = {"lib", "section", "version"};
+        return names[field];
+    }
+
+    // 一个分面的计数，按数量降序
+    typedef std::vector<std::pair<std::string, uint64_t>> FacetCounts;
+
+    class FacetIndex
+    {
+    private:
+        std::unordered_map<std::string, ns_roaring::Bitmap> bitmaps[FACET_FIELDS];
+
+    public:
+        // https://www.boost.org/doc/libs/1_83_0/boost_asio/reference/xxx.html -> asio, reference, 1_83_0
+        // 同样支持 .../libs/asio/doc/html/... 形式；解析不出的分面留空
+        static void ParseUrl(const std::string &url, std::string values[FACET_FIELDS])
+        {
+            std::size_t start = url.find("://");
+            start = start == std::string::npos ? 0 : url.find('/', start + 3);
+            std::vector<std::string> segs;
+            ns_util::StringUtil::Split(start == std::string::npos ? "" : url.substr(start), &segs, "/");
+            segs.erase(std::remove(segs.begin(), segs.end(), std::string()), segs.end());
+            for (auto &seg : segs)
+            {
+                boost::to_lower(seg);
+            }
+
+            std::size_t i = 0;
+            if (i + 1 < segs.size() && segs[i] == "doc" && segs[i + 1] == "libs")
+            {
+                i += 2;
+            }
+            if (i < segs.size() && IsVersion(segs[i]))
+            {
+                values[FACET_VERSION] = segs[i++];
+            }
+            SkipDocHtml(segs, &i);
+            if (i + 1 < segs.size() && segs[i] == "libs")
+            {
+                values[FACET_LIB] = segs[i + 1];
+                i += 2;
+                SkipDocHtml(segs, &i);
+            }
+            else if (i < segs.size())
+            {
+                std::string lib = StripExtension(segs[i++]);
+                if (lib.compare(0, 6, "boost_") == 0 && lib.size() > 6)
+                {
+                    lib = lib.substr(6);
+                }
+                values[FACET_LIB] = lib;
+            }
+            // 剩余部分至少还有一级目录时，目录名就是分区
+            if (!values[FACET_LIB].empty())
+            {
+                values[FACET_SECTION] = i + 1 < segs.size() ? segs[i] : "main";
+            }
+        }
+
+        void Build(ns_index::Index *idx)
+        {
+            for (int f = 0; f < FACET_FIELDS; f++)
+            {
+                bitmaps[f].clear();
+            }
+            std::size_t bytes = 0;
+            const uint64_t doc_count = idx->TitleLens().size();
+            for (uint64_t doc_id = 0; doc_id < doc_count; doc_id++)
+            {
+                ns_index::DocInfo *doc = idx->GetForwardIndex(doc_id);
+                std::string values[FACET_FIELDS];
+                ParseUrl(doc->url, values);
+                for (int f = 0; f < FACET_FIELDS; f++)
+                {
+                    if (!values[f].empty())
+                    {
+                        bitmaps[f][values[f]].Add(static_cast<uint32_t>(doc_id));
+                    }
+                }
+            }
+            std::string summary;
+            for (int f = 0; f < FACET_FIELDS; f++)
+            {
+                for (auto &item : bitmaps[f])
+                {
+                    item.second.ShrinkToFit();
+                    bytes += item.second.Bytes();
+                }
+                summary += std::string(" ") + FacetName(f) + ": " + std::to_string(bitmaps[f].size());
+            }
+            LOG(NORMAL, "分面位图建立完成," + summary + " 字节数: " + std::to_string(bytes));
+        }
+
+        const ns_roaring::Bitmap *Get(FacetField field, const std::string &value) const
+        {
+            auto iter = bitmaps[field].find(value);
+            return iter == bitmaps[field].end() ? nullptr : &iter->second;
+        }
+
+        // 同一分面的多个取值取并集，不同分面取交集
+        // 没有过滤条件返回false；有条件但没有文档满足时out为空
+        bool Filter(const std::vector<std::pair<FacetField, std::string>> &filters, ns_roaring::Bitmap *out) const
+        {
+            if (filters.empty())
+            {
+                return false;
+            }
+            bool first = true;
+            for (int f = 0; f < FACET_FIELDS; f++)
+            {
+                ns_roaring::Bitmap any;
+                bool used = false;
+                for (auto &filter : filters)
+                {
+                    if (filter.first != f)
+                    {
+                        continue;
+                    }
+                    used = true;
+                    const ns_roaring::Bitmap *bitmap = Get(filter.first, filter.second);
+                    if (bitmap != nullptr)
+                    {
+                        any = ns_roaring::Bitmap::Or(any, *bitmap);
+                    }
+                }
+                if (!used)
+                {
+                    continue;
+                }
+                *out = first ? std::move(any) : ns_roaring::Bitmap::And(*out, any);
+                first = false;
+            }
+            return true;
+        }
+
+        // hits中每个分面取值的文档数，只保留非0项
+        void Count(const ns_roaring::Bitmap &hits, FacetCounts counts[FACET_FIELDS]) const
+        {
+            for (int f = 0; f < FACET_FIELDS; f++)
+            {
+                counts[f].clear();
+                for (auto &item : bitmaps[f])
+                {
+                    uint64_t n = ns_roaring::Bitmap::AndCardinality(hits, item.second);
+                    if (n > 0)
+                    {
+                        counts[f].push_back(std::make_pair(item.first, n));
+                    }
+                }
+                std::sort(counts[f].begin(), counts[f].end(),
+                          [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b)
+                          { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+            }
+        }
+
+    private:
+        static bool IsVersion(const std::string &seg)
+        {
+            bool digit = false;
+            for (char c : seg)
+            {
+                if (std::isdigit(static_cast<unsigned char>(c)))
+                {
+                    digit = true;
+                }
+                else if (c != '_' && c != '.')
+                {
+                    return false;
+                }
+            }
+            return digit;
+        }
+
+        static void SkipDocHtml(const std::vector<std::string> &segs, std::size_t *i)
+        {
+            while (*i + 1 < segs.size() && (segs[*i] == "doc" || segs[*i] == "html"))
+            {
+                (*i)++;
+            }
+        }
+
+        static std::string StripExtension(const std::string &seg)
+        {
+            std::size_t dot = seg.find('.');
+            return dot == std::string::npos ? seg : seg.substr(0, dot);
+        }
+    };
+}
@@ -4,6 +4,8 @@
 
 int main()
 {
+    // 日志由后台线程写入log/log.txt并按大小轮转
+    ns_log::SetFile("log/log.txt");
     ns_httpserver::Server svr(8081);
     svr.RunModule();
 
@@ -2,15 +2,19 @@
 #include "cpp-httplib/httplib.h"
 #include "searcher.hpp"
 #include "mysql_operations.hpp"
+#include "session.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
 #include "log.hpp"
 
 namespace ns_httpserver
 {
     const std::string root_path = "./wwwroot";
-    const std::string input = "data/raw_html/raw.txt";
+    const std::string input = "data/raw_html/raw.bin";
     ns_searcher::Searcher search;
     ns_operation::TableUser *tb_user = nullptr;
     ns_operation::TableDoc *tb_doc = nullptr;
+    ns_session::SessionCache sessions;
     class Server
     {
     private:
@@ -39,16 +43,9 @@ namespace ns_httpserver
             // 进行账号和密码验证
             if (!account.empty() && !password.empty())
             {
-                if (tb_user->ValidateLogin(account, password) == true)
+                std::string json_string;
+                if (tb_user->ValidateLogin(account, password) == true && StartSession(account, &json_string, rsp))
                 {
-                    rsp.set_header("Set-Cookie", "account=" + account + "; path=/");
-                    rsp.set_header("Set-Cookie", "password=" + password + "; path=/");
-
-                    rsp.body = R"({"result":true,"reason":"登录成功"})";
-                    Json::Value user;
-                    tb_user->SelectOne(account,user);
-                    std::string json_string;
-                    ns_util::JsonUtil::Serialize(user, json_string);
                     rsp.set_content(json_string, "application/json");
                     rsp.status = 200;
                     return;
@@ -94,9 +91,27 @@ namespace ns_httpserver
             return;
         }
 
+        static bool ParseBoost(const httplib::Request &req, const char *name, float *boost)
+        {
+            if (!req.has_param(name))
+            {
+                return true;
+            }
+            std::string value = req.get_param_value(name);
+            char *end = nullptr;
+            double v = std::strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || !(v >= 0))
+            {
+                return false;
+            }
+            *boost = static_cast<float>(v);
+            return true;
+        }
+
         // 搜索功能
         static void SearchFunction(const httplib::Request &req, httplib::Response &rsp)
         {
+            ns_metrics::ScopedTimer timer(ns_metrics::STAGE_REQUEST);
             if (!req.has_param("word"))
             {
                 rsp.set_content("需要搜素关键字!", "text/plain; charset=utf-8");
@@ -104,46 +119,269 @@ namespace ns_httpserver
             }
             std::string word = req.get_param_value("word");
             LOG(NORMAL, "正在搜素: " + word);
+            ns_searcher::SearchOptions options;
+            // score=raw|tfidf|bm25|bm25f 按请求选择打分策略
+            if (req.has_param("score") && !ns_scorer::ParseScoreMode(req.get_param_value("score"), &options.mode))
+            {
+                rsp.set_content("未知的打分策略!", "text/plain; charset=utf-8");
+                rsp.status = 400;
+                return;
+            }
+            if (req.has_param("k"))
+            {
+                options.top_k = std::strtoul(req.get_param_value("k").c_str(), nullptr, 10);
+            }
+            // title_boost、content_boost 按请求调整字段权重，默认1
+            if (!ParseBoost(req, "title_boost", &options.boosts.title) || !ParseBoost(req, "content_boost", &options.boosts.content))
+            {
+                rsp.set_content("字段权重需为非负数!", "text/plain; charset=utf-8");
+                rsp.status = 400;
+                return;
+            }
+            // lib=asio&section=reference&version=1_83_0 分面过滤，同一分面可出现多次（取并集）
+            for (int f = 0; f < ns_facet::FACET_FIELDS; f++)
+            {
+                const char *name = ns_facet::FacetName(f);
+                for (std::size_t i = 0; i < req.get_param_value_count(name); i++)
+                {
+                    options.filters.push_back(std::make_pair(static_cast<ns_facet::FacetField>(f), req.get_param_value(name, i)));
+                }
+            }
+            // facets=1 返回分面计数
+            options.facets = req.get_param_value("facets") == "1";
+            // early=1 走影响力分层并提前终止，用于和穷举检索做A/B对比
+            options.early = req.get_param_value("early") == "1";
+            // explain=1 附带查询词、拉链长度、扫描/跳过的倒排元素数、候选数和各阶段耗时
+            options.explain = req.get_param_value("explain") == "1";
             std::string json_string;
-            search.Search(word, &json_string);
+            search.Search(word, options, &json_string);
             rsp.set_content(json_string, "application/json");
         }
 
-        // 检查Cookie
-        static void CheckCookie(const httplib::Request &req, httplib::Response &rsp)
+        // 取Cookie头中name对应的值，不存在时返回空串
+        static std::string CookieValue(const std::string &cookie, const std::string &name)
         {
-            std::string cookie = req.get_header_value("Cookie");
-            std::string account, password;
-            if (cookie.find("account=") != std::string::npos)
+            std::size_t pos = 0;
+            while (pos < cookie.size())
             {
-                size_t start = cookie.find("account=") + 8; // cookie中存储的格式为 "account=xxx"
-                size_t end = cookie.find(";", start);
-                account = cookie.substr(start, end - start);
+                std::size_t end = cookie.find(';', pos);
+                if (end == std::string::npos)
+                {
+                    end = cookie.size();
+                }
+                while (pos < end && cookie[pos] == ' ')
+                {
+                    pos++;
+                }
+                if (cookie.compare(pos, name.size(), name) == 0 && pos + name.size() < end && cookie[pos + name.size()] == '=')
+                {
+                    return cookie.substr(pos + name.size() + 1, end - pos - name.size() - 1);
+                }
+                pos = end + 1;
             }
-            if (cookie.find("password=") != std::string::npos)
+            return std::string();
+        }
+
+        // 查询用户资料并新建会话，资料写入profile，Cookie中只放token
+        static bool StartSession(const std::string &account, std::string *profile, httplib::Response &rsp)
+        {
+            Json::Value user;
+            if (!tb_user->SelectOne(account, user) || !ns_util::JsonUtil::Serialize(user, *profile))
             {
-                size_t start = cookie.find("password=") + 9; // cookie中存储的格式为 "password=xxx"
-                size_t end = cookie.find(";", start);
-                password = cookie.substr(start, end - start);
+                return false;
             }
+            std::string token = sessions.Create(account, *profile);
+            rsp.set_header("Set-Cookie", "session=" + token + "; path=/; HttpOnly");
+            return true;
+        }
+
+        // 检查Cookie：有效会话直接返回缓存的用户资料，不访问数据库
+        // 旧版Cookie中的账号密码校验通过后换发会话
+        static void CheckCookie(const httplib::Request &req, httplib::Response &rsp)
+        {
+            std::string cookie = req.get_header_value("Cookie");
+            std::string token = CookieValue(cookie, "session");
+            std::string json_string;
+            if (!token.empty() && sessions.Lookup(token, &json_string))
+            {
+                rsp.set_content(json_string, "application/json");
+                rsp.status = 200;
+                return;
+            }
+            std::string account = CookieValue(cookie, "account");
+            std::string password = CookieValue(cookie, "password");
             if (!account.empty() && !password.empty())
             {
-
-                if(tb_user->ValidateLogin(account, password))
+                if (tb_user->ValidateLogin(account, password) && StartSession(account, &json_string, rsp))
                 {
-                    rsp.set_header("Content-Type", "application/json");
-                    rsp.body = R"({"result":true,"reason":"已登录"})";
+                    // 换发会话后让浏览器删除明文账号密码，Set-Cookie可以有多个
+                    rsp.set_header("Set-Cookie", "account=; path=/; Max-Age=0");
+                    rsp.set_header("Set-Cookie", "password=; path=/; Max-Age=0");
+                    rsp.set_content(json_string, "application/json");
                     rsp.status = 200;
+                    return;
+                }
+            }
+        }
 
-                    Json::Value user;
-                    tb_user->SelectOne(account, user);
-                    std::string json_string;
-                    ns_util::JsonUtil::Serialize(user, json_string);
-                    rsp.set_content(json_string, "application/json");
+        // 连接池和会话缓存指标：等待次数和累计等待时间持续上涨说明连接数不够
+        static void DbStatus(const httplib::Request &, httplib::Response &rsp)
+        {
+            ns_mysqlpool::PoolStats stats = tb_user->ConnectionStats();
+            Json::Value root;
+            root["max_size"] = static_cast<Json::UInt64>(stats.max_size);
+            root["size"] = static_cast<Json::UInt64>(stats.size);
+            root["idle"] = static_cast<Json::UInt64>(stats.idle);
+            root["acquires"] = static_cast<Json::UInt64>(stats.acquires);
+            root["waits"] = static_cast<Json::UInt64>(stats.waits);
+            root["timeouts"] = static_cast<Json::UInt64>(stats.timeouts);
+            root["reconnects"] = static_cast<Json::UInt64>(stats.reconnects);
+            root["wait_seconds"] = stats.wait_seconds;
+            root["max_wait_seconds"] = stats.max_wait_seconds;
+            ns_session::SessionStats session_stats = sessions.Stats();
+            root["sessions"] = static_cast<Json::UInt64>(session_stats.sessions);
+            root["session_hits"] = static_cast<Json::UInt64>(session_stats.hits);
+            root["session_misses"] = static_cast<Json::UInt64>(session_stats.misses);
+            root["session_invalidated"] = static_cast<Json::UInt64>(session_stats.invalidated);
+            std::string json_string;
+            ns_util::JsonUtil::Serialize(root, json_string);
+            rsp.set_content(json_string, "application/json");
+        }
 
+        // Prometheus文本格式的运行指标：/s各阶段延迟、QPS、会话缓存命中率、连接池、索引规模
+        static void Metrics(const httplib::Request &, httplib::Response &rsp)
+        {
+            std::string out;
+            ns_metrics::AppendStages(&out);
+
+            // QPS按两次抓取之间的请求数计算
+            static std::mutex mtx;
+            static uint64_t last_requests = 0;
+            static std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+            uint64_t requests = ns_metrics::Registry::Instance().Summarize(ns_metrics::STAGE_REQUEST).count;
+            double qps = 0;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                auto now = std::chrono::steady_clock::now();
+                double seconds = std::chrono::duration<double>(now - last_time).count();
+                qps = seconds > 0 ? (requests - last_requests) / seconds : 0;
+                last_requests = requests;
+                last_time = now;
+            }
+            ns_metrics::AppendHeader(&out, "search_requests_total", "counter", "Number of /s requests");
+            ns_metrics::AppendValue(&out, "search_requests_total", static_cast<double>(requests));
+            ns_metrics::AppendHeader(&out, "search_qps", "gauge", "Requests per second since the previous scrape");
+            ns_metrics::AppendValue(&out, "search_qps", qps);
+
+            ns_session::SessionStats session = sessions.Stats();
+            uint64_t lookups = session.hits + session.misses;
+            ns_metrics::AppendHeader(&out, "session_cache_hits_total", "counter", "Cookie checks answered from the session cache");
+            ns_metrics::AppendValue(&out, "session_cache_hits_total", static_cast<double>(session.hits));
+            ns_metrics::AppendHeader(&out, "session_cache_misses_total", "counter", "Cookie checks with an unknown or expired token");
+            ns_metrics::AppendValue(&out, "session_cache_misses_total", static_cast<double>(session.misses));
+            ns_metrics::AppendHeader(&out, "session_cache_hit_ratio", "gauge", "Session cache hit ratio since start");
+            ns_metrics::AppendValue(&out, "session_cache_hit_ratio", lookups ? static_cast<double>(session.hits) / lookups : 0);
+            ns_metrics::AppendHeader(&out, "session_cache_sessions", "gauge", "Live sessions");
+            ns_metrics::AppendValue(&out, "session_cache_sessions", static_cast<double>(session.sessions));
+
+            ns_mysqlpool::PoolStats pool = tb_user->ConnectionStats();
+            ns_metrics::AppendHeader(&out, "db_pool_wait_seconds_total", "counter", "Time spent waiting for a MySQL connection");
+            ns_metrics::AppendValue(&out, "db_pool_wait_seconds_total", pool.wait_seconds);
+            ns_metrics::AppendHeader(&out, "db_pool_waits_total", "counter", "Acquires that had to wait");
+            ns_metrics::AppendValue(&out, "db_pool_waits_total", static_cast<double>(pool.waits));
+            ns_metrics::AppendHeader(&out, "db_pool_connections", "gauge", "Open MySQL connections");
+            ns_metrics::AppendValue(&out, "db_pool_connections", static_cast<double>(pool.size));
+
+            ns_index::Index *index = ns_index::Index::GetInstance();
+            ns_metrics::AppendHeader(&out, "index_documents", "gauge", "Live documents in the index");
+            ns_metrics::AppendValue(&out, "index_documents", static_cast<double>(index->GetStats().doc_count));
+            ns_metrics::AppendHeader(&out, "index_doc_slots", "gauge", "Document slots including removed ones");
+            ns_metrics::AppendValue(&out, "index_doc_slots", static_cast<double>(index->SlotCount()));
+            ns_metrics::AppendHeader(&out, "index_terms", "gauge", "Distinct terms in the inverted index");
+            ns_metrics::AppendValue(&out, "index_terms", static_cast<double>(index->TermCount()));
+
+            ns_pair::PairCoverage pairs = search.GetPairIndex().Coverage();
+            ns_metrics::AppendHeader(&out, "pair_queries_total", "counter", "Queries with two or more terms checked against the pair index");
+            ns_metrics::AppendValue(&out, "pair_queries_total", static_cast<double>(pairs.queries));
+            ns_metrics::AppendHeader(&out, "pair_covered_total", "counter", "Queries answered with a precomputed pair list");
+            ns_metrics::AppendValue(&out, "pair_covered_total", static_cast<double>(pairs.covered));
+
+            ns_metrics::AppendHeader(&out, "trace_spans_dropped_total", "counter", "Spans dropped by the per-request cap");
+            ns_metrics::AppendValue(&out, "trace_spans_dropped_total", static_cast<double>(ns_trace::Tracer::Instance().Dropped()));
+
+            rsp.set_content(out, "text/plain; version=0.0.4");
+        }
+
+        // 导出各线程最近的追踪span，Chrome trace-event格式；sample=N 把采样率改为每N个请求1个，0表示关闭
+        static void DumpTrace(const httplib::Request &req, httplib::Response &rsp)
+        {
+            if (req.has_param("sample"))
+            {
+                ns_trace::Tracer::Instance().SetSampleEvery(static_cast<uint32_t>(std::strtoul(req.get_param_value("sample").c_str(), nullptr, 10)));
+            }
+            std::string out;
+            ns_trace::Tracer::Instance().Dump(&out);
+            rsp.set_header("Content-Disposition", "attachment; filename=trace.json");
+            rsp.set_content(out, "application/json");
+        }
+
+        // /debug/profile?seconds=N&hz=M 对整个进程做N秒CPU采样，返回folded stacks，可直接生成火焰图
+        // 采样期间占用一个http工作线程；同一时间只允许一次，其余返回409
+        static void Profile(const httplib::Request &req, httplib::Response &rsp)
+        {
+            int seconds = req.has_param("seconds") ? std::atoi(req.get_param_value("seconds").c_str()) : 10;
+            int hz = req.has_param("hz") ? std::atoi(req.get_param_value("hz").c_str()) : ns_profiler::kDefaultHz;
+            if (seconds < 1 || seconds > ns_profiler::kMaxSeconds || hz < 1 || hz > ns_profiler::kMaxHz)
+            {
+                rsp.set_content("seconds需在1~" + std::to_string(ns_profiler::kMaxSeconds) + "之间, hz需在1~" +
+                                    std::to_string(ns_profiler::kMaxHz) + "之间!",
+                                "text/plain; charset=utf-8");
+                rsp.status = 400;
+                return;
+            }
+            ns_profiler::ProfileResult result;
+            std::string error;
+            if (!ns_profiler::Profiler::Instance().Profile(seconds, hz, &result, &error))
+            {
+                rsp.set_content(error, "text/plain; charset=utf-8");
+                rsp.status = 409;
+                return;
+            }
+            rsp.set_header("X-Profile-Samples", std::to_string(result.samples));
+            rsp.set_header("X-Profile-Lost", std::to_string(result.lost));
+            rsp.set_content(result.folded, "text/plain; charset=utf-8");
+        }
+
+        typedef std::function<void(const httplib::Request &, httplib::Response &)> Handler;
+
+        // 给处理函数套上请求追踪：分配请求id并写入X-Request-Id响应头，整个处理过程记为一个span；trace=1强制采样
+        // httplib在工作线程取到连接之后才调用处理函数，在线程池队列中等待的时间无法记录
+        static Handler Traced(const char *name, Handler handler)
+        {
+            return [name, handler](const httplib::Request &req, httplib::Response &rsp)
+            {
+                ns_trace::RequestScope scope(req.get_param_value("trace") == "1");
+                ns_trace::Span span(name, "http");
+                rsp.set_header("X-Request-Id", std::to_string(ns_trace::RequestId()));
+                handler(req, rsp);
+            };
+        }
+
+        // 调试接口只接受本机请求：可以启动采样、修改追踪采样率，不能暴露在0.0.0.0上
+        static Handler LocalOnly(Handler handler)
+        {
+            return [handler](const httplib::Request &req, httplib::Response &rsp)
+            {
+                const std::string &addr = req.remote_addr;
+                if (addr.compare(0, 4, "127.") != 0 && addr != "::1" && addr.compare(0, 11, "::ffff:127.") != 0)
+                {
+                    LOG(WARNING, "拒绝来自" + addr + "的调试请求");
+                    rsp.set_content("仅允许本机访问!", "text/plain; charset=utf-8");
+                    rsp.status = 403;
                     return;
                 }
-            }
+                handler(req, rsp);
+            };
         }
 
     public:
@@ -152,16 +390,23 @@ namespace ns_httpserver
         bool RunModule()
         {
             search.InitSearcher(input);
-            tb_user = new ns_operation::TableUser();
+            // 每个http工作线程最多同时占用一个连接
+            tb_user = new ns_operation::TableUser(CPPHTTPLIB_THREAD_POOL_COUNT);
+            tb_user->OnChange([](const std::string &account)
+                              { sessions.InvalidateAccount(account); });
             tb_doc = new ns_operation::TableDoc();
             // 设置主页
             svr.set_base_dir(root_path.c_str());
 
             // 设置回调函数
-            svr.Get("/s", SearchFunction);
-            svr.Post("/login", Login);
-            svr.Get("/l", CheckCookie);
-            svr.Post("/register", Register);
+            svr.Get("/s", Traced("GET /s", SearchFunction));
+            svr.Post("/login", Traced("POST /login", Login));
+            svr.Get("/l", Traced("GET /l", CheckCookie));
+            svr.Post("/register", Traced("POST /register", Register));
+            svr.Get("/status/db", DbStatus);
+            svr.Get("/metrics", Metrics);
+            svr.Get("/debug/trace", LocalOnly(DumpTrace));
+            svr.Get("/debug/profile", LocalOnly(Profile));
 
             LOG(NORMAL, "服务器启动成功!");
 
@@ -0,0 +1,125 @@
+#pragma once
+// 按影响力排序的分层索引：高频词的拉链按量化后的得分从高到低存放，查询时可提前终止
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "index.hpp"
+#include "scorer.hpp"
+
+namespace ns_impact
+{
+    // 影响力相同的一段倒排元素，[上一段的end, end)
+    struct ImpactRun
+    {
+        uint8_t impact;
+        uint32_t end;
+    };
+
+    // 一个词的影响力层：doc_id按影响力降序排列，影响力按段存放，每个元素只占4字节
+    struct ImpactList
+    {
+        std::vector<uint32_t> docs;
+        std::vector<ImpactRun> runs;
+    };
+
+    // 影响力统一用BM25得分量化到[1, 255]，不同词的影响力可以直接相加
+    class ImpactIndex
+    {
+    private:
+        std::unordered_map<const ns_index::InvertedList *, ImpactList> tiers;
+        float max_score; // 全部倒排元素中最大的BM25得分，作为量化上限
+        std::size_t postings;
+
+    public:
+        ImpactIndex() : max_score(0), postings(0) {}
+
+        // 只为文档频率不低于min_df的词建立影响力层，低频词查询时直接现算
+        void Build(ns_index::Index *idx, std::size_t min_df)
+        {
+            tiers.clear();
+            postings = 0;
+            std::vector<std::string> terms;
+            idx->ListTerms(&terms);
+
+            const ns_index::CollectionStats &stats = idx->GetStats();
+            const uint32_t *title_lens = idx->TitleLens().data();
+            const uint32_t *content_lens = idx->ContentLens().data();
+            const uint64_t doc_count = idx->TitleLens().size();
+
+            max_score = 0;
+            for (auto &term : terms)
+            {
+                const ns_index::InvertedList *list = idx->GetInvertedList(term);
+                ns_scorer::BM25::Term t = ns_scorer::BM25::Prepare(stats, list->size());
+                for (auto &elem : *list)
+                {
+                    if (elem.doc_id < doc_count)
+                    {
+                        max_score = std::max(max_score, ns_scorer::BM25::Score(t, elem, title_lens[elem.doc_id], content_lens[elem.doc_id]));
+                    }
+                }
+            }
+
+            std::vector<std::pair<uint8_t, uint32_t>> buffer;
+            for (auto &term : terms)
+            {
+                const ns_index::InvertedList *list = idx->GetInvertedList(term);
+                if (list->size() < min_df)
+                {
+                    continue;
+                }
+                ns_scorer::BM25::Term t = ns_scorer::BM25::Prepare(stats, list->size());
+                buffer.clear();
+                for (auto &elem : *list)
+                {
+                    if (elem.doc_id < doc_count)
+                    {
+                        buffer.push_back(std::make_pair(Quantize(ns_scorer::BM25::Score(t, elem, title_lens[elem.doc_id], content_lens[elem.doc_id])),
+                                                        static_cast<uint32_t>(elem.doc_id)));
+                    }
+                }
+                // 影响力降序，同影响力内doc_id升序
+                std::sort(buffer.begin(), buffer.end(), [](const std::pair<uint8_t, uint32_t> &a, const std::pair<uint8_t, uint32_t> &b)
+                          { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+
+                ImpactList &tier = tiers[list];
+                tier.docs.reserve(buffer.size());
+                for (std::size_t i = 0; i < buffer.size(); i++)
+                {
+                    if (i > 0 && buffer[i].first != buffer[i - 1].first)
+                    {
+                        ImpactRun run = {buffer[i - 1].first, static_cast<uint32_t>(i)};
+                        tier.runs.push_back(run);
+                    }
+                    tier.docs.push_back(buffer[i].second);
+                }
+                if (!buffer.empty())
+                {
+                    ImpactRun run = {buffer.back().first, static_cast<uint32_t>(buffer.size())};
+                    tier.runs.push_back(run);
+                }
+                postings += tier.docs.size();
+            }
+            LOG(NORMAL, "影响力分层建立完成, 词数: " + std::to_string(tiers.size()) + " 倒排元素: " + std::to_string(postings));
+        }
+
+        uint8_t Quantize(float score) const
+        {
+            if (max_score <= 0)
+            {
+                return 1;
+            }
+            int q = static_cast<int>(std::ceil(score * 255.0f / max_score));
+            return static_cast<uint8_t>(std::min(255, std::max(1, q)));
+        }
+
+        const ImpactList *Get(const ns_index::InvertedList *list) const
+        {
+            auto iter = tiers.find(list);
+            return iter == tiers.end() ? nullptr : &iter->second;
+        }
+
+        bool Empty() const { return tiers.empty(); }
+    };
+}
@@ -7,10 +7,18 @@
 #include <fstream>
 #include <ctime>
 #include <mutex>
+#include <unordered_set>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
 #include <jsoncpp/json/json.h>
 #include "util.hpp"
 #include "log.hpp"
 #include "mysql_operations.hpp"
+#include "threadpool.hpp"
+#include "mphf.hpp"
+#include "roaring.hpp"
+#include "record.hpp"
 // 索引
 namespace ns_index
 {
@@ -20,18 +28,195 @@ namespace ns_index
         std::string content; // 内容
         std::string url;     // URL
         uint64_t doc_id;     // 文档id
+        uint32_t dup_count;  // 建库时被合并到该文档的近重复文档数
+        DocInfo() : doc_id(0), dup_count(0) {}
     };
 
+    // 增量更新删除的文档保留空槽位（url为空），doc_id与raw.bin中的记录位置始终一致，全量重建时才压缩
+    inline bool IsRemoved(const DocInfo &doc)
+    {
+        return doc.url.empty();
+    }
+
     struct InvertedElem
     {
         uint64_t doc_id;
         std::string word;
-        int weight; // 权重值
+        int weight;      // 权重值
+        int title_cnt;   // 标题中出现次数
+        int content_cnt; // 正文中出现次数
+        InvertedElem() : doc_id(0), weight(0), title_cnt(0), content_cnt(0) {}
+    };
+
+    // 建索引时标题、正文命中的权重
+    const int TITLE_WEIGHT = 10;
+    const int CONTENT_WEIGHT = 1;
+
+    // 全量文档统计，供打分策略使用
+    struct CollectionStats
+    {
+        uint64_t doc_count;
+        double avg_title_len;   // 标题平均长度（字节）
+        double avg_content_len; // 正文平均长度（字节）
+        CollectionStats() : doc_count(0), avg_title_len(0), avg_content_len(0) {}
     };
 
     // 倒排拉链
     typedef std::vector<InvertedElem> InvertedList;
 
+    // 查询时遍历的一条拉链：整条全量拉链，或其中positions列出的元素（如标题拉链），只引用不拷贝倒排元素
+    // positions为升序下标，对应的doc_id也升序
+    struct ListView
+    {
+        const InvertedList *list;
+        const std::vector<uint32_t> *positions;
+
+        ListView() : list(nullptr), positions(nullptr) {}
+        explicit ListView(const InvertedList *list, const std::vector<uint32_t> *positions = nullptr) : list(list), positions(positions) {}
+
+        bool Empty() const { return list == nullptr; }
+        std::size_t size() const { return positions != nullptr ? positions->size() : list->size(); }
+        const InvertedElem &operator[](std::size_t k) const { return positions != nullptr ? (*list)[(*positions)[k]] : (*list)[k]; }
+
+        // 第一个doc_id不小于doc_id的元素序号
+        std::size_t LowerBound(uint64_t doc_id) const
+        {
+            std::size_t lo = 0, hi = size();
+            while (lo < hi)
+            {
+                std::size_t mid = lo + (hi - lo) / 2;
+                if ((*this)[mid].doc_id < doc_id)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        // 依次对每个元素调用func，两种情况各自一个循环，循环内不再判断
+        template <class Func>
+        void ForEach(Func func) const
+        {
+            if (positions == nullptr)
+            {
+                for (const InvertedElem &elem : *list)
+                {
+                    func(elem);
+                }
+                return;
+            }
+            for (uint32_t pos : *positions)
+            {
+                func((*list)[pos]);
+            }
+        }
+    };
+
+    // 拉链的二进制编码，存入inverted_blob的postings列
+    // 1字节版本号，之后每个倒排元素依次为doc_id差值、weight、title_cnt、content_cnt，均为varint（每字节7位，高位表示后面还有）
+    // 长拉链按kMaxBlobBytes切成若干块，每块单独一行，第一个元素的差值相对0，各块可独立解码
+    const unsigned char kPostingsVersion = 1;
+    // 转义后最多翻倍，仍低于BulkWriter单条语句的上限，也远低于max_allowed_packet
+    const std::size_t kMaxBlobBytes = 256 << 10;
+    const std::size_t kMaxElemBytes = 4 * 10; // 一个倒排元素编码后的最大字节数
+
+    inline void PutVarint(uint64_t v, std::string *out)
+    {
+        while (v >= 0x80)
+        {
+            out->push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        out->push_back(static_cast<char>(v));
+    }
+
+    inline bool GetVarint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+    {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64 && *p < end; shift += 7)
+        {
+            unsigned char b = *(*p)++;
+            result |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+            {
+                *v = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 从list[*pos]开始编码一块，不超过kMaxBlobBytes，*pos前进到下一块的起点；list须按doc_id升序
+    inline void EncodePostings(const InvertedList &list, std::size_t *pos, std::string *out)
+    {
+        out->clear();
+        out->push_back(static_cast<char>(kPostingsVersion));
+        uint64_t prev = 0;
+        std::size_t i = *pos;
+        for (; i < list.size() && out->size() + kMaxElemBytes <= kMaxBlobBytes; i++)
+        {
+            const InvertedElem &e = list[i];
+            PutVarint(e.doc_id - prev, out);
+            PutVarint(static_cast<uint32_t>(e.weight), out);
+            PutVarint(static_cast<uint32_t>(e.title_cnt), out);
+            PutVarint(static_cast<uint32_t>(e.content_cnt), out);
+            prev = e.doc_id;
+        }
+        *pos = i;
+    }
+
+    // 解码一块追加到list末尾，df为这一块的元素个数，用于预留空间和校验
+    inline bool DecodePostings(const std::string &word, uint32_t df, const char *data, std::size_t len, InvertedList *list)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        const unsigned char *end = p + len;
+        if (len == 0 || *p++ != kPostingsVersion)
+        {
+            return false;
+        }
+        std::size_t first = list->size();
+        list->reserve(first + df);
+        uint64_t doc_id = 0;
+        while (p < end)
+        {
+            uint64_t delta, weight, title_cnt, content_cnt;
+            if (!GetVarint(&p, end, &delta) || !GetVarint(&p, end, &weight) ||
+                !GetVarint(&p, end, &title_cnt) || !GetVarint(&p, end, &content_cnt))
+            {
+                return false;
+            }
+            doc_id += delta;
+            InvertedElem item;
+            item.doc_id = doc_id;
+            item.word = word;
+            item.weight = static_cast<int>(weight);
+            item.title_cnt = static_cast<int>(title_cnt);
+            item.content_cnt = static_cast<int>(content_cnt);
+            list->push_back(std::move(item));
+        }
+        // list可能已有同一个词前面各块的元素，只核对这一块解出的个数
+        return list->size() - first == df;
+    }
+
+    // LoadIndex读取倒排的来源
+    enum PostingSource
+    {
+        POSTINGS_AUTO,  // inverted_blob有数据时读它，否则读旧的inverted_elem
+        POSTINGS_ROWS,  // 只读inverted_elem，迁移时使用
+        POSTINGS_BLOBS
+    };
+
+    // 查询词限定的字段
+    enum Field
+    {
+        FIELD_ANY,  // 标题或正文
+        FIELD_TITLE // 只匹配标题
+    };
+
     class Index
     {
     private:
@@ -39,9 +224,22 @@ namespace ns_index
         std::vector<DocInfo> forward_index;
         // 倒排索引为一个关键字对应多个InvertedElem
         std::unordered_map<std::string, InvertedList> inverted_index;
+        // 文档长度按doc_id连续存放，打分时顺序访问
+        std::vector<uint32_t> title_lens;
+        std::vector<uint32_t> content_lens;
+        CollectionStats stats;
+        // 索引建好后冻结成只读词典：最小完美哈希 + 连续存放的拉链指针
+        ns_mphf::PerfectHashDict term_dict;
+        std::vector<InvertedList *> dict_lists;
+        bool frozen;
+        // 字段索引：标题命中的元素在全量拉链中的下标，以及URL切词后的文档位图
+        std::unordered_map<std::string, std::vector<uint32_t>> title_index;
+        std::unordered_map<std::string, ns_roaring::Bitmap> url_index;
+        // ApplyChanges中拉链有变化（含被删空）的词，SaveChanges只重写这些词
+        std::vector<std::string> changed_terms;
 
     private: // 单例模型
-        Index() {}
+        Index() : frozen(false) {}
         Index(const Index &) = delete;
         Index &operator=(const Index &) = delete;
 
@@ -80,9 +278,25 @@ namespace ns_index
             }
             return &forward_index[doc_id];
         }
+        const CollectionStats &GetStats() const { return stats; }
+        std::size_t TermCount() const { return inverted_index.size(); }
+        std::size_t SlotCount() const { return forward_index.size(); } // 含空槽位
+        const std::vector<uint32_t> &TitleLens() const { return title_lens; }
+        const std::vector<uint32_t> &ContentLens() const { return content_lens; }
+
         // 根据关键字word，得到倒排拉链
         InvertedList *GetInvertedList(const std::string &word)
         {
+            if (frozen)
+            {
+                uint32_t id = 0;
+                if (!term_dict.Find(word, &id))
+                {
+                    LOG(NOTICE, "无" + word + "相关倒排拉链 have no InvertedList");
+                    return nullptr;
+                }
+                return dict_lists[id];
+            }
             auto iter = inverted_index.find(word);
             if (iter == inverted_index.end())
             {
@@ -92,10 +306,145 @@ namespace ns_index
             }
             return &(iter->second);
         }
+        // 标题中出现过word的文档，拉链远短于全量拉链；没有时返回空的ListView
+        ListView GetTitleList(const std::string &word)
+        {
+            auto iter = title_index.find(word);
+            if (iter == title_index.end())
+            {
+                return ListView();
+            }
+            return ListView(GetInvertedList(word), &iter->second);
+        }
+
+        // URL中包含token的文档
+        const ns_roaring::Bitmap *GetUrlDocs(const std::string &token) const
+        {
+            auto iter = url_index.find(token);
+            return iter == url_index.end() ? nullptr : &iter->second;
+        }
+
+        // 从倒排拉链和正排索引派生字段索引，不单独持久化；正排或倒排变化后需重新调用
+        void BuildFieldIndex()
+        {
+            title_index.clear();
+            url_index.clear();
+            std::size_t title_postings = 0;
+            for (auto &item_list : inverted_index)
+            {
+                const InvertedList &list = item_list.second;
+                std::size_t count = std::count_if(list.begin(), list.end(), [](const InvertedElem &item)
+                                                  { return item.title_cnt > 0; });
+                if (count == 0)
+                {
+                    continue;
+                }
+                std::vector<uint32_t> &positions = title_index[item_list.first];
+                positions.reserve(count);
+                for (std::size_t i = 0; i < list.size(); i++)
+                {
+                    if (list[i].title_cnt > 0)
+                    {
+                        positions.push_back(static_cast<uint32_t>(i));
+                    }
+                }
+                title_postings += count;
+            }
+            std::vector<std::string> tokens;
+            for (auto &doc : forward_index)
+            {
+                tokens.clear();
+                CutUrl(doc.url, &tokens);
+                for (auto &token : tokens)
+                {
+                    url_index[token].Add(static_cast<uint32_t>(doc.doc_id));
+                }
+            }
+            for (auto &item : url_index)
+            {
+                item.second.ShrinkToFit();
+            }
+            LOG(NORMAL, "字段索引建立完成, 标题拉链元素: " + std::to_string(title_postings) + " URL词数: " + std::to_string(url_index.size()));
+        }
+
+        // URL切词：按非字母数字切分并转小写，下划线连接的片段同时保留整体，如boost_asio得到boost_asio、boost、asio
+        static void CutUrl(const std::string &url, std::vector<std::string> *tokens)
+        {
+            std::string segment;
+            for (std::size_t i = 0; i <= url.size(); i++)
+            {
+                char c = i < url.size() ? url[i] : '\0';
+                if (std::isalnum(static_cast<unsigned char>(c)) || c == '_')
+                {
+                    segment.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+                    continue;
+                }
+                if (segment.empty())
+                {
+                    continue;
+                }
+                std::size_t start = 0;
+                while (start <= segment.size())
+                {
+                    std::size_t end = segment.find('_', start);
+                    if (end == std::string::npos)
+                    {
+                        end = segment.size();
+                    }
+                    if (end > start && (start > 0 || end < segment.size()))
+                    {
+                        tokens->push_back(segment.substr(start, end - start));
+                    }
+                    start = end + 1;
+                }
+                tokens->push_back(segment);
+                segment.clear();
+            }
+        }
+
+        // 索引不再变化后调用，之后的查找走完美哈希词典
+        bool Freeze()
+        {
+            std::vector<std::string> keys;
+            std::vector<uint32_t> values;
+            keys.reserve(inverted_index.size());
+            values.reserve(inverted_index.size());
+            dict_lists.clear();
+            dict_lists.reserve(inverted_index.size());
+            for (auto &item_list : inverted_index)
+            {
+                keys.push_back(item_list.first);
+                values.push_back(static_cast<uint32_t>(dict_lists.size()));
+                dict_lists.push_back(&item_list.second);
+            }
+            if (!term_dict.Build(keys, values))
+            {
+                dict_lists.clear();
+                frozen = false;
+                return false;
+            }
+            frozen = true;
+            LOG(NORMAL, "词典冻结完成, 词数: " + std::to_string(term_dict.Size()) + " 字节数: " + std::to_string(term_dict.Bytes()));
+            return true;
+        }
+
+        void ListTerms(std::vector<std::string> *terms) const
+        {
+            terms->reserve(terms->size() + inverted_index.size());
+            for (auto &item_list : inverted_index)
+            {
+                terms->push_back(item_list.first);
+            }
+        }
+
         // 根据去标签、格式化之后的文档，构建正排和倒排索引
-        // data/raw_html/raw.txt
+        // data/raw_html/raw.bin为记录格式，按长度读取字段；旧的raw.txt按行读取再切分
         bool BuildIndex(const std::string &input) // 接收parser处理完的数据
         {
+            if (ns_record::IsRecordFile(input))
+            {
+                return BuildIndexFromRecords(input);
+            }
             std::ifstream in(input, std::ios::binary | std::ios::in);
             if (!in.is_open())
             {
@@ -103,119 +452,487 @@ namespace ns_index
                 LOG(FATAL, "sorry, " + input + " open error");
                 return false;
             }
+            // 按批读取，批内的分词和词频统计交给线程池并行完成，再按文档顺序合并进倒排拉链
+            std::vector<std::string> lines;
+            lines.reserve(kBatchSize);
             std::string line;
             int count = 0;
             clock_t timeStart = clock();
-            clock_t timeEnd;
             while (std::getline(in, line))
             {
-                DocInfo *doc = BuildForwardIndex(line);
-                if (doc == nullptr)
+                lines.push_back(std::move(line));
+                if (lines.size() < kBatchSize)
                 {
-                    // std::cerr << "build error: " << line  << std::endl;
-                    LOG(WARNING, "build error: " + line);
                     continue;
                 }
+                count += BuildBatch(lines);
+                lines.clear();
+                ReportProgress(count, &timeStart);
+            }
+            count += BuildBatch(lines);
+            LOG(NORMAL, "建立索引的文档总数: " + std::to_string(count));
+            UpdateStats();
+            return true;
+        }
 
-                BuildInvertedIndex(*doc);
-                count++;
-                timeEnd = clock();
-                if ((timeEnd - timeStart) / CLOCKS_PER_SEC >= 1)
+        // 流式读取记录文件，内存中只保留一批记录
+        bool BuildIndexFromRecords(const std::string &input)
+        {
+            ns_record::Reader reader;
+            if (!reader.Open(input))
+            {
+                LOG(FATAL, "sorry, " + input + " open error");
+                return false;
+            }
+            std::vector<DocInfo> docs;
+            docs.reserve(kBatchSize);
+            ns_record::Record record;
+            int count = 0;
+            clock_t timeStart = clock();
+            while (reader.Next(&record))
+            {
+                DocInfo doc;
+                doc.title = std::move(record.title);
+                doc.content = std::move(record.content);
+                doc.url = std::move(record.url);
+                doc.dup_count = record.dup_count;
+                docs.push_back(std::move(doc));
+                if (docs.size() < kBatchSize)
                 {
-                    LOG(NORMAL, "当前已建立的索引文档: " + std::to_string(count));
-                    timeStart = timeEnd;
+                    continue;
                 }
+                count += BuildDocs(&docs);
+                ReportProgress(count, &timeStart);
+            }
+            if (reader.Corrupted())
+            {
+                LOG(FATAL, input + " 记录损坏, 已读入 " + std::to_string(count + docs.size()) + " 篇, 放弃建立索引");
+                return false;
             }
+            count += BuildDocs(&docs);
+            LOG(NORMAL, "建立索引的文档总数: " + std::to_string(count));
+            UpdateStats();
             return true;
         }
-        
+
+        // 加入一批已解析好的文档，doc_id按加入顺序分配，docs被清空；全部加入后需调用FinishBuild
+        int BuildDocs(std::vector<DocInfo> *docs)
+        {
+            std::size_t first = forward_index.size();
+            for (auto &doc : *docs)
+            {
+                doc.doc_id = forward_index.size();
+                forward_index.push_back(std::move(doc));
+            }
+            docs->clear();
+            return IndexNewDocs(first);
+        }
+
+        void FinishBuild()
+        {
+            LOG(NORMAL, "建立索引的文档总数: " + std::to_string(forward_index.size()));
+            UpdateStats();
+        }
+
         bool LoadInvertedIndex()    // 根据数据库中正排索引建立倒排索引
         {
-            Json::Value docs;
-            if (tb_doc->SelectAll(docs) == false)
+            bool ok = tb_doc->ScanAll([this](ns_operation::DocRow &row)
+                                      {
+                BuildInvertedIndex(*PlaceDoc(row));
+                return true; });
+            if (!ok)
             {
                 return false;
             }
-            for (auto &doc : docs)
+            UpdateStats();
+            return true;
+        }
+
+        // 正排和倒排分别由tb_doc、tb_inv各自的连接流式读取，两张表并行加载
+        bool LoadIndex(PostingSource source = POSTINGS_AUTO) // 从数据库读取索引
+        {
+            if (source == POSTINGS_AUTO)
             {
-                DocInfo docif;
-                docif.doc_id = doc["doc_id"].asInt();
-                docif.url = doc["url"].asString();
-                docif.title = doc["title"].asString();
-                docif.content = doc["content"].asString();
-                BuildInvertedIndex(docif);
-                forward_index.push_back(std::move(docif));
+                source = tb_inv->HasBlobs() ? POSTINGS_BLOBS : POSTINGS_ROWS;
+                if (source == POSTINGS_ROWS)
+                {
+                    LOG(WARNING, "inverted_blob为空，从inverted_elem逐行加载，可运行 ./indextext migrate 迁移");
+                }
             }
+            bool docs_ok = false;
+            std::thread doc_loader([this, &docs_ok]
+                                   {
+                                       docs_ok = tb_doc->ScanAll([this](ns_operation::DocRow &row)
+                                                                 {
+                                           PlaceDoc(row);
+                                           return true; });
+                                   });
+            bool postings_ok;
+            if (source == POSTINGS_BLOBS)
+            {
+                // 同一个词的各块按seq顺序返回，拉链写入时已按doc_id升序，无需再排序
+                postings_ok = tb_inv->SelectBlobs([this](const std::string &word, uint32_t df, const char *data, std::size_t len)
+                                                  {
+                    if (!DecodePostings(word, df, data, len, &inverted_index[word]))
+                    {
+                        LOG(FATAL, "拉链解码失败 word = " + word);
+                        return false;
+                    }
+                    return true; });
+            }
+            else
+            {
+                postings_ok = tb_inv->ScanAll([this](ns_operation::PostingRow &row)
+                                              {
+                    InvertedElem item;
+                    item.doc_id = row.doc_id;
+                    item.word = row.word;
+                    item.weight = row.weight;
+                    item.title_cnt = row.title_cnt;
+                    item.content_cnt = row.content_cnt;
+                    inverted_index[row.word].push_back(std::move(item));
+                    return true; });
+                SortInvertedLists();
+            }
+            doc_loader.join();
+            if (!docs_ok || !postings_ok)
+            {
+                return false;
+            }
+            UpdateStats();
+
             return true;
         }
 
-        bool LoadIndex() // 从数据库读取索引
+        // 每个词的拉链编码后写入inverted_blob，通常一行，超过kMaxBlobBytes的分成多行；多行INSERT批量写入，每批一个事务
+        bool SaveInvertedIndex()
         {
-            Json::Value tmps;
-            if (tb_inv->SelectAll(tmps) == false)
+            if (tb_inv->ClearBlobs() == false)
             {
                 return false;
             }
+            std::vector<std::string> words;
+            words.reserve(inverted_index.size());
+            for (auto &item_list : inverted_index)
+            {
+                words.push_back(item_list.first);
+            }
+            return WriteBlobs(words);
+        }
 
-            for (auto &tmp : tmps)
+        // 从inverted_blob读回每个词的拉链，逐个元素与内存中的比较，返回表中的词数和倒排元素数
+        bool VerifyBlobs(std::size_t *terms, std::size_t *postings)
+        {
+            *terms = *postings = 0;
+            std::string current;
+            InvertedList decoded;
+            // 一个词的各块都读完后与内存中的拉链比较
+            auto check = [&]()
             {
-                InvertedElem item;
-                item.doc_id = tmp["doc_id"].asInt();
-                item.word = tmp["word"].asString();
-                item.weight = tmp["weight"].asInt();
-                inverted_index[item.word].push_back(std::move(item));
+                auto iter = inverted_index.find(current);
+                if (iter == inverted_index.end() || decoded.size() != iter->second.size())
+                {
+                    LOG(FATAL, "拉链与内存不一致 word = " + current);
+                    return false;
+                }
+                for (std::size_t i = 0; i < decoded.size(); i++)
+                {
+                    const InvertedElem &x = decoded[i], &y = iter->second[i];
+                    if (x.doc_id != y.doc_id || x.weight != y.weight || x.title_cnt != y.title_cnt || x.content_cnt != y.content_cnt)
+                    {
+                        LOG(FATAL, "拉链与内存不一致 word = " + current);
+                        return false;
+                    }
+                }
+                (*terms)++;
+                *postings += decoded.size();
+                return true;
+            };
+            bool ok = tb_inv->SelectBlobs([&](const std::string &word, uint32_t df, const char *data, std::size_t len)
+                                          {
+                if (word != current)
+                {
+                    if (!current.empty() && !check())
+                    {
+                        return false;
+                    }
+                    current = word;
+                    decoded.clear();
+                }
+                if (!DecodePostings(word, df, data, len, &decoded))
+                {
+                    LOG(FATAL, "拉链解码失败 word = " + word);
+                    return false;
+                }
+                return true; });
+            ok = ok && (current.empty() || check());
+            return ok && *terms == inverted_index.size();
+        }
+
+        // 应用parser生成的变更集：removed中的文档变为空槽位并从倒排拉链中去掉，added按doc_id追加
+        // added的doc_id必须递增且不小于当前文档数，中间空出的位置补空槽位；docs被清空
+        // 拉链有变化的词记录在changed_terms中，供SaveChanges只重写这些词
+        // 完美哈希词典和字段索引等派生结构不会随之更新，调用方需重新Freeze、BuildFieldIndex等
+        bool ApplyChanges(const std::vector<uint64_t> &removed, std::vector<DocInfo> *added)
+        {
+            uint64_t next_id = forward_index.size();
+            for (const DocInfo &doc : *added)
+            {
+                if (doc.doc_id < next_id)
+                {
+                    LOG(WARNING, "新文档的doc_id已被占用或不递增 doc_id = " + std::to_string(doc.doc_id));
+                    return false;
+                }
+                next_id = doc.doc_id + 1;
             }
-            
-            Json::Value docs;
-            if(tb_doc->SelectAll(docs) == false)
+            std::vector<bool> drop(forward_index.size(), false);
+            std::size_t dropped_docs = 0;
+            for (uint64_t doc_id : removed)
             {
-                return false;
+                if (doc_id >= forward_index.size() || IsRemoved(forward_index[doc_id]))
+                {
+                    LOG(WARNING, "删除的文档不存在 doc_id = " + std::to_string(doc_id));
+                    continue;
+                }
+                drop[doc_id] = true;
+                forward_index[doc_id] = DocInfo();
+                forward_index[doc_id].doc_id = doc_id;
+                dropped_docs++;
             }
-            for(auto &doc : docs)
+            // 不重新分词，直接按doc_id过滤所有拉链，代价与倒排元素总数成正比
+            std::size_t dropped_postings = 0;
+            changed_terms.clear();
+            if (dropped_docs > 0)
             {
-                DocInfo docif;
-                docif.doc_id = doc["doc_id"].asInt();
-                docif.url = doc["url"].asString();
-                docif.title = doc["title"].asString();
-                docif.content = doc["content"].asString();
-                forward_index.push_back(std::move(docif));
+                for (auto iter = inverted_index.begin(); iter != inverted_index.end();)
+                {
+                    InvertedList &list = iter->second;
+                    std::size_t before = list.size();
+                    list.erase(std::remove_if(list.begin(), list.end(), [&drop](const InvertedElem &e)
+                                              { return drop[e.doc_id]; }),
+                               list.end());
+                    if (list.size() != before)
+                    {
+                        dropped_postings += before - list.size();
+                        changed_terms.push_back(iter->first);
+                    }
+                    iter = list.empty() ? inverted_index.erase(iter) : std::next(iter);
+                }
             }
+            frozen = false;
+            dict_lists.clear();
 
+            std::size_t first = forward_index.size();
+            for (auto &doc : *added)
+            {
+                while (forward_index.size() < doc.doc_id)
+                {
+                    forward_index.push_back(DocInfo());
+                    forward_index.back().doc_id = forward_index.size() - 1;
+                }
+                forward_index.push_back(std::move(doc));
+            }
+            added->clear();
+            int count = IndexNewDocs(first);
+            // 新文档的doc_id最大，位于拉链末尾；已因删除记录过的词不重复加入
+            std::unordered_set<std::string> seen(changed_terms.begin(), changed_terms.end());
+            for (auto &item_list : inverted_index)
+            {
+                const InvertedList &list = item_list.second;
+                if (!list.empty() && list.back().doc_id >= first && seen.insert(item_list.first).second)
+                {
+                    changed_terms.push_back(item_list.first);
+                }
+            }
+            UpdateStats();
+            LOG(NORMAL, "增量更新完成, 删除文档: " + std::to_string(dropped_docs) + " 删除倒排元素: " + std::to_string(dropped_postings) +
+                            " 新增文档: " + std::to_string(count) +
+                            " 变化的词: " + std::to_string(changed_terms.size()) + " 有效文档: " + std::to_string(stats.doc_count) +
+                            " 空槽位: " + std::to_string(forward_index.size() - stats.doc_count));
             return true;
         }
 
-        bool SaveInvertedIndex()   
+        // 把ApplyChanges的结果写回数据库：删掉removed的文档行，写入doc_id不小于first的文档，
+        // 删除changed_terms的拉链后重写其中仍存在的词，其余词的行不动
+        // 新行先批量写入暂存表，再在一个事务中删除旧行并从暂存表复制；任何一步失败时正式表不变，变更集仍在，可直接重新运行
+        bool SaveChanges(const std::vector<uint64_t> &removed, uint64_t first)
         {
-            if (tb_inv->Clear() == false)
+            if (!tb_doc->ResetStaging("doc_info") || !tb_inv->ResetStaging("inverted_blob"))
+            {
+                return false;
+            }
+            ns_operation::BulkWriter doc_writer(ns_operation::TableBase::StagingTable("doc_info"), ns_operation::TableDoc::BulkColumns());
+            if (!doc_writer.Start())
             {
                 return false;
             }
+            for (uint64_t doc_id = first; doc_id < forward_index.size(); doc_id++)
+            {
+                const DocInfo &doc = forward_index[doc_id];
+                if (IsRemoved(doc))
+                {
+                    continue;
+                }
+                doc_writer.Value(doc_id).Value(doc.title).Value(doc.content).Value(doc.url).Value(doc.dup_count).EndRow();
+            }
+            if (!doc_writer.Finish() || !WriteBlobs(changed_terms, ns_operation::TableBase::StagingTable("inverted_blob")))
+            {
+                return false;
+            }
+            std::vector<std::string> sqls;
+            ns_operation::TableDoc::DeleteByDocIdsSql(removed, &sqls);
+            tb_inv->DeleteBlobsSql(changed_terms, &sqls);
+            sqls.push_back(ns_operation::TableBase::CopyStagingSql("doc_info", ns_operation::TableDoc::BulkColumns()));
+            sqls.push_back(ns_operation::TableBase::CopyStagingSql("inverted_blob", ns_operation::TableInverted::BlobColumns()));
+            if (!tb_inv->Transaction(sqls))
+            {
+                LOG(FATAL, "增量更新写回失败，事务已回滚，索引未改动");
+                return false;
+            }
+            tb_doc->DropStaging("doc_info");
+            tb_inv->DropStaging("inverted_blob");
+            return true;
+        }
+
+    private:
+        // 从数据库读取时按doc_id放入正排索引，被删除的doc_id没有对应的行，留下空槽位；row中的字段被移走
+        DocInfo *PlaceDoc(ns_operation::DocRow &row)
+        {
+            uint64_t doc_id = row.doc_id;
+            while (forward_index.size() <= doc_id)
+            {
+                forward_index.push_back(DocInfo());
+                forward_index.back().doc_id = forward_index.size() - 1;
+            }
+            DocInfo &doc = forward_index[doc_id];
+            doc.doc_id = doc_id;
+            doc.title = std::move(row.title);
+            doc.content = std::move(row.content);
+            doc.url = std::move(row.url);
+            doc.dup_count = row.dup_count;
+            return &doc;
+        }
+
+        // 保证每条倒排拉链按doc_id升序，便于查询时按文档区间切分
+        // BuildIndex按文档顺序追加，天然有序；从数据库读取的顺序没有保证
+        void SortInvertedLists()
+        {
             for (auto &item_list : inverted_index)
             {
-                for (auto &item : item_list.second)
+                InvertedList &list = item_list.second;
+                if (!std::is_sorted(list.begin(), list.end(), CompareDocId))
+                {
+                    std::sort(list.begin(), list.end(), CompareDocId);
+                }
+            }
+        }
+
+        static bool CompareDocId(const InvertedElem &e1, const InvertedElem &e2)
+        {
+            return e1.doc_id < e2.doc_id;
+        }
+
+        // 编码好的一行inverted_blob
+        struct BlobRow
+        {
+            const std::string *word;
+            std::size_t seq;
+            std::size_t count;
+            std::string blob;
+        };
+
+        // 编码words中每个仍存在的词的拉链，写入table（inverted_blob或其暂存表）
+        // 按窗口流水线：线程池并行编码一个窗口的词，交给BulkWriter后由它的后台线程转义、发送，同时编码下一个窗口
+        bool WriteBlobs(const std::vector<std::string> &words, const std::string &table = "inverted_blob")
+        {
+            const std::size_t shard_terms = 1024;
+            const std::size_t window_shards = 16;
+            ns_operation::BulkWriter writer(table, ns_operation::TableInverted::BlobColumns());
+            if (!writer.Start())
+            {
+                return false;
+            }
+            std::size_t bytes = 0, terms = 0, chunks = 0;
+            std::vector<std::vector<BlobRow>> shards(window_shards);
+            for (std::size_t window = 0; window < words.size() && !writer.Failed(); window += shard_terms * window_shards)
+            {
                 {
-                    Json::Value tmp;
-                    tmp["doc_id"] = std::to_string(item.doc_id);
-                    tmp["word"] = item.word;
-                    tmp["weight"] = item.weight;
-                    if (tb_inv->Insert(tmp) == false)
+                    ns_threadpool::TaskGroup group(ns_threadpool::ThreadPool::GetInstance(), ns_threadpool::PRIORITY_BACKGROUND);
+                    for (std::size_t s = 0; s < window_shards; s++)
                     {
-                        return false;
+                        std::size_t begin = std::min(window + s * shard_terms, words.size());
+                        std::size_t end = std::min(begin + shard_terms, words.size());
+                        std::vector<BlobRow> *rows = &shards[s];
+                        rows->clear();
+                        group.Run([this, &words, begin, end, rows]
+                                  {
+                            for (std::size_t i = begin; i < end; i++)
+                            {
+                                auto iter = inverted_index.find(words[i]);
+                                if (iter == inverted_index.end())
+                                {
+                                    continue;
+                                }
+                                const InvertedList &list = iter->second;
+                                for (std::size_t pos = 0, seq = 0; pos < list.size(); seq++)
+                                {
+                                    std::size_t first = pos;
+                                    rows->push_back(BlobRow());
+                                    BlobRow &row = rows->back();
+                                    EncodePostings(list, &pos, &row.blob);
+                                    row.word = &words[i];
+                                    row.seq = seq;
+                                    row.count = pos - first;
+                                }
+                            } });
+                    }
+                    group.Wait();
+                }
+                for (std::vector<BlobRow> &rows : shards)
+                {
+                    for (BlobRow &row : rows)
+                    {
+                        bytes += row.blob.size();
+                        chunks++;
+                        terms += row.seq == 0 ? 1 : 0;
+                        writer.Value(*row.word).Value(row.seq).Value(row.count).Value(std::move(row.blob)).EndRow();
                     }
                 }
             }
-            return true;
+            bool ok = writer.Finish();
+            LOG(NORMAL, "写入拉链: " + std::to_string(terms) + " 个词, " + std::to_string(chunks) + " 行, 编码后 " + std::to_string(bytes) + " 字节");
+            return ok;
+        }
+
+        // 根据正排索引重新计算文档长度和平均值
+        void UpdateStats()
+        {
+            title_lens.resize(forward_index.size());
+            content_lens.resize(forward_index.size());
+            double title_total = 0, content_total = 0;
+            uint64_t live = 0;
+            for (std::size_t i = 0; i < forward_index.size(); i++)
+            {
+                title_lens[i] = forward_index[i].title.size();
+                content_lens[i] = forward_index[i].content.size();
+                title_total += title_lens[i];
+                content_total += content_lens[i];
+                live += IsRemoved(forward_index[i]) ? 0 : 1;
+            }
+            // 空槽位的长度为0，不计入文档数，平均长度只按有效文档计算
+            stats.doc_count = live;
+            stats.avg_title_len = stats.doc_count ? title_total / stats.doc_count : 0;
+            stats.avg_content_len = stats.doc_count ? content_total / stats.doc_count : 0;
         }
 
-    private:
         // 构建正排索引
         DocInfo *BuildForwardIndex(const std::string &line)
         {
-            // 1. 解析line，字符串切分 [title\3 content\3 url]
+            // 1. 解析line，字符串切分 [title\3 content\3 url\3 dup_count]，旧格式没有dup_count
             std::string sep = "\3";
             std::vector<std::string> results;
             ns_util::StringUtil::Split(line, &results, sep);
-            if (results.size() != 3)
+            if (results.size() != 3 && results.size() != 4)
             {
                 return nullptr;
             }
@@ -225,54 +942,129 @@ namespace ns_index
             doc.content = results[1];
             doc.url = results[2];
             doc.doc_id = forward_index.size();
+            if (results.size() == 4)
+            {
+                doc.dup_count = static_cast<uint32_t>(std::strtoul(results[3].c_str(), nullptr, 10));
+            }
 
             // 3. 插入到正排索引的vector
             forward_index.push_back(std::move(doc));
 
             return &forward_index.back();
         }
+        struct word_cnt
+        {
+            int title_cnt;
+            int content_cnt;
+            word_cnt() : title_cnt(0), content_cnt(0) {}
+        };
+        typedef std::unordered_map<std::string, word_cnt> WordMap; // 用来暂存词频的映射表
+
+        static const std::size_t kBatchSize = 1024;
+
+        static void ReportProgress(int count, clock_t *timeStart)
+        {
+            clock_t timeEnd = clock();
+            if ((timeEnd - *timeStart) / CLOCKS_PER_SEC >= 1)
+            {
+                LOG(NORMAL, "当前已建立的索引文档: " + std::to_string(count));
+                *timeStart = timeEnd;
+            }
+        }
+
+        // 构建一批文档的正排和倒排索引，返回成功的文档数
+        int BuildBatch(const std::vector<std::string> &lines)
+        {
+            std::size_t first = forward_index.size();
+            for (const std::string &line : lines)
+            {
+                if (BuildForwardIndex(line) == nullptr)
+                {
+                    // std::cerr << "build error: " << line  << std::endl;
+                    LOG(WARNING, "build error: " + line);
+                }
+            }
+            return IndexNewDocs(first);
+        }
+
+        // 为正排索引中从first开始新加入的文档建立倒排
+        int IndexNewDocs(std::size_t first)
+        {
+            std::size_t n = forward_index.size() - first;
+
+            // 分词是建索引的主要开销，只读正排索引，可以并行
+            std::vector<WordMap> word_maps(n);
+            ns_threadpool::ThreadPool *pool = ns_threadpool::ThreadPool::GetInstance();
+            {
+                ns_threadpool::TaskGroup group(pool, ns_threadpool::PRIORITY_BACKGROUND);
+                const std::size_t chunk = 32;
+                for (std::size_t begin = 0; begin < n; begin += chunk)
+                {
+                    std::size_t end = std::min(begin + chunk, n);
+                    group.Run([this, &word_maps, first, begin, end]
+                              {
+                                  for (std::size_t i = begin; i < end; i++)
+                                  {
+                                      CountWords(forward_index[first + i], &word_maps[i]);
+                                  }
+                              });
+                }
+                group.Wait();
+            }
+
+            // 合并必须串行且按doc_id顺序，保证拉链有序
+            for (std::size_t i = 0; i < n; i++)
+            {
+                InsertWords(forward_index[first + i].doc_id, word_maps[i]);
+            }
+            return static_cast<int>(n);
+        }
+
         // 构建倒排索引
         bool BuildInvertedIndex(const DocInfo &doc)
         {
-            struct word_cnt
-            {
-                int title_cnt;
-                int content_cnt;
-                word_cnt() : title_cnt(0), content_cnt(0) {}
-            };
-            std::unordered_map<std::string, word_cnt> word_map; // 用来暂存词频的映射表
+            WordMap word_map;
+            CountWords(doc, &word_map);
+            InsertWords(doc.doc_id, word_map);
+            return true;
+        }
 
+        // 统计文档中每个词在标题和正文中的出现次数
+        static void CountWords(const DocInfo &doc, WordMap *word_map)
+        {
             std::vector<std::string> title_words;
             ns_util::JiebaUtil::CutString(doc.title, &title_words);
 
-            for (std::string s : title_words)
+            for (std::string &s : title_words)
             {
                 boost::to_lower(s);
-                word_map[s].title_cnt++;
+                (*word_map)[s].title_cnt++;
             }
 
             std::vector<std::string> content_words;
             ns_util::JiebaUtil::CutString(doc.content, &content_words);
 
-            for (std::string s : content_words)
+            for (std::string &s : content_words)
             {
                 boost::to_lower(s);
-                word_map[s].content_cnt++;
+                (*word_map)[s].content_cnt++;
             }
+        }
 
-#define X 10
-#define Y 1
+        void InsertWords(uint64_t doc_id, const WordMap &word_map)
+        {
             for (auto &word_pair : word_map)
             {
                 InvertedElem item;
-                item.doc_id = doc.doc_id;
+                item.doc_id = doc_id;
                 item.word = word_pair.first;
-                item.weight = (X - Y) * word_pair.second.title_cnt + Y * word_pair.second.content_cnt;
+                item.title_cnt = word_pair.second.title_cnt;
+                item.content_cnt = word_pair.second.content_cnt;
+                // 标题中的词也会在正文中计数，因此标题只额外加(TITLE_WEIGHT - CONTENT_WEIGHT)
+                item.weight = (TITLE_WEIGHT - CONTENT_WEIGHT) * item.title_cnt + CONTENT_WEIGHT * item.content_cnt;
                 InvertedList &inverted_list = inverted_index[word_pair.first];
                 inverted_list.push_back(std::move(item));
             }
-
-            return true;
         }
     };
     std::mutex Index::mtx;
@@ -1,15 +1,117 @@
+#include <chrono>
+#include <limits>
 #include "index.hpp"
+#include "manifest.hpp"
 
-const std::string input = "data/raw_html/raw.txt";
+const std::string input = "data/raw_html/raw.bin";
+// parser update生成的变更集
+const std::string changes_path = "data/raw_html/changes.txt";
+const std::string changes_docs = "data/raw_html/changes.bin";
 
-int main()
+// 从数据库加载现有索引，应用变更集后只把变化的文档和倒排元素写回，应用成功后删除变更集
+static bool ApplyChanges(ns_index::Index *index)
+{
+    std::vector<ns_manifest::Change> changes;
+    if (!ns_manifest::LoadChanges(changes_path, &changes))
+    {
+        std::cerr << "no pending change set: " << changes_path << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (!index->LoadIndex())
+    {
+        LOG(FATAL, "加载索引失败. . . ");
+        return false;
+    }
+
+    // 新增和修改的文档按变更集中的顺序存放在changes_docs中
+    std::vector<uint64_t> removed;
+    std::vector<ns_index::DocInfo> added;
+    ns_record::Reader reader;
+    bool opened = false;
+    for (auto &change : changes)
+    {
+        if (change.kind != ns_manifest::CHANGE_ADD)
+        {
+            removed.push_back(change.old_id);
+        }
+        if (change.kind == ns_manifest::CHANGE_DELETE)
+        {
+            continue;
+        }
+        if (!opened && !(opened = reader.Open(changes_docs)))
+        {
+            return false;
+        }
+        ns_record::Record record;
+        if (!reader.Next(&record) || record.url != change.url)
+        {
+            LOG(FATAL, changes_docs + " does not match " + changes_path);
+            return false;
+        }
+        ns_index::DocInfo doc;
+        doc.title = std::move(record.title);
+        doc.content = std::move(record.content);
+        doc.url = std::move(record.url);
+        doc.dup_count = record.dup_count;
+        doc.doc_id = change.new_id;
+        added.push_back(std::move(doc));
+    }
+    uint64_t first = added.empty() ? std::numeric_limits<uint64_t>::max() : added.front().doc_id;
+    if (!index->ApplyChanges(removed, &added) || !index->SaveChanges(removed, first))
+    {
+        return false;
+    }
+    std::remove(changes_path.c_str());
+    std::remove(changes_docs.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "applied " << changes.size() << " changes in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// 把旧的inverted_elem逐行数据转成inverted_blob，再读回逐词核对
+static bool Migrate(ns_index::Index *index)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (!index->LoadIndex(ns_index::POSTINGS_ROWS))
+    {
+        LOG(FATAL, "读取inverted_elem失败. . . ");
+        return false;
+    }
+    if (!index->SaveInvertedIndex())
+    {
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::size_t terms = 0, postings = 0;
+    if (!index->VerifyBlobs(&terms, &postings))
+    {
+        LOG(FATAL, "迁移结果校验失败, inverted_elem未改动, 请先 truncate table inverted_blob 再重试");
+        return false;
+    }
+    std::cout << "migrated " << postings << " postings of " << terms << " terms in " << seconds << " s" << std::endl;
+    std::cout << "inverted_elem is no longer read; drop it with: drop table inverted_elem;" << std::endl;
+    return true;
+}
+
+// ./indextext          根据raw.bin全量建立索引并写入数据库
+// ./indextext update   应用parser update生成的变更集，不重建整个索引
+// ./indextext migrate  把旧的逐行倒排表转存为按词编码的inverted_blob
+int main(int argc, char *argv[])
 {
     ns_index::Index *index = ns_index::Index::GetInstance();
-    index->BuildIndex(input);
-    index->SaveInvertedIndex();
-    // if (index->LoadIndex() == true)
-    //     std::cout << "读取完成" << std::endl;
-    // else
-    //     std::cout << "读取失败" << std::endl;
-    return 0;
-}
\ No newline at end of file
+    if (argc > 1 && std::string(argv[1]) == "update")
+    {
+        return ApplyChanges(index) ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "migrate")
+    {
+        return Migrate(index) ? 0 : 1;
+    }
+    // 拉链在建完之后才完整，整体编码写入
+    if (!index->BuildIndex(input))
+    {
+        return 1;
+    }
+    return index->SaveInvertedIndex() ? 0 : 1;
+}
@@ -1,8 +1,18 @@
 #pragma once
-// 日志
+// 日志：调用线程只格式化一行并放入本线程的环形缓冲，后台线程定期取出写到stdout或日志文件
+// 缓冲满时丢弃并计数，不会阻塞调用线程；同一处LOG的同一条内容每秒最多输出LOG_RATE_LIMIT条，多余的合并成一个计数
 #include <iostream>
 #include <string>
 #include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "trace.hpp"
 
 #define NORMAL 1
 #define NOTICE 2
@@ -10,14 +20,328 @@
 #define DEBUG 4
 #define FATAL 5
 
-#define LOG(LEVEL, MESSAGE) log(#LEVEL, MESSAGE, __FILE__, __LINE__)
+// 编译期过滤：低于这个级别的LOG整条语句被编译器删除，例如 -DLOG_COMPILE_LEVEL=WARNING
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL DEBUG
+#endif
+#ifndef LOG_RATE_LIMIT
+#define LOG_RATE_LIMIT 20
+#endif
+
+// 级别未启用时MESSAGE不会被求值，拼接字符串的开销也省掉
 // 符号 # 称为字符串化运算符,它会把宏调用时的实参转换为字符串
 //__FTLE__  获取文件名称
 //__LINE__  获取行号
-void log(std::string level, std::string message, std::string file, int line)
+#define LOG(LEVEL, MESSAGE)                                                                       \
+    do                                                                                            \
+    {                                                                                             \
+        if (ns_log::Severity(LEVEL) >= ns_log::Severity(LOG_COMPILE_LEVEL) && ns_log::Enabled(LEVEL)) \
+        {                                                                                         \
+            static ns_log::Site log_site_(#LEVEL, __FILE__, __LINE__);                            \
+            ns_log::Write(log_site_, MESSAGE);                                                    \
+        }                                                                                         \
+    } while (0)
+
+namespace ns_log
 {
-    std::cout << "[" << level << "]"
-              << "[" << time(nullptr) << "]"
-              << "[" << message << "]"
-              << "[" << file << " : " << line << "]" << std::endl;
+    const std::size_t kRingSize = 4096; // 每个线程最多暂存的行数，须为2的幂
+    const int kFlushIntervalMs = 20;
+    const long kRotateBytes = 64L << 20; // 日志文件超过这么大时轮转
+    const int kRotateFiles = 5;          // 保留log.txt.1 ~ log.txt.5
+    const std::size_t kSiteSlots = 8;    // 每处LOG同时跟踪的不同内容数
+
+    // 级别宏的数值不是严重程度的顺序，过滤时按 DEBUG < NORMAL < NOTICE < WARNING < FATAL 比较
+    inline constexpr int Severity(int level)
+    {
+        return level == DEBUG ? 0 : level == NORMAL ? 1 : level == NOTICE ? 2 : level == WARNING ? 3 : 4;
+    }
+
+    // 运行期过滤，默认输出全部级别；环境变量LOG_LEVEL可设为DEBUG/NORMAL/NOTICE/WARNING/FATAL
+    inline std::atomic<int> &MinSeverity()
+    {
+        static std::atomic<int> min_severity(0);
+        return min_severity;
+    }
+    inline bool Enabled(int level) { return Severity(level) >= MinSeverity().load(std::memory_order_relaxed); }
+    inline void SetLevel(int level) { MinSeverity().store(Severity(level)); }
+
+    // 一处LOG调用；限流按内容区分，同一处输出的不同内容互不影响，只有重复刷屏的同一行会被合并
+    struct Site
+    {
+        // 一种内容在当前这一秒已输出的条数，按内容哈希分槽，哈希不同时由新内容接管
+        struct Slot
+        {
+            std::atomic<std::size_t> hash;
+            std::atomic<int64_t> window;
+            std::atomic<uint32_t> count;
+        };
+
+        const char *level;
+        const char *file;
+        int line;
+        Slot slots[kSiteSlots];
+        std::atomic<uint64_t> suppressed; // 本处被限流的条数，随下一条输出一起报告
+
+        Site(const char *level, const char *file, int line) : level(level), file(file), line(line), suppressed(0)
+        {
+            for (Slot &slot : slots)
+            {
+                slot.hash.store(0, std::memory_order_relaxed);
+                slot.window.store(0, std::memory_order_relaxed);
+                slot.count.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // 跨秒或换了内容时重置计数，并发下的少量误差可以接受
+        bool Allow(const std::string &message)
+        {
+            std::size_t h = std::hash<std::string>()(message);
+            Slot &slot = slots[h % kSiteSlots];
+            int64_t now = time(nullptr);
+            if (slot.hash.load(std::memory_order_relaxed) != h || slot.window.load(std::memory_order_relaxed) != now)
+            {
+                slot.hash.store(h, std::memory_order_relaxed);
+                slot.window.store(now, std::memory_order_relaxed);
+                slot.count.store(0, std::memory_order_relaxed);
+            }
+            if (slot.count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT)
+            {
+                return true;
+            }
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    };
+
+    // 单生产者单消费者环形缓冲：所属线程写head，后台线程写tail
+    struct Ring
+    {
+        std::vector<std::string> slots;
+        std::atomic<std::size_t> head;
+        std::atomic<std::size_t> tail;
+        std::atomic<bool> orphaned; // 所属线程已退出，取空后可以回收
+
+        Ring() : slots(kRingSize), head(0), tail(0), orphaned(false) {}
+
+        bool Push(std::string &&line)
+        {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) == kRingSize)
+            {
+                return false;
+            }
+            slots[h & (kRingSize - 1)] = std::move(line);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // 取出全部已提交的行追加到out，返回行数
+        std::size_t Drain(std::string *out)
+        {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            std::size_t h = head.load(std::memory_order_acquire);
+            for (std::size_t i = t; i != h; i++)
+            {
+                std::string &slot = slots[i & (kRingSize - 1)];
+                out->append(slot);
+                slot.clear();
+            }
+            tail.store(h, std::memory_order_release);
+            return h - t;
+        }
+    };
+
+    class Logger
+    {
+    private:
+        // 两把锁：mtx只保护rings，线程第一次写日志注册缓冲时只等它；io_mtx保护输出文件，磁盘写入期间只持有io_mtx
+        // 需要同时持有时先io_mtx后mtx，保证先取出的行先写出
+        std::mutex mtx;
+        std::vector<std::shared_ptr<Ring>> rings;
+        std::mutex io_mtx;
+        FILE *out;
+        std::string path; // 为空表示输出到stdout
+        long written;
+        std::atomic<uint64_t> dropped;
+
+        // 线程退出时通知后台线程回收它的缓冲
+        struct Holder
+        {
+            std::shared_ptr<Ring> ring;
+            ~Holder()
+            {
+                if (ring)
+                {
+                    ring->orphaned = true;
+                }
+            }
+        };
+
+        Logger() : out(stdout), written(0), dropped(0)
+        {
+            const char *env = std::getenv("LOG_LEVEL");
+            if (env != nullptr)
+            {
+                std::string name(env);
+                int level = name == "DEBUG" ? DEBUG : name == "NOTICE" ? NOTICE : name == "WARNING" ? WARNING : name == "FATAL" ? FATAL : NORMAL;
+                SetLevel(level);
+            }
+            std::thread([this]
+                        { Run(); })
+                .detach();
+            // Logger不析构，退出时由atexit写出剩余的日志
+            std::atexit([]
+                        { Instance().Flush(); });
+        }
+
+        void Run()
+        {
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(kFlushIntervalMs));
+                Flush();
+            }
+        }
+
+        // 取出全部线程已提交的行，调用方持有mtx
+        void DrainLocked(std::string *buffer)
+        {
+            for (std::size_t i = 0; i < rings.size();)
+            {
+                rings[i]->Drain(buffer);
+                // orphaned在线程最后一次Push之后才置位，此时再取一次即可取空
+                if (rings[i]->orphaned && rings[i]->Drain(buffer) == 0)
+                {
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                    continue;
+                }
+                i++;
+            }
+            uint64_t lost = dropped.exchange(0);
+            if (lost > 0)
+            {
+                buffer->append("[WARNING][" + std::to_string(time(nullptr)) + "][日志缓冲已满, 丢弃" + std::to_string(lost) + "行][log.hpp]\n");
+            }
+        }
+
+        // 调用方持有io_mtx，不持有mtx
+        void FlushLocked()
+        {
+            std::string buffer;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                DrainLocked(&buffer);
+            }
+            if (buffer.empty())
+            {
+                return;
+            }
+            ns_trace::Span span("log.flush", "log", true);
+            fwrite(buffer.data(), 1, buffer.size(), out);
+            fflush(out);
+            written += buffer.size();
+            if (out != stdout && written >= kRotateBytes)
+            {
+                Rotate();
+            }
+        }
+
+        // log.txt -> log.txt.1 -> ... -> log.txt.N，最旧的被覆盖
+        void Rotate()
+        {
+            fclose(out);
+            for (int i = kRotateFiles - 1; i >= 1; i--)
+            {
+                std::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+            }
+            std::rename(path.c_str(), (path + ".1").c_str());
+            Open();
+        }
+
+        void Open()
+        {
+            written = 0;
+            out = fopen(path.c_str(), "a");
+            if (out == nullptr)
+            {
+                out = stdout;
+                path.clear();
+                return;
+            }
+            fseek(out, 0, SEEK_END);
+            written = ftell(out);
+        }
+
+        Ring *ThreadRing()
+        {
+            thread_local Holder holder;
+            if (!holder.ring)
+            {
+                holder.ring = std::make_shared<Ring>();
+                std::unique_lock<std::mutex> lock(mtx);
+                rings.push_back(holder.ring);
+            }
+            return holder.ring.get();
+        }
+
+    public:
+        // 有意不释放：退出时线程池等后台线程可能还在写日志，析构后的Logger不能再被访问
+        static Logger &Instance()
+        {
+            static Logger *logger = new Logger();
+            return *logger;
+        }
+
+        // 之后的日志写入path（追加），打开失败时仍输出到stdout
+        bool SetFile(const std::string &file)
+        {
+            std::unique_lock<std::mutex> lock(io_mtx);
+            FlushLocked();
+            if (out != stdout)
+            {
+                fclose(out);
+            }
+            path = file;
+            Open();
+            return out != stdout;
+        }
+
+        void Push(std::string &&line)
+        {
+            if (!ThreadRing()->Push(std::move(line)))
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // 立即写出所有线程已提交的日志，用于退出前或测试
+        void Flush()
+        {
+            std::unique_lock<std::mutex> lock(io_mtx);
+            FlushLocked();
+        }
+    };
+
+    inline void Write(Site &site, const std::string &message)
+    {
+        if (!site.Allow(message))
+        {
+            return;
+        }
+        ns_trace::Span span("log.write", "log");
+        std::string line;
+        line.reserve(message.size() + 64);
+        line.append("[").append(site.level).append("][").append(std::to_string(time(nullptr))).append("][").append(message);
+        uint64_t suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+        if (suppressed > 0)
+        {
+            line.append(" (此前限流" + std::to_string(suppressed) + "条)");
+        }
+        line.append("][").append(site.file).append(" : ").append(std::to_string(site.line)).append("]\n");
+        Logger::Instance().Push(std::move(line));
+    }
+
+    inline bool SetFile(const std::string &path) { return Logger::Instance().SetFile(path); }
+    inline void Flush() { Logger::Instance().Flush(); }
 }
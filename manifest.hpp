@@ -0,0 +1,210 @@
+#pragma once
+// 增量建库：manifest记录上次解析时每个html文件的状态，变更集记录这次需要应用到索引上的增删改
+// manifest每行: mtime \t size \t md5 \t 指纹 \t 状态 \t doc_id \t 路径
+// 变更集每行: 操作 \t 旧doc_id \t 新doc_id \t url，没有的id写-；新增和修改的文档按新doc_id顺序写在记录文件中
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include "log.hpp"
+
+namespace ns_manifest
+{
+    // 文件解析后的去向
+    enum EntryState
+    {
+        STATE_KEPT = 'K',    // 写入了raw.bin，doc_id有效
+        STATE_DUP = 'D',     // 与已有文档近重复，被丢弃
+        STATE_SKIPPED = 'S'  // 解析失败或没有标题
+    };
+
+    struct Entry
+    {
+        int64_t mtime;
+        uint64_t size;
+        std::string md5;
+        uint64_t fp; // 去模板后正文的SimHash指纹，增量去重时与新文档比较
+        char state;
+        uint64_t doc_id;
+        Entry() : mtime(0), size(0), fp(0), state(STATE_SKIPPED), doc_id(0) {}
+    };
+
+    class Manifest
+    {
+    private:
+        std::unordered_map<std::string, Entry> entries; // 路径 -> 状态
+
+    public:
+        // 文件不存在返回false，表示还没有做过全量解析
+        bool Load(const std::string &path)
+        {
+            std::ifstream in(path.c_str());
+            if (!in.is_open())
+            {
+                return false;
+            }
+            entries.clear();
+            std::string line;
+            std::size_t lineno = 0;
+            while (std::getline(in, line))
+            {
+                lineno++;
+                std::string fields[6];
+                std::size_t start = 0;
+                int n = 0;
+                // 路径放在最后，前6列按\t切分后剩下的都是路径
+                for (; n < 6; n++)
+                {
+                    std::size_t tab = line.find('\t', start);
+                    if (tab == std::string::npos)
+                    {
+                        break;
+                    }
+                    fields[n] = line.substr(start, tab - start);
+                    start = tab + 1;
+                }
+                if (n != 6 || fields[4].size() != 1)
+                {
+                    LOG(WARNING, path + " 第" + std::to_string(lineno) + "行格式错误");
+                    return false;
+                }
+                Entry entry;
+                entry.mtime = std::strtoll(fields[0].c_str(), nullptr, 10);
+                entry.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+                entry.md5 = fields[2];
+                entry.fp = std::strtoull(fields[3].c_str(), nullptr, 16);
+                entry.state = fields[4][0];
+                entry.doc_id = std::strtoull(fields[5].c_str(), nullptr, 10);
+                entries[line.substr(start)] = entry;
+            }
+            return true;
+        }
+
+        // 先写临时文件再改名，中途失败不会留下半个manifest
+        bool Save(const std::string &path) const
+        {
+            std::string tmp = path + ".tmp";
+            FILE *fp = fopen(tmp.c_str(), "w");
+            if (fp == nullptr)
+            {
+                LOG(WARNING, "open " + tmp + " for write error");
+                return false;
+            }
+            bool ok = true;
+            for (auto &item : entries)
+            {
+                const Entry &e = item.second;
+                ok = fprintf(fp, "%lld\t%llu\t%s\t%016llx\t%c\t%llu\t%s\n", static_cast<long long>(e.mtime),
+                             static_cast<unsigned long long>(e.size), e.md5.c_str(), static_cast<unsigned long long>(e.fp),
+                             e.state, static_cast<unsigned long long>(e.doc_id), item.first.c_str()) > 0 && ok;
+            }
+            ok = fclose(fp) == 0 && ok;
+            return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+        }
+
+        Entry *Find(const std::string &path)
+        {
+            auto iter = entries.find(path);
+            return iter == entries.end() ? nullptr : &iter->second;
+        }
+
+        // 返回的引用在之后插入其他文件时仍然有效
+        Entry &Put(const std::string &path, const Entry &entry) { return entries[path] = entry; }
+        void Erase(const std::string &path) { entries.erase(path); }
+        void Clear() { entries.clear(); }
+        std::size_t Size() const { return entries.size(); }
+
+        const std::unordered_map<std::string, Entry> &Entries() const { return entries; }
+    };
+
+    enum ChangeKind
+    {
+        CHANGE_ADD,
+        CHANGE_UPDATE, // 删除旧文档并以新doc_id加入，url不变
+        CHANGE_DELETE
+    };
+
+    struct Change
+    {
+        ChangeKind kind;
+        uint64_t old_id; // UPDATE、DELETE有效
+        uint64_t new_id; // ADD、UPDATE有效
+        std::string url;
+        Change() : kind(CHANGE_ADD), old_id(0), new_id(0) {}
+    };
+
+    inline const char *ChangeName(ChangeKind kind)
+    {
+        static const char *const names[] = {"add", "update", "delete"};
+        return names[kind];
+    }
+
+    inline bool SaveChanges(const std::string &path, const std::vector<Change> &changes)
+    {
+        std::ofstream out(path.c_str(), std::ios::out | std::ios::trunc);
+        if (!out.is_open())
+        {
+            LOG(WARNING, "open " + path + " for write error");
+            return false;
+        }
+        for (const Change &c : changes)
+        {
+            out << ChangeName(c.kind) << '\t'
+                << (c.kind == CHANGE_ADD ? std::string("-") : std::to_string(c.old_id)) << '\t'
+                << (c.kind == CHANGE_DELETE ? std::string("-") : std::to_string(c.new_id)) << '\t'
+                << c.url << '\n';
+        }
+        return static_cast<bool>(out.flush());
+    }
+
+    inline bool LoadChanges(const std::string &path, std::vector<Change> *changes)
+    {
+        std::ifstream in(path.c_str());
+        if (!in.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::string fields[3];
+            std::size_t start = 0;
+            int n = 0;
+            for (; n < 3; n++)
+            {
+                std::size_t tab = line.find('\t', start);
+                if (tab == std::string::npos)
+                {
+                    break;
+                }
+                fields[n] = line.substr(start, tab - start);
+                start = tab + 1;
+            }
+            Change c;
+            if (n == 3 && fields[0] == "add")
+            {
+                c.kind = CHANGE_ADD;
+            }
+            else if (n == 3 && fields[0] == "update")
+            {
+                c.kind = CHANGE_UPDATE;
+            }
+            else if (n == 3 && fields[0] == "delete")
+            {
+                c.kind = CHANGE_DELETE;
+            }
+            else
+            {
+                LOG(WARNING, path + " 格式错误: " + line);
+                return false;
+            }
+            c.old_id = std::strtoull(fields[1].c_str(), nullptr, 10);
+            c.new_id = std::strtoull(fields[2].c_str(), nullptr, 10);
+            c.url = line.substr(start);
+            changes->push_back(c);
+        }
+        return true;
+    }
+}
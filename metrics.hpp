@@ -0,0 +1,355 @@
+#pragma once
+// 查询各阶段的延迟直方图：每个线程一组，只由本线程写入，读取时汇总，记录路径上没有锁和原子读改写
+// 直方图按HDR的方式分桶：每个2的幂区间再均分16份，相对误差不超过1/16，覆盖1ns到约18分钟
+// 请求级计时：Begin之后每次Lap把距上次Lap的时间记到指定阶段，End时写入直方图
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include "trace.hpp"
+
+namespace ns_metrics
+{
+    enum Stage
+    {
+        STAGE_SEGMENT,   // 查询解析和分词
+        STAGE_LOOKUP,    // 过滤位图和倒排拉链查找
+        STAGE_SCORE,     // 拉链合并与打分
+        STAGE_FACETS,    // 分面计数
+        STAGE_SORT,      // 按得分排序、截取前k条
+        STAGE_SNIPPET,   // 摘要生成
+        STAGE_SERIALIZE, // 拼接json
+        STAGE_REQUEST,   // /s请求总耗时，由http层记录
+        STAGE_COUNT
+    };
+
+    inline const char *StageName(int stage)
+    {
+        static const char *const names[STAGE_COUNT] = {"segment", "lookup", "score", "facets", "sort", "snippet", "serialize", "request"};
+        return names[stage];
+    }
+
+    const int kSubBits = 4;
+    const int kMaxBits = 40;
+    const std::size_t kBuckets = (kMaxBits - kSubBits + 1) << kSubBits;
+
+    inline std::size_t BucketOf(uint64_t ns)
+    {
+        if (ns < (1u << kSubBits))
+        {
+            return ns;
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= kMaxBits)
+        {
+            return kBuckets - 1;
+        }
+        int shift = msb - kSubBits;
+        return ((shift + 1) << kSubBits) + ((ns >> shift) - (1u << kSubBits));
+    }
+
+    // 桶内的最大值，分位数按它报告，偏保守
+    inline uint64_t BucketUpper(std::size_t bucket)
+    {
+        if (bucket < (1u << kSubBits))
+        {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket >> kSubBits) - 1;
+        uint64_t sub = (bucket & ((1u << kSubBits) - 1)) + (1u << kSubBits);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    // 只有所属线程写入，用load+store代替fetch_add；其他线程读取时可能看到稍旧的值
+    struct Histogram
+    {
+        std::atomic<uint64_t> counts[kBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+
+        Histogram() : count(0), sum(0), max(0)
+        {
+            for (auto &c : counts)
+            {
+                c.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        static void Bump(std::atomic<uint64_t> &a, uint64_t delta)
+        {
+            a.store(a.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+
+        void Record(uint64_t ns)
+        {
+            Bump(counts[BucketOf(ns)], 1);
+            Bump(count, 1);
+            Bump(sum, ns);
+            if (ns > max.load(std::memory_order_relaxed))
+            {
+                max.store(ns, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // 多个线程汇总后的结果，时间单位为秒
+    struct Summary
+    {
+        uint64_t count;
+        double sum;
+        double max;
+        double p50, p90, p99, p999;
+    };
+
+    class Registry
+    {
+    private:
+        struct ThreadHistograms
+        {
+            Histogram stages[STAGE_COUNT];
+        };
+
+        std::mutex mtx; // 只在线程第一次记录时注册、以及汇总时加锁
+        std::vector<std::unique_ptr<ThreadHistograms>> threads; // 线程退出后保留，计数不丢失
+        std::atomic<bool> enabled;
+
+        Registry() : enabled(true) {}
+
+    public:
+        static Registry &Instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        bool Enabled() const { return enabled.load(std::memory_order_relaxed); }
+        void SetEnabled(bool on) { enabled = on; }
+
+        Histogram &Local(int stage)
+        {
+            thread_local ThreadHistograms *local = nullptr;
+            if (local == nullptr)
+            {
+                std::unique_ptr<ThreadHistograms> h(new ThreadHistograms());
+                local = h.get();
+                std::unique_lock<std::mutex> lock(mtx);
+                threads.push_back(std::move(h));
+            }
+            return local->stages[stage];
+        }
+
+        Summary Summarize(int stage)
+        {
+            std::vector<uint64_t> merged(kBuckets, 0);
+            uint64_t count = 0, sum = 0, max = 0;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                for (auto &t : threads)
+                {
+                    Histogram &h = t->stages[stage];
+                    for (std::size_t b = 0; b < kBuckets; b++)
+                    {
+                        merged[b] += h.counts[b].load(std::memory_order_relaxed);
+                    }
+                    count += h.count.load(std::memory_order_relaxed);
+                    sum += h.sum.load(std::memory_order_relaxed);
+                    max = std::max(max, h.max.load(std::memory_order_relaxed));
+                }
+            }
+            Summary s;
+            s.count = count;
+            s.sum = sum / 1e9;
+            s.max = max / 1e9;
+            const double qs[] = {0.5, 0.9, 0.99, 0.999};
+            double *outs[] = {&s.p50, &s.p90, &s.p99, &s.p999};
+            uint64_t total = 0;
+            for (std::size_t b = 0; b < kBuckets; b++)
+            {
+                total += merged[b];
+            }
+            for (int q = 0; q < 4; q++)
+            {
+                *outs[q] = 0;
+                uint64_t rank = static_cast<uint64_t>(qs[q] * total);
+                uint64_t seen = 0;
+                for (std::size_t b = 0; b < kBuckets && total > 0; b++)
+                {
+                    seen += merged[b];
+                    if (seen > rank)
+                    {
+                        *outs[q] = std::min<uint64_t>(BucketUpper(b), max) / 1e9;
+                        break;
+                    }
+                }
+            }
+            return s;
+        }
+    };
+
+    inline void Record(int stage, uint64_t ns)
+    {
+        Registry::Instance().Local(stage).Record(ns);
+    }
+
+    // 一次请求各阶段的耗时，touched按位标记经过的阶段
+    struct Timings
+    {
+        unsigned touched;
+        uint64_t ns[STAGE_COUNT];
+
+        uint64_t Total() const
+        {
+            uint64_t total = 0;
+            for (int s = 0; s < STAGE_COUNT; s++)
+            {
+                total += (touched & (1u << s)) ? ns[s] : 0;
+            }
+            return total;
+        }
+    };
+
+    // 本线程当前请求的计时状态
+    struct RequestClock
+    {
+        bool active;
+        bool record; // 是否写入直方图；关闭统计但需要本次耗时（explain、慢查询）时只计时
+        std::chrono::steady_clock::time_point last;
+        Timings timings;
+    };
+
+    inline RequestClock &Current()
+    {
+        thread_local RequestClock clock = RequestClock();
+        return clock;
+    }
+
+    // 关闭统计且不要求计时时Begin不启动计时，之后的Lap、End都直接返回
+    // 被采样追踪的请求也计时，每次Lap同时记为一个span
+    inline void Begin(bool force = false)
+    {
+        RequestClock &c = Current();
+        c.record = Registry::Instance().Enabled();
+        c.active = c.record || force || ns_trace::Sampled();
+        if (!c.active)
+        {
+            return;
+        }
+        c.timings.touched = 0;
+        c.last = std::chrono::steady_clock::now();
+    }
+
+    inline void Lap(int stage)
+    {
+        RequestClock &c = Current();
+        if (!c.active)
+        {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.last).count();
+        ns_trace::Emit(StageName(stage), "search", c.last, now);
+        c.last = now;
+        Timings &t = c.timings;
+        if (!(t.touched & (1u << stage)))
+        {
+            t.touched |= 1u << stage;
+            t.ns[stage] = 0;
+        }
+        t.ns[stage] += ns;
+    }
+
+    // out不为空时取出本次请求的各阶段耗时，未计时则touched为0
+    inline void End(Timings *out = nullptr)
+    {
+        RequestClock &c = Current();
+        if (out != nullptr)
+        {
+            out->touched = c.active ? c.timings.touched : 0;
+            std::copy(c.timings.ns, c.timings.ns + STAGE_COUNT, out->ns);
+        }
+        if (!c.active)
+        {
+            return;
+        }
+        c.active = false;
+        for (int s = 0; s < STAGE_COUNT && c.record; s++)
+        {
+            if (c.timings.touched & (1u << s))
+            {
+                Record(s, c.timings.ns[s]);
+            }
+        }
+    }
+
+    // 作用域计时，析构时记录
+    class ScopedTimer
+    {
+    private:
+        int stage;
+        bool on;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit ScopedTimer(int stage) : stage(stage), on(Registry::Instance().Enabled())
+        {
+            if (on)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~ScopedTimer()
+        {
+            if (on)
+            {
+                Record(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+    };
+
+    // Prometheus文本格式
+    inline void AppendValue(std::string *out, const std::string &name, double value)
+    {
+        char buf[64];
+        int n = snprintf(buf, sizeof(buf), " %.9g\n", value);
+        out->append(name);
+        out->append(buf, n);
+    }
+
+    inline void AppendHeader(std::string *out, const char *name, const char *type, const char *help)
+    {
+        out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    // 各阶段以summary输出，分位数基于进程启动以来的全部样本
+    inline void AppendStages(std::string *out)
+    {
+        Summary sums[STAGE_COUNT];
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            sums[s] = Registry::Instance().Summarize(s);
+        }
+        AppendHeader(out, "search_stage_seconds", "summary", "Latency of each /s stage");
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            std::string label = std::string("{stage=\"") + StageName(s) + "\"";
+            AppendValue(out, "search_stage_seconds" + label + ",quantile=\"0.5\"}", sums[s].p50);
+            AppendValue(out, "search_stage_seconds" + label + ",quantile=\"0.9\"}", sums[s].p90);
+            AppendValue(out, "search_stage_seconds" + label + ",quantile=\"0.99\"}", sums[s].p99);
+            AppendValue(out, "search_stage_seconds" + label + ",quantile=\"0.999\"}", sums[s].p999);
+            AppendValue(out, "search_stage_seconds_sum" + label + "}", sums[s].sum);
+            AppendValue(out, "search_stage_seconds_count" + label + "}", static_cast<double>(sums[s].count));
+        }
+        AppendHeader(out, "search_stage_max_seconds", "gauge", "Slowest observation of each /s stage");
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            AppendValue(out, std::string("search_stage_max_seconds{stage=\"") + StageName(s) + "\"}", sums[s].max);
+        }
+    }
+}
@@ -0,0 +1,385 @@
+#pragma once
+// 最小完美哈希词典：只读索引的查询词 -> 编号映射
+// 构建完成后是一块连续、与地址无关的内存，可以直接写文件再mmap回来使用
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include "log.hpp"
+
+namespace ns_mphf
+{
+    // MurmurHash64A
+    inline uint64_t Hash64(const char *data, std::size_t len, uint64_t seed)
+    {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = seed ^ (len * m);
+        const char *end = data + (len & ~static_cast<std::size_t>(7));
+        for (const char *p = data; p != end; p += 8)
+        {
+            uint64_t k;
+            std::memcpy(&k, p, 8);
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+        const unsigned char *tail = reinterpret_cast<const unsigned char *>(end);
+        switch (len & 7)
+        {
+        case 7:
+            h ^= uint64_t(tail[6]) << 48;
+            // fall through
+        case 6:
+            h ^= uint64_t(tail[5]) << 40;
+            // fall through
+        case 5:
+            h ^= uint64_t(tail[4]) << 32;
+            // fall through
+        case 4:
+            h ^= uint64_t(tail[3]) << 24;
+            // fall through
+        case 3:
+            h ^= uint64_t(tail[2]) << 16;
+            // fall through
+        case 2:
+            h ^= uint64_t(tail[1]) << 8;
+            // fall through
+        case 1:
+            h ^= uint64_t(tail[0]);
+            h *= m;
+        }
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+    inline uint64_t Mix64(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // 词典内存布局（均为小端、4字节对齐，偏移相对于起始地址）：
+    //   Header
+    //   uint32_t pilots[buckets]     每个桶的位移参数
+    //   uint32_t remap[table - n]    落在[n, table)的位置重映射到[0, n)的空位
+    //   Slot     slots[n]            指纹 + 词在key区的位置 + 值，一次缓存行读取完成校验
+    //   char     keys[]              所有词首尾相接
+    class PerfectHashDict
+    {
+    private:
+        static const uint32_t kMagic = 0x48504d53; // "SMPH"
+        static const uint32_t kVersion = 1;
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t n;       // 词数
+            uint32_t table;   // 中间表大小，略大于n以加快构建
+            uint32_t buckets; // 桶数
+            uint32_t pad;
+            uint64_t seed;
+            uint64_t key_bytes;
+        };
+
+        struct Slot
+        {
+            uint32_t fingerprint;
+            uint32_t key_offset;
+            uint32_t key_len;
+            uint32_t value;
+        };
+
+        const char *base;
+        const Header *header;
+        const uint32_t *pilots;
+        const uint32_t *remap;
+        const Slot *slots;
+        const char *keys;
+        std::vector<uint64_t> owned; // Build得到的数据，按8字节对齐；Attach到mmap区域时为空
+
+    private:
+        static uint32_t Fingerprint(uint64_t h) { return static_cast<uint32_t>(Mix64(h) >> 32); }
+        static uint32_t BucketOf(uint64_t h, uint32_t buckets) { return static_cast<uint32_t>((h >> 32) % buckets); }
+        static uint32_t Position(uint64_t h, uint32_t pilot, uint32_t table)
+        {
+            return static_cast<uint32_t>((h ^ Mix64(pilot + 1)) % table);
+        }
+
+    public:
+        PerfectHashDict() : base(nullptr), header(nullptr), pilots(nullptr), remap(nullptr), slots(nullptr), keys(nullptr) {}
+        PerfectHashDict(const PerfectHashDict &) = delete;
+        PerfectHashDict &operator=(const PerfectHashDict &) = delete;
+
+        bool Empty() const { return header == nullptr; }
+        uint32_t Size() const { return header == nullptr ? 0 : header->n; }
+        const char *Data() const { return base; }
+        std::size_t Bytes() const
+        {
+            if (header == nullptr)
+                return 0;
+            return (keys - base) + header->key_bytes;
+        }
+
+        // 以keys[i] -> values[i]构建，keys不能重复
+        bool Build(const std::vector<std::string> &key_list, const std::vector<uint32_t> &values)
+        {
+            const uint32_t n = static_cast<uint32_t>(key_list.size());
+            if (n == 0 || values.size() != key_list.size())
+            {
+                return false;
+            }
+            const uint32_t table = n + n / 64 + 1;     // 负载因子约0.985
+            const uint32_t buckets = (n + 3) / 4 + 1;  // 平均每桶4个词
+            uint64_t key_bytes = 0;
+            for (auto &k : key_list)
+            {
+                key_bytes += k.size();
+            }
+            if (key_bytes > UINT32_MAX)
+            {
+                LOG(WARNING, "词典过大, 无法构建完美哈希");
+                return false;
+            }
+
+            for (uint64_t seed = 0x9e3779b97f4a7c15ULL, attempt = 0; attempt < 8; attempt++, seed = Mix64(seed))
+            {
+                std::vector<uint32_t> pilot_of(buckets, 0);
+                std::vector<uint32_t> slot_of(n); // 第i个词在中间表中的位置
+                if (Search(key_list, seed, table, buckets, &pilot_of, &slot_of))
+                {
+                    Layout(key_list, values, seed, table, buckets, key_bytes, pilot_of, slot_of);
+                    return true;
+                }
+            }
+            LOG(WARNING, "完美哈希构建失败");
+            return false;
+        }
+
+        // 直接使用外部的一块内存（如mmap的文件），调用者保证其生命周期
+        bool Attach(const char *data, std::size_t len)
+        {
+            if (len < sizeof(Header))
+            {
+                return false;
+            }
+            const Header *h = reinterpret_cast<const Header *>(data);
+            if (h->magic != kMagic || h->version != kVersion || h->table < h->n)
+            {
+                LOG(WARNING, "完美哈希词典格式错误");
+                return false;
+            }
+            std::size_t need = sizeof(Header) + sizeof(uint32_t) * (static_cast<std::size_t>(h->buckets) + (h->table - h->n)) +
+                               sizeof(Slot) * static_cast<std::size_t>(h->n) + h->key_bytes;
+            if (len < need)
+            {
+                LOG(WARNING, "完美哈希词典长度不足");
+                return false;
+            }
+            base = data;
+            header = h;
+            pilots = reinterpret_cast<const uint32_t *>(data + sizeof(Header));
+            remap = pilots + h->buckets;
+            slots = reinterpret_cast<const Slot *>(remap + (h->table - h->n));
+            keys = reinterpret_cast<const char *>(slots + h->n);
+            return true;
+        }
+
+        // 查找成功返回true并写出value；不存在的词靠指纹+逐字节比较排除
+        bool Find(const char *key, std::size_t len, uint32_t *value) const
+        {
+            if (header == nullptr)
+            {
+                return false;
+            }
+            uint64_t h = Hash64(key, len, header->seed);
+            uint32_t pos = Position(h, pilots[BucketOf(h, header->buckets)], header->table);
+            if (pos >= header->n)
+            {
+                pos = remap[pos - header->n];
+            }
+            const Slot &slot = slots[pos];
+            if (slot.fingerprint != Fingerprint(h) || slot.key_len != len ||
+                std::memcmp(keys + slot.key_offset, key, len) != 0)
+            {
+                return false;
+            }
+            *value = slot.value;
+            return true;
+        }
+
+        bool Find(const std::string &key, uint32_t *value) const
+        {
+            return Find(key.data(), key.size(), value);
+        }
+
+        bool Save(const std::string &path) const
+        {
+            if (header == nullptr)
+            {
+                return false;
+            }
+            std::ofstream out(path, std::ios::out | std::ios::binary);
+            if (!out.is_open())
+            {
+                LOG(WARNING, "open " + path + " failed!");
+                return false;
+            }
+            out.write(base, Bytes());
+            return out.good();
+        }
+
+    private:
+        // 桶按大小从大到小依次为每个桶寻找一个pilot，使桶内所有词落到互不冲突的空位上
+        bool Search(const std::vector<std::string> &key_list, uint64_t seed, uint32_t table, uint32_t buckets,
+                    std::vector<uint32_t> *pilot_of, std::vector<uint32_t> *slot_of)
+        {
+            const uint32_t n = static_cast<uint32_t>(key_list.size());
+            std::vector<uint64_t> hashes(n);
+            std::vector<uint32_t> bucket_size(buckets + 1, 0);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                hashes[i] = Hash64(key_list[i].data(), key_list[i].size(), seed);
+                bucket_size[BucketOf(hashes[i], buckets) + 1]++;
+            }
+            // 计数排序，把同一个桶的词放在一起
+            for (uint32_t b = 0; b < buckets; b++)
+            {
+                bucket_size[b + 1] += bucket_size[b];
+            }
+            std::vector<uint32_t> start(bucket_size.begin(), bucket_size.end());
+            std::vector<uint32_t> members(n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                members[start[BucketOf(hashes[i], buckets)]++] = i;
+            }
+            std::vector<uint32_t> order(buckets);
+            for (uint32_t b = 0; b < buckets; b++)
+            {
+                order[b] = b;
+            }
+            std::sort(order.begin(), order.end(), [&bucket_size](uint32_t a, uint32_t b)
+                      { return bucket_size[a + 1] - bucket_size[a] > bucket_size[b + 1] - bucket_size[b]; });
+
+            std::vector<bool> taken(table, false);
+            std::vector<uint32_t> positions;
+            const uint32_t max_pilot = 1u << 20;
+            for (uint32_t b : order)
+            {
+                uint32_t begin = bucket_size[b], end = bucket_size[b + 1];
+                if (begin == end)
+                {
+                    break; // 之后都是空桶
+                }
+                bool found = false;
+                for (uint32_t pilot = 0; pilot < max_pilot && !found; pilot++)
+                {
+                    positions.clear();
+                    found = true;
+                    for (uint32_t k = begin; k < end; k++)
+                    {
+                        uint32_t pos = Position(hashes[members[k]], pilot, table);
+                        if (taken[pos] || std::find(positions.begin(), positions.end(), pos) != positions.end())
+                        {
+                            found = false;
+                            break;
+                        }
+                        positions.push_back(pos);
+                    }
+                    if (found)
+                    {
+                        (*pilot_of)[b] = pilot;
+                        for (uint32_t k = begin; k < end; k++)
+                        {
+                            taken[positions[k - begin]] = true;
+                            (*slot_of)[members[k]] = positions[k - begin];
+                        }
+                    }
+                }
+                if (!found)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void Layout(const std::vector<std::string> &key_list, const std::vector<uint32_t> &values, uint64_t seed,
+                    uint32_t table, uint32_t buckets, uint64_t key_bytes,
+                    const std::vector<uint32_t> &pilot_of, const std::vector<uint32_t> &slot_of)
+        {
+            const uint32_t n = static_cast<uint32_t>(key_list.size());
+            std::size_t size = sizeof(Header) + sizeof(uint32_t) * (static_cast<std::size_t>(buckets) + (table - n)) +
+                               sizeof(Slot) * static_cast<std::size_t>(n) + key_bytes;
+            owned.assign((size + 7) / 8, 0);
+            char *data = reinterpret_cast<char *>(owned.data());
+
+            Header *h = reinterpret_cast<Header *>(data);
+            h->magic = kMagic;
+            h->version = kVersion;
+            h->n = n;
+            h->table = table;
+            h->buckets = buckets;
+            h->pad = 0;
+            h->seed = seed;
+            h->key_bytes = key_bytes;
+
+            uint32_t *out_pilots = reinterpret_cast<uint32_t *>(data + sizeof(Header));
+            std::memcpy(out_pilots, pilot_of.data(), sizeof(uint32_t) * buckets);
+
+            // 中间表中[0, n)的空位依次分给落在[n, table)的词，得到最小完美哈希
+            uint32_t *out_remap = out_pilots + buckets;
+            std::vector<bool> used(n, false);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (slot_of[i] < n)
+                {
+                    used[slot_of[i]] = true;
+                }
+            }
+            uint32_t free_pos = 0;
+            std::vector<uint32_t> final_pos(n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (slot_of[i] < n)
+                {
+                    final_pos[i] = slot_of[i];
+                    continue;
+                }
+                while (used[free_pos])
+                {
+                    free_pos++;
+                }
+                used[free_pos] = true;
+                out_remap[slot_of[i] - n] = free_pos;
+                final_pos[i] = free_pos;
+            }
+
+            Slot *out_slots = reinterpret_cast<Slot *>(out_remap + (table - n));
+            char *out_keys = reinterpret_cast<char *>(out_slots + n);
+            uint32_t offset = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                Slot &slot = out_slots[final_pos[i]];
+                slot.fingerprint = Fingerprint(Hash64(key_list[i].data(), key_list[i].size(), seed));
+                slot.key_offset = offset;
+                slot.key_len = static_cast<uint32_t>(key_list[i].size());
+                slot.value = values[i];
+                std::memcpy(out_keys + offset, key_list[i].data(), key_list[i].size());
+                offset += slot.key_len;
+            }
+            Attach(data, size);
+        }
+    };
+}
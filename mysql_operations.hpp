@@ -3,22 +3,115 @@
 
 #include "util.hpp"
 #include "md5.h"
+#include "threadpool.hpp"
+#include "mysql_pool.hpp"
+#include "trace.hpp"
 #include <cstring>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
 
 namespace ns_operation
 {
+    // 连接参数，各表和BulkWriter共用
+    const char *const DB_HOST = "172.17.0.2";
+    const char *const DB_PORT = "3306";
+    const char *const DB_USER = "root";
+    const char *const DB_PASSWD = "123456";
+    const char *const DB_NAME = "search_engine";
+    const std::size_t USER_POOL_SIZE = 8; // TableUser连接池的默认上限
+
+    // ScanAll逐行解码成的类型，字段与表中的列对应
+    struct DocRow
+    {
+        uint64_t doc_id;
+        std::string title;
+        std::string content;
+        std::string url;
+        uint32_t dup_count;
+        DocRow() : doc_id(0), dup_count(0) {}
+    };
+
+    struct PostingRow
+    {
+        uint64_t doc_id;
+        std::string word;
+        int weight;
+        int title_cnt;
+        int content_cnt;
+        PostingRow() : doc_id(0), weight(0), title_cnt(0), content_cnt(0) {}
+    };
+
     class TableBase
     {
     protected:
         MYSQL *mysql; // 一个对象就是一个客户端，管理一张表
         std::mutex mtx;
 
-        const char *HOST = "172.17.0.2";
-        const char *PORT = "3306";
-        const char *USER = "root";
-        const char *PASSWD = "123456";
-        const char *DB_NAME = "search_engine";
+        const char *HOST = DB_HOST;
+        const char *PORT = DB_PORT;
+        const char *USER = DB_USER;
+        const char *PASSWD = DB_PASSWD;
+
+        // 字符串值统一经过这里转义，拼SQL时不再手写引号
+        std::string Quote(const std::string &value)
+        {
+            return ns_util::SQLUtil::Quote(mysql, value);
+        }
+
+        // 用mysql_use_result边从服务器接收边回调，客户端不缓存整个结果集，额外内存与行数无关
+        // 接收完之前连接不能执行其他语句，因此全程持有mtx；func返回false时停止，剩余的行由mysql_free_result丢弃
+        bool ScanRows(const std::string &sql, const std::function<bool(MYSQL_ROW, const unsigned long *, unsigned int)> &func)
+        {
+            ns_trace::Span span("mysql.scan", "mysql");
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
+            {
+                return false;
+            }
+            MYSQL_RES *res = mysql_use_result(mysql);
+            if (res == nullptr)
+            {
+                LOG(FATAL, "mysql use result error: " + std::string(mysql_error(mysql)));
+                return false;
+            }
+            unsigned int fields = mysql_num_fields(res);
+            MYSQL_ROW row;
+            bool ok = true;
+            while (ok && (row = mysql_fetch_row(res)) != nullptr)
+            {
+                ok = func(row, mysql_fetch_lengths(res), fields);
+            }
+            // 流式读取时网络或服务器出错也表现为mysql_fetch_row返回nullptr
+            if (ok && mysql_errno(mysql) != 0)
+            {
+                LOG(FATAL, "mysql fetch row error: " + std::string(mysql_error(mysql)));
+                ok = false;
+            }
+            mysql_free_result(res);
+            return ok;
+        }
+
+        // 按长度取值，NULL视为空串；复用out已有的空间
+        static void Field(std::string *out, MYSQL_ROW row, const unsigned long *lengths, unsigned int i)
+        {
+            if (row[i] == nullptr)
+            {
+                out->clear();
+            }
+            else
+            {
+                out->assign(row[i], lengths[i]);
+            }
+        }
+
+        static long long FieldInt(MYSQL_ROW row, unsigned int i)
+        {
+            return row[i] == nullptr ? 0 : std::strtoll(row[i], nullptr, 10);
+        }
 
     public:
         // 初始化
@@ -35,6 +128,49 @@ namespace ns_operation
             ns_util::SQLUtil::MysqlDestroy(mysql);
         }
 
+        // 暂存表与正式表结构相同，增量更新先把新行写入暂存表，再在一个事务中换入正式表
+        static std::string StagingTable(const std::string &table) { return table + "_staging"; }
+
+        // 按正式表的当前结构重建空的暂存表；DDL会隐式提交，只能在事务之外执行
+        bool ResetStaging(const std::string &table)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            return ns_util::SQLUtil::MysqlQuery(mysql, "drop table if exists " + StagingTable(table) + ";") &&
+                   ns_util::SQLUtil::MysqlQuery(mysql, "create table " + StagingTable(table) + " like " + table + ";");
+        }
+
+        bool DropStaging(const std::string &table)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            return ns_util::SQLUtil::MysqlQuery(mysql, "drop table if exists " + StagingTable(table) + ";");
+        }
+
+        // 把暂存表中的行复制到正式表的语句，只复制columns，自增列由正式表重新分配
+        static std::string CopyStagingSql(const std::string &table, const std::string &columns)
+        {
+            return "insert into " + table + "(" + columns + ") select " + columns + " from " + StagingTable(table) + ";";
+        }
+
+        // 在一个事务中依次执行sqls，任何一条失败都回滚，表保持执行前的状态
+        bool Transaction(const std::vector<std::string> &sqls)
+        {
+            ns_trace::Span span("mysql.transaction", "mysql");
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!ns_util::SQLUtil::MysqlQuery(mysql, "start transaction;"))
+            {
+                return false;
+            }
+            for (const std::string &sql : sqls)
+            {
+                if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
+                {
+                    ns_util::SQLUtil::MysqlQuery(mysql, "rollback;");
+                    return false;
+                }
+            }
+            return ns_util::SQLUtil::MysqlQuery(mysql, "commit;");
+        }
+
         virtual bool Insert(const Json::Value &root) = 0;
         virtual bool Update(const string &id, const Json::Value &root) = 0;
         virtual bool Delete(const string &id) = 0;
@@ -43,6 +179,200 @@ namespace ns_operation
         virtual bool Clear() = 0;
     };
 
+    struct BulkStats
+    {
+        uint64_t rows;
+        uint64_t bytes;        // 发送的SQL字节数
+        uint64_t statements;
+        uint64_t transactions;
+        double seconds;        // 从Start到Finish
+        BulkStats() : rows(0), bytes(0), statements(0), transactions(0), seconds(0) {}
+        double RowsPerSecond() const { return seconds > 0 ? rows / seconds : 0; }
+    };
+
+    // 批量写入一张表：调用线程只把值攒成批，交给后台线程；后台线程用自己的连接转义、拼成多行INSERT，每批在一个事务内提交
+    // 调用线程只在队列满时等待，解析和建索引不再为每一行等一次数据库往返
+    // LOAD DATA LOCAL INFILE需要服务端开启local_infile（默认关闭），所以用多行INSERT
+    // 用法: writer.Start(); writer.Value(a).Value(b).EndRow(); ... writer.Finish();
+    class BulkWriter
+    {
+    private:
+        struct Batch
+        {
+            std::vector<std::string> values; // 按行展开，每行columns个
+            std::size_t bytes;
+            Batch() : bytes(0) {}
+        };
+
+        static const std::size_t kBatchBytes = 4 << 20;        // 调用线程攒够这么多字节交给后台，即一个事务
+        static const std::size_t kMaxStatementBytes = 1 << 20; // 单条语句的上限，低于max_allowed_packet（5.7默认4MB）
+        static const std::size_t kQueueDepth = 4;
+
+        std::string table;
+        std::string head; // insert ignore into table(columns) values
+        std::size_t columns;
+        MYSQL *mysql;
+        Batch batch;
+        std::size_t row_values; // 当前行已加入的值个数
+        ns_threadpool::BoundedQueue<Batch> queue;
+        std::thread worker;
+        std::atomic<bool> failed;
+        BulkStats stats; // 由后台线程更新，Finish之后读取
+        std::chrono::steady_clock::time_point start;
+
+        // 后台线程：一批拆成若干条不超过kMaxStatementBytes的语句，在同一个事务中执行；单行超过上限的值须由调用方预先切分
+        void Run()
+        {
+            Batch b;
+            std::string sql, row;
+            while (queue.Pop(&b))
+            {
+                if (failed)
+                {
+                    continue; // 出错后丢弃剩余批次，调用线程不会被卡住
+                }
+                std::size_t rows = b.values.size() / columns;
+                std::size_t statements = 0;
+                bool ok = true;
+                for (std::size_t r = 0; ok && r < rows; r++)
+                {
+                    row.assign("(");
+                    for (std::size_t c = 0; c < columns; c++)
+                    {
+                        if (c > 0)
+                        {
+                            row.push_back(',');
+                        }
+                        row.append(ns_util::SQLUtil::Quote(mysql, b.values[r * columns + c]));
+                    }
+                    row.push_back(')');
+                    // 加上这一行会超限时先执行已拼好的部分，语句只在行之间拆分
+                    if (!sql.empty() && sql.size() + row.size() + 1 > kMaxStatementBytes)
+                    {
+                        ok = Execute(sql);
+                        statements++;
+                        sql.clear();
+                    }
+                    if (row.size() + head.size() > kMaxStatementBytes)
+                    {
+                        LOG(WARNING, table + " 单行 " + std::to_string(row.size()) + " 字节超过语句上限, 可能超过max_allowed_packet");
+                    }
+                    sql.append(sql.empty() ? head : ",").append(row);
+                    if (ok && r + 1 == rows)
+                    {
+                        ok = Execute(sql);
+                        statements++;
+                        sql.clear();
+                    }
+                }
+                ok = ok && mysql_commit(mysql) == 0;
+                if (!ok)
+                {
+                    mysql_rollback(mysql);
+                    LOG(FATAL, "批量写入" + table + "失败，事务已回滚: " + std::string(mysql_error(mysql)));
+                    failed = true;
+                    sql.clear();
+                    continue;
+                }
+                stats.rows += rows;
+                stats.statements += statements;
+                stats.transactions++;
+            }
+        }
+
+        bool Execute(const std::string &sql)
+        {
+            stats.bytes += sql.size();
+            if (mysql_real_query(mysql, sql.data(), sql.size()) != 0)
+            {
+                LOG(FATAL, "mysql query error: " + sql.substr(0, 256));
+                return false;
+            }
+            return true;
+        }
+
+    public:
+        // columns为逗号分隔的列名，每行的值个数必须与之相同；值一律作为字符串字面量写入，由MySQL转换成列的类型
+        BulkWriter(const std::string &table, const std::string &column_list)
+            : table(table), head("insert ignore into " + table + "(" + column_list + ") values"),
+              columns(std::count(column_list.begin(), column_list.end(), ',') + 1), mysql(nullptr), row_values(0),
+              queue(kQueueDepth), failed(false) {}
+        ~BulkWriter() { Finish(); }
+        BulkWriter(const BulkWriter &) = delete;
+        BulkWriter &operator=(const BulkWriter &) = delete;
+
+        bool Start()
+        {
+            mysql = ns_util::SQLUtil::MysqlInit(DB_NAME, DB_HOST, DB_PORT, DB_USER, DB_PASSWD);
+            if (mysql == nullptr)
+            {
+                return false;
+            }
+            mysql_autocommit(mysql, 0);
+            start = std::chrono::steady_clock::now();
+            worker = std::thread([this]
+                                 { Run(); });
+            return true;
+        }
+
+        BulkWriter &Value(std::string value)
+        {
+            batch.bytes += value.size() + 4;
+            batch.values.push_back(std::move(value));
+            row_values++;
+            return *this;
+        }
+        template <class Int>
+        BulkWriter &Value(Int value) { return Value(std::to_string(value)); }
+
+        void EndRow()
+        {
+            if (row_values != columns)
+            {
+                LOG(FATAL, table + " 每行应有" + std::to_string(columns) + "个值, 实际" + std::to_string(row_values));
+                batch.values.resize(batch.values.size() - row_values);
+                failed = true;
+            }
+            row_values = 0;
+            if (batch.bytes >= kBatchBytes)
+            {
+                Flush();
+            }
+        }
+
+        // 把已攒的行交给后台线程，不等待写完
+        void Flush()
+        {
+            if (!batch.values.empty() && worker.joinable())
+            {
+                queue.Push(std::move(batch));
+            }
+            batch = Batch();
+        }
+
+        // 写完所有行后返回，全部成功返回true
+        bool Finish()
+        {
+            if (!worker.joinable())
+            {
+                return !failed && mysql != nullptr;
+            }
+            Flush();
+            queue.Close();
+            worker.join();
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ns_util::SQLUtil::MysqlDestroy(mysql);
+            mysql = nullptr;
+            LOG(NORMAL, "批量写入" + table + "完成, 行数: " + std::to_string(stats.rows) + " 语句: " + std::to_string(stats.statements) +
+                            " 事务: " + std::to_string(stats.transactions) + " 字节: " + std::to_string(stats.bytes) +
+                            " 用时: " + std::to_string(stats.seconds) + "s 行/秒: " + std::to_string(static_cast<uint64_t>(stats.RowsPerSecond())));
+            return !failed;
+        }
+
+        bool Failed() const { return failed; }
+        const BulkStats &Stats() const { return stats; }
+    };
+
     class TableDoc : public TableBase
     {
         // doc_info
@@ -55,8 +385,13 @@ namespace ns_operation
         // | content | text         | YES  |     | NULL    |                |
         // | url     | varchar(256) | YES  |     | NULL    |                |
         // | path    | varchar(256) | YES  |     | NULL    |                | // 预留
+        // | dup_count | int(11)    | NO   |     | 0       |                | // 近重复文档数
         // +---------+--------------+------+-----+---------+----------------+
+        // 已有的表需执行: alter table doc_info add column dup_count int not null default 0;
     public:
+        // 与Insert的列顺序一致，供BulkWriter使用
+        static std::string BulkColumns() { return "doc_id, title, content, url, dup_count"; }
+
         bool Insert(const Json::Value &doc)
         {
             std::string sql;
@@ -65,11 +400,12 @@ namespace ns_operation
             // sql.append("\'" + doc["content"].asString() + "\', ");
             // sql.append("\'" + doc["url"].asString() + "\');");
 
-            sql.append("insert ignore into doc_info(doc_id,title, content, url) values(");
-            sql.append("\'" + doc["doc_id"].asString() + "\', ");
-            sql.append("\'" + doc["title"].asString() + "\', ");
-            sql.append("\'" + doc["content"].asString() + "\', ");
-            sql.append("\'" + doc["url"].asString() + "\');");
+            sql.append("insert ignore into doc_info(doc_id,title, content, url, dup_count) values(");
+            sql.append(Quote(doc["doc_id"].asString()) + ", ");
+            sql.append(Quote(doc["title"].asString()) + ", ");
+            sql.append(Quote(doc["content"].asString()) + ", ");
+            sql.append(Quote(doc["url"].asString()) + ", ");
+            sql.append(std::to_string(doc["dup_count"].asUInt()) + ");");
 
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
@@ -81,77 +417,76 @@ namespace ns_operation
             // 拼接需要更新的字段
             if (!doc["title"].isNull())
             {
-                sql.append("title =\'");
-                sql.append(doc["title"].asString());
-                sql.append("\', ");
+                sql.append("title =" + Quote(doc["title"].asString()) + ", ");
             }
             if (!doc["content"].isNull())
             {
-                sql.append("content =\'");
-                sql.append(doc["content"].asString());
-                sql.append("\', ");
+                sql.append("content =" + Quote(doc["content"].asString()) + ", ");
             }
             if (!doc["url"].isNull())
             {
-                sql.append("url =\'");
-                sql.append(doc["url"].asString());
-                sql.append("\', ");
+                sql.append("url =" + Quote(doc["url"].asString()) + ", ");
             }
 
             // 去掉 SQL 语句末尾的逗号和空格
             sql.erase(sql.end() - 2, sql.end());
 
             // 拼接 WHERE 子句
-            sql.append(" where url =\'");
-            sql.append(url);
-            sql.append("\';");
+            sql.append(" where url =" + Quote(url) + ";");
 
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
         bool Delete(const string &url)
         {
             std::string sql;
-            sql.append("delete from doc_info where url =\'");
-            sql.append(url);
-            sql.append("\';");
+            sql.append("delete from doc_info where url =" + Quote(url) + ";");
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
-        bool SelectAll(Json::Value &docs)
+        // 增量更新时修改过的文档换了新doc_id但url不变，只能按doc_id删除旧行；每1000个doc_id一条语句，追加到sqls
+        static void DeleteByDocIdsSql(const std::vector<uint64_t> &doc_ids, std::vector<std::string> *sqls)
         {
-            std::string sql = "select * from doc_info;";
-            mtx.lock();
-            if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
-            {
-                mtx.unlock();
-                return false;
-            }
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
-            {
-                LOG(FATAL, "mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
-                return false;
+            const std::size_t chunk = 1000;
+            for (std::size_t begin = 0; begin < doc_ids.size(); begin += chunk)
+            {
+                std::string sql = "delete from doc_info where doc_id in (";
+                for (std::size_t i = begin; i < doc_ids.size() && i < begin + chunk; i++)
+                {
+                    sql.append(i > begin ? "," : "");
+                    sql.append(std::to_string(doc_ids[i]));
+                }
+                sql.append(");");
+                sqls->push_back(std::move(sql));
             }
-            mtx.unlock();
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
-            {
+        }
+        // 逐行解码成DocRow交给func，func可以移走其中的字段，返回false时停止
+        bool ScanAll(const std::function<bool(DocRow &)> &func)
+        {
+            DocRow doc;
+            return ScanRows("select * from doc_info;", [&doc, &func](MYSQL_ROW row, const unsigned long *lengths, unsigned int fields)
+                            {
+                doc.doc_id = FieldInt(row, 1);
+                Field(&doc.title, row, lengths, 2);
+                Field(&doc.content, row, lengths, 3);
+                Field(&doc.url, row, lengths, 4);
+                doc.dup_count = fields > 6 ? FieldInt(row, 6) : 0; // 旧表没有dup_count列
+                return func(doc); });
+        }
+        bool SelectAll(Json::Value &docs)
+        {
+            return ScanAll([&docs](DocRow &row)
+                           {
                 Json::Value doc;
-                doc["doc_id"] = std::stoi(row[1]);
-                doc["title"] = row[2];
-                doc["content"] = row[3];
-                doc["url"] = row[4];
-                // doc["path"] = row[4];
+                doc["doc_id"] = static_cast<Json::UInt64>(row.doc_id);
+                doc["title"] = row.title;
+                doc["content"] = row.content;
+                doc["url"] = row.url;
+                doc["dup_count"] = row.dup_count;
                 docs.append(doc);
-            }
-            mysql_free_result(res);
-            return true;
+                return true; });
         }
         bool SelectOne(const string &url, Json::Value &doc)
         {
-            std::string sql = "select * from doc_info where url=\'";
-            sql.append(url);
-            sql.append("\';");
+            std::string sql = "select * from doc_info where url=" + Quote(url) + ";";
             mtx.lock();
             if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
             {
@@ -208,21 +543,46 @@ namespace ns_operation
         // | is_delete        | tinyint(4)    | NO   |     | 0                      |                |
         // + -- -- -- -- -- --+-- -- -- -- -- +-- -- +-- --+-- -- -- -- -- -- -- -- +-- -- -- -- -- -+
 
+        // 登录、Cookie校验、注册在各个http线程上并发执行，走连接池和预处理语句，不再在一个连接上排队
+        // 其余不常用的操作仍使用TableBase的连接
+        ns_mysqlpool::ConnectionPool pool;
+        // 用户资料被修改或删除后以账号回调，缓存了资料的一方（会话缓存）据此失效
+        std::function<void(const std::string &)> on_change;
+
+        bool Changed(const std::string &account, bool ok)
+        {
+            if (ok && on_change)
+            {
+                on_change(account);
+            }
+            return ok;
+        }
+
     public:
+        explicit TableUser(std::size_t pool_size = USER_POOL_SIZE)
+            : pool(pool_size, DB_NAME, DB_HOST, DB_PORT, DB_USER, DB_PASSWD) {}
+
+        ns_mysqlpool::PoolStats ConnectionStats() { return pool.Stats(); }
+        void OnChange(std::function<void(const std::string &)> func) { on_change = std::move(func); }
+
         bool Insert(const Json::Value &user)
         {
-            std::string sql;
-            sql.append("insert into user_info(account, password, name, email, avatar, permission_level, is_vip, is_delete) values(");
-            sql.append("\'" + user["account"].asString() + "\', ");
-            sql.append("\'" + MD5(user["password"].asString()).toStr() + "\', ");
-            sql.append("\'" + user["name"].asString() + "\', ");
-            sql.append("\'" + user["email"].asString() + "\', ");
-            sql.append("\'" + user["avatar"].asString() + "\', ");
-            sql.append("\'" + user["permission_level"].asString() + "\', ");
-            sql.append("\'" + user["is_vip"].asString() + "\', ");
-            sql.append("\'" + user["is_delete"].asString() + "\');");
-
-            return ns_util::SQLUtil::MysqlQuery(mysql, sql);
+            ns_mysqlpool::ConnectionPool::Handle conn = pool.Acquire();
+            if (!conn)
+            {
+                return false;
+            }
+            ns_mysqlpool::Statement stmt(conn.Get(), "insert into user_info(account, password, name, email, avatar, permission_level, is_vip, is_delete) "
+                                                     "values(?, ?, ?, ?, ?, ?, ?, ?)");
+            stmt.Bind(user["account"].asString())
+                .Bind(MD5(user["password"].asString()).toStr())
+                .Bind(user["name"].asString())
+                .Bind(user["email"].asString())
+                .Bind(user["avatar"].asString())
+                .Bind(user["permission_level"].asString())
+                .Bind(user["is_vip"].asString())
+                .Bind(user["is_delete"].asString());
+            return stmt.Execute();
         }
         bool Update(const string &account, const Json::Value &user)
         {
@@ -232,65 +592,47 @@ namespace ns_operation
             // 拼接需要更新的字段
             if (!user["password"].isNull())
             {
-                sql.append("password =\'");
-                sql.append(user["password"].asString());
-                sql.append("\', ");
+                sql.append("password =" + Quote(user["password"].asString()) + ", ");
             }
             if (!user["name"].isNull())
             {
-                sql.append("name =\'");
-                sql.append(user["name"].asString());
-                sql.append("\', ");
+                sql.append("name =" + Quote(user["name"].asString()) + ", ");
             }
             if (!user["email"].isNull())
             {
-                sql.append("email =\'");
-                sql.append(user["email"].asString());
-                sql.append("\', ");
+                sql.append("email =" + Quote(user["email"].asString()) + ", ");
             }
             if (!user["avatar"].isNull())
             {
-                sql.append("avatar =\'");
-                sql.append(user["avatar"].asString());
-                sql.append("\', ");
+                sql.append("avatar =" + Quote(user["avatar"].asString()) + ", ");
             }
             if (!user["permission_level"].isNull())
             {
-                sql.append("permission_level =\'");
-                sql.append(user["permission_level"].asString());
-                sql.append("\', ");
+                sql.append("permission_level =" + Quote(user["permission_level"].asString()) + ", ");
             }
             if (!user["is_vip"].isNull())
             {
-                sql.append("is_vip =\'");
-                sql.append(user["is_vip"].asString());
-                sql.append("\', ");
+                sql.append("is_vip =" + Quote(user["is_vip"].asString()) + ", ");
             }
             if (!user["is_delete"].isNull())
             {
-                sql.append("is_delete =\'");
-                sql.append(user["is_delete"].asString());
-                sql.append("\', ");
+                sql.append("is_delete =" + Quote(user["is_delete"].asString()) + ", ");
             }
 
             // 去掉 SQL 语句末尾的逗号和空格
             sql.erase(sql.end() - 2, sql.end());
 
             // 拼接 WHERE 子句
-            sql.append(" where account =\'");
             // sql.append(user["account"].asString());
-            sql.append(account);
-            sql.append("\';");
+            sql.append(" where account =" + Quote(account) + ";");
 
-            return ns_util::SQLUtil::MysqlQuery(mysql, sql);
+            return Changed(account, ns_util::SQLUtil::MysqlQuery(mysql, sql));
         }
         bool Delete(const string &account)
         {
             std::string sql;
-            sql.append("update user_info set is_delete =\'1\' where account =\'");
-            sql.append(account);
-            sql.append("\';");
-            return ns_util::SQLUtil::MysqlQuery(mysql, sql);
+            sql.append("update user_info set is_delete =\'1\' where account =" + Quote(account) + ";");
+            return Changed(account, ns_util::SQLUtil::MysqlQuery(mysql, sql));
         }
         bool SelectAll(Json::Value &users)
         {
@@ -330,42 +672,32 @@ namespace ns_operation
         }
         bool SelectOne(const string &account, Json::Value &user)
         {
-            std::string sql = "select * from user_info where account=\'";
-            sql.append(account);
-            sql.append("\';");
-
-            if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
+            ns_mysqlpool::ConnectionPool::Handle conn = pool.Acquire();
+            if (!conn)
             {
-                mtx.unlock();
                 return false;
             }
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+            ns_mysqlpool::Statement stmt(conn.Get(), "select id, account, name, email, avatar, create_date, permission_level, is_vip, is_delete "
+                                                     "from user_info where account = ?");
+            stmt.Bind(account);
+            if (!stmt.Execute())
             {
-                LOG(FATAL, "mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
                 return false;
             }
-            mtx.unlock();
-            if (mysql_num_rows(res) != 1)
+            if (stmt.Rows() != 1 || !stmt.Fetch())
             {
                 LOG(NOTICE, account + string(" does not exist!"));
-                mysql_free_result(res);
                 return false;
             }
-            MYSQL_ROW row = mysql_fetch_row(res);
-            user["id"] = std::stoi(row[0]);
-            user["account"] = std::stoi(row[1]);
-            // user["password"] = row[2];
-            user["name"] = row[3];
-            user["email"] = row[4];
-            user["avatar"] = row[5];
-            user["create_date"] = row[6];
-            user["permission_level"] = std::stoi(row[7]);
-            user["is_vip"] = std::stoi(row[8]);
-            user["is_delete"] = std::stoi(row[9]);
-
-            mysql_free_result(res);
+            user["id"] = static_cast<Json::Int>(stmt.Int(0));
+            user["account"] = static_cast<Json::Int>(stmt.Int(1));
+            user["name"] = stmt.Value(2);
+            user["email"] = stmt.Value(3);
+            user["avatar"] = stmt.Value(4);
+            user["create_date"] = stmt.Value(5);
+            user["permission_level"] = static_cast<Json::Int>(stmt.Int(6));
+            user["is_vip"] = static_cast<Json::Int>(stmt.Int(7));
+            user["is_delete"] = static_cast<Json::Int>(stmt.Int(8));
             return true;
         }
         // 弃用
@@ -376,52 +708,35 @@ namespace ns_operation
         // 登录验证
         bool ValidateLogin(const std::string &account, const std::string &password)
         {
-            std::string sql = "select password,is_delete from user_info where account=\'";
-            sql.append(account);
-            sql.append("\';");
-            mtx.lock();
-            if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
+            ns_mysqlpool::ConnectionPool::Handle conn = pool.Acquire();
+            if (!conn)
             {
-                mtx.unlock();
                 return false;
             }
-
-            // 保存查询结果
-            MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+            ns_mysqlpool::Statement stmt(conn.Get(), "select password, is_delete from user_info where account = ?");
+            stmt.Bind(account);
+            if (!stmt.Execute())
             {
-                LOG(FATAL, "mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
                 return false;
             }
-            mtx.unlock();
-            if (mysql_num_rows(res) != 1)
+            if (stmt.Rows() != 1 || !stmt.Fetch())
             {
                 LOG(NOTICE, "account: " + account + " does not exist!");
-                mysql_free_result(res);
                 return false;
             }
-
-            MYSQL_ROW row = mysql_fetch_row(res);
-            if (row[1][0] == '1' || password != string(row[0]))
+            if (stmt.Value(1) == "1" || password != stmt.Value(0))
             {
-                mysql_free_result(res);
                 LOG(NOTICE, "account: " + account + " wrong password!");
                 return false;
             }
-            mysql_free_result(res);
             return true;
         }
         // vip更新
         bool ModifyVip(string &account, string &level)
         {
             std::string sql;
-            sql.append("update user_info set is_vip =\'");
-            sql.append(level);
-            sql.append("\' where account =\'");
-            sql.append(account);
-            sql.append("\';");
-            return ns_util::SQLUtil::MysqlQuery(mysql, sql);
+            sql.append("update user_info set is_vip =" + Quote(level) + " where account =" + Quote(account) + ";");
+            return Changed(account, ns_util::SQLUtil::MysqlQuery(mysql, sql));
         }
     };
 
@@ -434,16 +749,30 @@ namespace ns_operation
         // | doc_id | int(11)      | NO   | MUL | NULL    |       |
         // | word   | varchar(256) | NO   |     | NULL    |       |
         // | weight | int(11)      | NO   |     | NULL    |       |
+        // | title_cnt   | int(11) | NO   |     | 0       |       |
+        // | content_cnt | int(11) | NO   |     | 0       |       |
         // +--------+--------------+------+-----+---------+-------+
+        // alter table inverted_elem add title_cnt int not null default 0, add content_cnt int not null default 0;
+        //
+        // inverted_blob：postings为拉链的压缩编码（见index.hpp的EncodePostings），通常每个词一行；
+        // 编码超过kMaxBlobBytes的长拉链按seq分成多行，df为该行的元素个数，各行之和即文档频率
+        // 加载整个索引只需读取约词数行二进制数据，不再逐个倒排元素解析字符串；inverted_elem只用于读取旧数据和迁移
+        // create table inverted_blob(word varbinary(255) not null, seq int not null default 0, df int not null, postings mediumblob not null, primary key(word, seq));
+        // 已有的表需执行: alter table inverted_blob add column seq int not null default 0 after word, drop primary key, add primary key(word, seq);
+        // word按字节比较，避免排序规则把大小写、重音不同的词视为同一个
 
     public:
+        static std::string BulkColumns() { return "doc_id, word, weight, title_cnt, content_cnt"; }
+        static std::string BlobColumns() { return "word, seq, df, postings"; }
         bool Insert(const Json::Value &elem)
         {
             std::string sql;
-            sql.append("insert ignore into inverted_elem(doc_id, word, weight) values(");
-            sql.append("\'" + elem["doc_id"].asString() + "\', ");
-            sql.append("\'" + elem["word"].asString() + "\', ");
-            sql.append("\'" + elem["weight"].asString() + "\');");
+            sql.append("insert ignore into inverted_elem(doc_id, word, weight, title_cnt, content_cnt) values(");
+            sql.append(Quote(elem["doc_id"].asString()) + ", ");
+            sql.append(Quote(elem["word"].asString()) + ", ");
+            sql.append(Quote(elem["weight"].asString()) + ", ");
+            sql.append(Quote(elem["title_cnt"].asString()) + ", ");
+            sql.append(Quote(elem["content_cnt"].asString()) + ");");
 
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
@@ -455,75 +784,122 @@ namespace ns_operation
             // 拼接需要更新的字段
             if (!elem["title"].isNull())
             {
-                sql.append("title =\'");
-                sql.append(elem["title"].asString());
-                sql.append("\', ");
+                sql.append("title =" + Quote(elem["title"].asString()) + ", ");
             }
             if (!elem["content"].isNull())
             {
-                sql.append("content =\'");
-                sql.append(elem["content"].asString());
-                sql.append("\', ");
+                sql.append("content =" + Quote(elem["content"].asString()) + ", ");
             }
             if (!elem["url"].isNull())
             {
-                sql.append("url =\'");
-                sql.append(elem["url"].asString());
-                sql.append("\', ");
+                sql.append("url =" + Quote(elem["url"].asString()) + ", ");
             }
 
             // 去掉 SQL 语句末尾的逗号和空格
             sql.erase(sql.end() - 2, sql.end());
 
             // 拼接 WHERE 子句
-            sql.append(" where doc_id =\'");
-            sql.append(doc_id);
-            sql.append("\';");
+            sql.append(" where doc_id =" + Quote(doc_id) + ";");
 
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
         bool Delete(const string &doc_id)
         {
             std::string sql;
-            sql.append("delete from inverted_elem where doc_id =\'");
-            sql.append(doc_id);
-            sql.append("\';");
+            sql.append("delete from inverted_elem where doc_id =" + Quote(doc_id) + ";");
             return ns_util::SQLUtil::MysqlQuery(mysql, sql);
         }
+        // 逐行解码成PostingRow交给func，func可以移走其中的字段，返回false时停止
+        bool ScanAll(const std::function<bool(PostingRow &)> &func)
+        {
+            PostingRow elem;
+            return ScanRows("select * from inverted_elem;", [&elem, &func](MYSQL_ROW row, const unsigned long *lengths, unsigned int fields)
+                            {
+                elem.doc_id = FieldInt(row, 0);
+                Field(&elem.word, row, lengths, 1);
+                elem.weight = FieldInt(row, 2);
+                // 旧表没有title_cnt/content_cnt列时，按全部命中正文处理
+                bool has_cnt = fields >= 5;
+                elem.title_cnt = has_cnt ? FieldInt(row, 3) : 0;
+                elem.content_cnt = has_cnt ? FieldInt(row, 4) : elem.weight;
+                return func(elem); });
+        }
         bool SelectAll(Json::Value &elems)
         {
-            std::string sql = "select * from inverted_elem;";
-            mtx.lock();
-            if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
+            return ScanAll([&elems](PostingRow &row)
+                           {
+                Json::Value elem;
+                elem["doc_id"] = static_cast<Json::UInt64>(row.doc_id);
+                elem["word"] = row.word;
+                elem["weight"] = row.weight;
+                elem["title_cnt"] = row.title_cnt;
+                elem["content_cnt"] = row.content_cnt;
+                elems.append(elem);
+                return true; });
+        }
+        // inverted_blob存在且不为空
+        bool HasBlobs()
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!ns_util::SQLUtil::MysqlQuery(mysql, "show tables like 'inverted_blob';"))
             {
-                mtx.unlock();
                 return false;
             }
             MYSQL_RES *res = mysql_store_result(mysql);
-            if (res == nullptr)
+            bool exists = res != nullptr && mysql_num_rows(res) > 0;
+            if (res != nullptr)
+            {
+                mysql_free_result(res);
+            }
+            if (!exists || !ns_util::SQLUtil::MysqlQuery(mysql, "select 1 from inverted_blob limit 1;"))
             {
-                LOG(FATAL, "mysql store result error: " + std::string(mysql_error(mysql)));
-                mtx.unlock();
                 return false;
             }
-            mtx.unlock();
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(res)) != nullptr)
+            res = mysql_store_result(mysql);
+            bool rows = res != nullptr && mysql_num_rows(res) > 0;
+            if (res != nullptr)
             {
-                Json::Value elem;
-                elem["doc_id"] = std::stoi(row[0]);
-                elem["word"] = row[1];
-                elem["weight"] = std::stoi(row[2]);
-                elems.append(elem);
+                mysql_free_result(res);
             }
-            mysql_free_result(res);
-            return true;
+            return rows;
+        }
+
+        // 逐行回调(词, 该行元素个数, 编码后的拉链, 字节数)，同一个词的各行按seq连续返回；回调返回false时停止并返回false，数据在回调返回后失效
+        bool SelectBlobs(const std::function<bool(const std::string &, uint32_t, const char *, std::size_t)> &func)
+        {
+            std::string word;
+            return ScanRows("select word, df, postings from inverted_blob order by word, seq;", [&word, &func](MYSQL_ROW row, const unsigned long *lengths, unsigned int)
+                            {
+                Field(&word, row, lengths, 0);
+                return func(word, static_cast<uint32_t>(FieldInt(row, 1)), row[2], lengths[2]); });
         }
+
+        // 增量更新时删除拉链有变化的词，之后重新写入；每1000个词一条语句，追加到sqls
+        void DeleteBlobsSql(const std::vector<std::string> &words, std::vector<std::string> *sqls)
+        {
+            const std::size_t chunk = 1000;
+            for (std::size_t begin = 0; begin < words.size(); begin += chunk)
+            {
+                std::string sql = "delete from inverted_blob where word in (";
+                for (std::size_t i = begin; i < words.size() && i < begin + chunk; i++)
+                {
+                    sql.append(i > begin ? "," : "");
+                    sql.append(Quote(words[i]));
+                }
+                sql.append(");");
+                sqls->push_back(std::move(sql));
+            }
+        }
+
+        bool ClearBlobs()
+        {
+            std::string sql = "truncate table inverted_blob;";
+            return ns_util::SQLUtil::MysqlQuery(mysql, sql);
+        }
+
         bool SelectByDoc(const string &doc_id, Json::Value &elems)
         {
-            std::string sql = "select * from inverted_elem where doc_id =\'";
-            sql.append(doc_id);
-            sql.append("\';");
+            std::string sql = "select * from inverted_elem where doc_id =" + Quote(doc_id) + ";";
             mtx.lock();
             if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
             {
@@ -552,9 +928,7 @@ namespace ns_operation
         }
         bool SelectByWord(const string &word, Json::Value &elems)
         {
-            std::string sql = "select * from inverted_elem where word =\'";
-            sql.append(word);
-            sql.append("\';");
+            std::string sql = "select * from inverted_elem where word =" + Quote(word) + ";";
             mtx.lock();
             if (!ns_util::SQLUtil::MysqlQuery(mysql, sql))
             {
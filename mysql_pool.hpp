@@ -0,0 +1,439 @@
+#pragma once
+// MySQL连接池：连接数有上限，按需创建；借出前检查空闲过久或出过错的连接，断开时重连
+// 每个连接缓存自己的预处理语句，热点语句在服务器端只解析一次，参数不再拼进SQL
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <mysql/mysql.h>
+#include "util.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+namespace ns_mysqlpool
+{
+    const int kAcquireTimeoutMs = 3000; // 等不到空闲连接时放弃
+    const int kIdleCheckMs = 30000;     // 空闲超过这么久的连接借出前先ping，防止已被服务器的wait_timeout断开
+    const std::size_t kColumnBuffer = 256; // 结果列的初始缓冲，更长的值截断后再单独取
+
+    // MYSQL_BIND中标志位的类型，5.7为my_bool，8.0为bool
+    typedef std::remove_pointer<decltype(std::declval<MYSQL_BIND>().is_null)>::type BindFlag;
+
+    struct PoolStats
+    {
+        std::size_t max_size;
+        std::size_t size;       // 已创建的连接数
+        std::size_t idle;
+        uint64_t acquires;
+        uint64_t waits;         // 没有空闲连接、需要等待的次数
+        uint64_t timeouts;
+        uint64_t reconnects;
+        double wait_seconds;    // 借连接的累计等待时间
+        double max_wait_seconds;
+    };
+
+    // mysql_init在新线程上隐式调用mysql_thread_init，但线程退出时不会自动mysql_thread_end，
+    // httplib的工作线程借过连接后退出会泄漏客户端库的线程私有数据；thread_local对象在线程退出时析构
+    class ThreadGuard
+    {
+    public:
+        ThreadGuard() { mysql_thread_init(); }
+        ~ThreadGuard() { mysql_thread_end(); }
+        ThreadGuard(const ThreadGuard &) = delete;
+        ThreadGuard &operator=(const ThreadGuard &) = delete;
+    };
+
+    // 在调用mysql函数的线程上调用，每个线程只初始化一次
+    inline void AttachThread()
+    {
+        static thread_local ThreadGuard guard;
+        (void)guard;
+    }
+
+    class Connection
+    {
+    private:
+        MYSQL *mysql;
+        std::unordered_map<std::string, MYSQL_STMT *> stmts; // SQL -> 预处理语句
+        std::chrono::steady_clock::time_point last_used;
+        bool broken; // 执行时出现客户端错误（连接断开等），归还后下次借出前重连
+
+        friend class ConnectionPool;
+
+        void Close()
+        {
+            for (auto &item : stmts)
+            {
+                mysql_stmt_close(item.second);
+            }
+            stmts.clear();
+            ns_util::SQLUtil::MysqlDestroy(mysql);
+            mysql = nullptr;
+        }
+
+    public:
+        Connection() : mysql(nullptr), broken(false) {}
+        ~Connection() { Close(); }
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        MYSQL *Get() { return mysql; }
+        void MarkBroken() { broken = true; }
+
+        // 同一条SQL在这个连接上只prepare一次
+        MYSQL_STMT *Prepare(const std::string &sql)
+        {
+            auto iter = stmts.find(sql);
+            if (iter != stmts.end())
+            {
+                return iter->second;
+            }
+            MYSQL_STMT *stmt = mysql_stmt_init(mysql);
+            if (stmt == nullptr)
+            {
+                LOG(FATAL, "mysql stmt init error: " + std::string(mysql_error(mysql)));
+                return nullptr;
+            }
+            if (mysql_stmt_prepare(stmt, sql.data(), sql.size()) != 0)
+            {
+                LOG(FATAL, "mysql stmt prepare error: " + sql + " " + std::string(mysql_stmt_error(stmt)));
+                broken = mysql_stmt_errno(stmt) >= 2000; // CR_*客户端错误，多为连接断开
+                mysql_stmt_close(stmt);
+                return nullptr;
+            }
+            stmts[sql] = stmt;
+            return stmt;
+        }
+    };
+
+    // 预处理语句的一次执行：Bind按占位符顺序绑定参数，Execute之后用Fetch逐行取结果
+    // 参数和结果列都以字符串传递，由服务器和客户端库按列类型转换
+    class Statement
+    {
+    private:
+        struct Column
+        {
+            std::string buffer; // 绑定给mysql_stmt_fetch的缓冲
+            std::string value;  // 当前行的值
+            unsigned long length;
+            BindFlag is_null;
+            BindFlag error;
+        };
+
+        Connection *conn;
+        MYSQL_STMT *stmt;
+        std::vector<std::string> params;
+        std::vector<unsigned long> param_lengths;
+        std::vector<Column> columns;
+        bool has_result;
+
+        bool Fail(const char *what)
+        {
+            LOG(FATAL, std::string(what) + " error: " + mysql_stmt_error(stmt));
+            if (mysql_stmt_errno(stmt) >= 2000)
+            {
+                conn->MarkBroken();
+            }
+            return false;
+        }
+
+    public:
+        Statement(Connection *conn, const std::string &sql) : conn(conn), stmt(conn->Prepare(sql)), has_result(false) {}
+        ~Statement()
+        {
+            if (has_result)
+            {
+                mysql_stmt_free_result(stmt);
+            }
+        }
+        Statement(const Statement &) = delete;
+        Statement &operator=(const Statement &) = delete;
+
+        Statement &Bind(std::string value)
+        {
+            params.push_back(std::move(value));
+            return *this;
+        }
+        template <class Int>
+        Statement &Bind(Int value) { return Bind(std::to_string(value)); }
+
+        bool Execute()
+        {
+            ns_trace::Span span("mysql.execute", "mysql");
+            if (stmt == nullptr)
+            {
+                return false;
+            }
+            std::vector<MYSQL_BIND> binds(params.size());
+            param_lengths.resize(params.size());
+            for (std::size_t i = 0; i < params.size(); i++)
+            {
+                std::memset(&binds[i], 0, sizeof(MYSQL_BIND));
+                param_lengths[i] = params[i].size();
+                binds[i].buffer_type = MYSQL_TYPE_STRING;
+                binds[i].buffer = &params[i][0];
+                binds[i].buffer_length = params[i].size();
+                binds[i].length = &param_lengths[i];
+            }
+            if (!binds.empty() && mysql_stmt_bind_param(stmt, binds.data()))
+            {
+                return Fail("mysql stmt bind param");
+            }
+            if (mysql_stmt_execute(stmt) != 0)
+            {
+                return Fail("mysql stmt execute");
+            }
+            unsigned int fields = mysql_stmt_field_count(stmt);
+            if (fields == 0)
+            {
+                return true;
+            }
+            // 结果集都很小，一次取回后连接即可执行下一条语句
+            if (mysql_stmt_store_result(stmt) != 0)
+            {
+                return Fail("mysql stmt store result");
+            }
+            has_result = true;
+            columns.resize(fields);
+            std::vector<MYSQL_BIND> results(fields);
+            for (unsigned int i = 0; i < fields; i++)
+            {
+                Column &c = columns[i];
+                c.buffer.resize(kColumnBuffer);
+                std::memset(&results[i], 0, sizeof(MYSQL_BIND));
+                results[i].buffer_type = MYSQL_TYPE_STRING;
+                results[i].buffer = &c.buffer[0];
+                results[i].buffer_length = c.buffer.size();
+                results[i].length = &c.length;
+                results[i].is_null = &c.is_null;
+                results[i].error = &c.error;
+            }
+            if (mysql_stmt_bind_result(stmt, results.data()))
+            {
+                return Fail("mysql stmt bind result");
+            }
+            return true;
+        }
+
+        uint64_t Rows() { return has_result ? mysql_stmt_num_rows(stmt) : 0; }
+        uint64_t AffectedRows() { return mysql_stmt_affected_rows(stmt); }
+
+        // 取下一行，没有更多行或出错时返回false
+        bool Fetch()
+        {
+            if (!has_result)
+            {
+                return false;
+            }
+            int rc = mysql_stmt_fetch(stmt);
+            if (rc == MYSQL_NO_DATA)
+            {
+                return false;
+            }
+            if (rc != 0 && rc != MYSQL_DATA_TRUNCATED)
+            {
+                return Fail("mysql stmt fetch");
+            }
+            for (unsigned int i = 0; i < columns.size(); i++)
+            {
+                Column &c = columns[i];
+                if (c.is_null)
+                {
+                    c.value.clear();
+                }
+                else if (c.length <= c.buffer.size())
+                {
+                    c.value.assign(c.buffer.data(), c.length);
+                }
+                else
+                {
+                    // 超出缓冲的列按实际长度再取一次
+                    c.value.resize(c.length);
+                    MYSQL_BIND bind;
+                    std::memset(&bind, 0, sizeof(bind));
+                    unsigned long length = 0;
+                    bind.buffer_type = MYSQL_TYPE_STRING;
+                    bind.buffer = &c.value[0];
+                    bind.buffer_length = c.value.size();
+                    bind.length = &length;
+                    if (mysql_stmt_fetch_column(stmt, &bind, i, 0) != 0)
+                    {
+                        return Fail("mysql stmt fetch column");
+                    }
+                }
+            }
+            return true;
+        }
+
+        const std::string &Value(unsigned int i) const { return columns[i].value; }
+        bool IsNull(unsigned int i) const { return columns[i].is_null; }
+        long long Int(unsigned int i) const { return std::strtoll(columns[i].value.c_str(), nullptr, 10); }
+    };
+
+    class ConnectionPool
+    {
+    private:
+        std::string db, host, port, user, passwd;
+        std::size_t max_size;
+        std::mutex mtx;
+        std::condition_variable cond;
+        std::vector<Connection *> idle;
+        std::size_t size;
+        PoolStats stats;
+
+        bool Connect(Connection *conn)
+        {
+            conn->Close();
+            conn->broken = false;
+            conn->mysql = ns_util::SQLUtil::MysqlInit(db.c_str(), host.c_str(), port.c_str(), user.c_str(), passwd.c_str());
+            conn->last_used = std::chrono::steady_clock::now();
+            return conn->mysql != nullptr;
+        }
+
+        // 借出前的健康检查：出过错或空闲太久且ping不通的连接重连
+        bool Check(Connection *conn)
+        {
+            auto idle_for = std::chrono::steady_clock::now() - conn->last_used;
+            if (!conn->broken && conn->mysql != nullptr &&
+                (idle_for < std::chrono::milliseconds(kIdleCheckMs) || mysql_ping(conn->mysql) == 0))
+            {
+                return true;
+            }
+            LOG(WARNING, "mysql连接不可用，重新连接");
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                stats.reconnects++;
+            }
+            return Connect(conn);
+        }
+
+        void Release(Connection *conn)
+        {
+            conn->last_used = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(mtx);
+            idle.push_back(conn);
+            cond.notify_one();
+        }
+
+        // 连接建立失败时让出名额
+        void Discard(Connection *conn)
+        {
+            delete conn;
+            std::unique_lock<std::mutex> lock(mtx);
+            size--;
+            cond.notify_one();
+        }
+
+    public:
+        // 借出的连接，析构时归还
+        class Handle
+        {
+        private:
+            ConnectionPool *pool;
+            Connection *conn;
+
+        public:
+            Handle(ConnectionPool *pool = nullptr, Connection *conn = nullptr) : pool(pool), conn(conn) {}
+            Handle(Handle &&other) : pool(other.pool), conn(other.conn) { other.conn = nullptr; }
+            ~Handle()
+            {
+                if (conn != nullptr)
+                {
+                    pool->Release(conn);
+                }
+            }
+            Handle(const Handle &) = delete;
+            Handle &operator=(const Handle &) = delete;
+
+            explicit operator bool() const { return conn != nullptr; }
+            Connection *Get() { return conn; }
+        };
+
+        ConnectionPool(std::size_t max_size, const char *db, const char *host, const char *port, const char *user, const char *passwd)
+            : db(db), host(host), port(port), user(user), passwd(passwd), max_size(max_size == 0 ? 1 : max_size), size(0)
+        {
+            stats = PoolStats();
+        }
+        ~ConnectionPool()
+        {
+            for (Connection *conn : idle)
+            {
+                delete conn;
+            }
+        }
+        ConnectionPool(const ConnectionPool &) = delete;
+        ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+        // 优先复用空闲连接，不足上限时新建，否则等待归还；超时或连不上时返回空Handle
+        Handle Acquire()
+        {
+            ns_trace::Span span("mysql.acquire", "mysql"); // 包含等待空闲连接、健康检查和重连
+            AttachThread(); // 借到的连接在本线程上使用
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = start + std::chrono::milliseconds(kAcquireTimeoutMs);
+            std::unique_lock<std::mutex> lock(mtx);
+            stats.acquires++;
+            bool waited = false;
+            while (idle.empty() && size >= max_size)
+            {
+                waited = true;
+                if (cond.wait_until(lock, deadline) == std::cv_status::timeout && idle.empty() && size >= max_size)
+                {
+                    stats.timeouts++;
+                    lock.unlock();
+                    LOG(WARNING, "等待mysql连接超时, 连接数: " + std::to_string(max_size));
+                    return Handle();
+                }
+            }
+            double wait = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.waits += waited ? 1 : 0;
+            stats.wait_seconds += wait;
+            stats.max_wait_seconds = std::max(stats.max_wait_seconds, wait);
+
+            Connection *conn = nullptr;
+            if (!idle.empty())
+            {
+                conn = idle.back(); // 后进先出，常用的连接保持热
+                idle.pop_back();
+            }
+            else
+            {
+                size++; // 先占名额，在锁外建立连接
+            }
+            lock.unlock();
+
+            if (conn == nullptr)
+            {
+                conn = new Connection();
+                if (!Connect(conn))
+                {
+                    Discard(conn);
+                    return Handle();
+                }
+            }
+            else if (!Check(conn))
+            {
+                Discard(conn);
+                return Handle();
+            }
+            return Handle(this, conn);
+        }
+
+        PoolStats Stats()
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            PoolStats s = stats;
+            s.max_size = max_size;
+            s.size = size;
+            s.idle = idle.size();
+            return s;
+        }
+    };
+}
@@ -0,0 +1,265 @@
+#pragma once
+// 词对索引：高频的两词组合预先求出同时包含两个词的文档（交集），查询时两条拉链各走一遍，每个文档只访问一次，不再经过哈希表累加
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include "index.hpp"
+#include "log.hpp"
+
+namespace ns_pair
+{
+    // 交集中的一个文档：first/second为该文档在两个词各自拉链中的下标，按下标（即doc_id）升序
+    // 只存下标，原始元素仍在倒排拉链中，任何打分策略都可以照常打分
+    struct PairPosting
+    {
+        uint32_t first;
+        uint32_t second;
+    };
+    typedef std::vector<PairPosting> PairList;
+
+    // 运行时的覆盖情况：含两个及以上查询词的查询数，以及其中用上了词对拉链的查询数
+    struct PairCoverage
+    {
+        uint64_t queries;
+        uint64_t covered;
+    };
+
+    struct PairOptions
+    {
+        std::size_t budget;          // 词对拉链占用内存的上限（字节），0表示不建立
+        std::string query_log;       // 查询日志，每行一条查询；为空或打不开时按共现统计选择词对
+        std::size_t candidate_terms; // 共现统计只在文档频率最高的这些词之间进行
+        PairOptions() : budget(64 << 20), candidate_terms(128) {}
+    };
+
+    class PairIndex
+    {
+    private:
+        // key为 字典序较小的词 + '\1' + 较大的词，first对应较小的词
+        std::unordered_map<std::string, PairList> pairs;
+        std::size_t bytes;
+        mutable std::atomic<uint64_t> queries;
+        mutable std::atomic<uint64_t> covered;
+
+    public:
+        PairIndex() : bytes(0), queries(0), covered(0) {}
+
+        // 需在索引冻结之后调用，词对拉链中的下标对应当时的倒排拉链，拉链变化后需重建
+        void Build(ns_index::Index *idx, const PairOptions &options)
+        {
+            pairs.clear();
+            bytes = 0;
+            if (options.budget == 0)
+            {
+                return;
+            }
+            std::vector<std::pair<double, std::string>> candidates;
+            bool from_log = !options.query_log.empty() && FromQueryLog(idx, options.query_log, &candidates);
+            if (!from_log)
+            {
+                FromCooccurrence(idx, options.candidate_terms, &candidates);
+            }
+            std::sort(candidates.begin(), candidates.end(),
+                      [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b)
+                      { return a.first > b.first; });
+
+            // 按收益从高到低装入，装不下的跳过，继续尝试更小的词对
+            const uint64_t doc_count = idx->TitleLens().size();
+            for (auto &candidate : candidates)
+            {
+                const std::string &key = candidate.second;
+                std::size_t sep = key.find('\1');
+                const ns_index::InvertedList *a = idx->GetInvertedList(key.substr(0, sep));
+                const ns_index::InvertedList *b = idx->GetInvertedList(key.substr(sep + 1));
+                // 交集不超过较短的拉链，按它预估；实际大小算入已用预算
+                std::size_t cost = std::min(a->size(), b->size()) * sizeof(PairPosting) + key.size();
+                if (bytes + cost > options.budget)
+                {
+                    continue;
+                }
+                PairList list;
+                Intersect(*a, *b, doc_count, &list);
+                if (list.empty())
+                {
+                    continue;
+                }
+                list.shrink_to_fit();
+                bytes += list.size() * sizeof(PairPosting) + key.size();
+                pairs[key] = std::move(list);
+            }
+            LOG(NORMAL, "词对索引建立完成, 来源: " + std::string(from_log ? "查询日志" : "共现统计") +
+                            " 候选: " + std::to_string(candidates.size()) + " 词对: " + std::to_string(pairs.size()) +
+                            " 字节数: " + std::to_string(bytes));
+        }
+
+        // 查找a、b组成的词对，swapped表示first对应b
+        const PairList *Find(const std::string &a, const std::string &b, bool *swapped) const
+        {
+            if (pairs.empty() || a == b)
+            {
+                return nullptr;
+            }
+            *swapped = b < a;
+            auto iter = pairs.find(*swapped ? Key(b, a) : Key(a, b));
+            return iter == pairs.end() ? nullptr : &iter->second;
+        }
+
+        bool Empty() const { return pairs.empty(); }
+        std::size_t Size() const { return pairs.size(); }
+        std::size_t Bytes() const { return bytes; }
+
+        // 每次多词查询调用一次，hit表示用上了词对拉链
+        void Record(bool hit) const
+        {
+            queries.fetch_add(1, std::memory_order_relaxed);
+            if (hit)
+            {
+                covered.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        PairCoverage Coverage() const
+        {
+            PairCoverage coverage;
+            coverage.queries = queries.load(std::memory_order_relaxed);
+            coverage.covered = covered.load(std::memory_order_relaxed);
+            return coverage;
+        }
+
+    private:
+        static std::string Key(const std::string &small, const std::string &large)
+        {
+            return small + '\1' + large;
+        }
+
+        // 两条按doc_id有序的拉链求交集，记录两边的下标
+        static void Intersect(const ns_index::InvertedList &a, const ns_index::InvertedList &b, uint64_t doc_count, PairList *out)
+        {
+            std::size_t i = 0, j = 0;
+            while (i < a.size() && j < b.size())
+            {
+                if (a[i].doc_id < b[j].doc_id)
+                {
+                    i++;
+                }
+                else if (b[j].doc_id < a[i].doc_id)
+                {
+                    j++;
+                }
+                else
+                {
+                    if (a[i].doc_id < doc_count)
+                    {
+                        PairPosting posting = {static_cast<uint32_t>(i), static_cast<uint32_t>(j)};
+                        out->push_back(posting);
+                    }
+                    i++;
+                    j++;
+                }
+            }
+        }
+
+        // 查询日志中同一条查询出现的词两两组成候选，收益 = 出现次数 * 两条拉链的长度之和
+        static bool FromQueryLog(ns_index::Index *idx, const std::string &path, std::vector<std::pair<double, std::string>> *candidates)
+        {
+            std::ifstream in(path);
+            if (!in.is_open())
+            {
+                LOG(WARNING, "打开查询日志失败: " + path + ", 改用共现统计");
+                return false;
+            }
+            std::unordered_map<std::string, double> freq;
+            std::string line;
+            while (std::getline(in, line))
+            {
+                std::vector<std::string> words;
+                ns_util::JiebaUtil::CutString(line, &words);
+                for (std::string &word : words)
+                {
+                    boost::to_lower(word);
+                }
+                std::sort(words.begin(), words.end());
+                words.erase(std::unique(words.begin(), words.end()), words.end());
+                for (std::size_t i = 0; i < words.size(); i++)
+                {
+                    for (std::size_t j = i + 1; j < words.size(); j++)
+                    {
+                        freq[Key(words[i], words[j])] += 1;
+                    }
+                }
+            }
+            for (auto &item : freq)
+            {
+                std::size_t sep = item.first.find('\1');
+                const ns_index::InvertedList *a = idx->GetInvertedList(item.first.substr(0, sep));
+                const ns_index::InvertedList *b = idx->GetInvertedList(item.first.substr(sep + 1));
+                if (a != nullptr && b != nullptr)
+                {
+                    candidates->push_back(std::make_pair(item.second * (a->size() + b->size()), item.first));
+                }
+            }
+            return true;
+        }
+
+        // 没有查询日志时，在文档频率最高的词之间统计共现文档数，共现越多越可能被一起查询
+        static void FromCooccurrence(ns_index::Index *idx, std::size_t limit, std::vector<std::pair<double, std::string>> *candidates)
+        {
+            std::vector<std::string> terms;
+            idx->ListTerms(&terms);
+            std::vector<std::pair<std::size_t, std::string>> by_df;
+            by_df.reserve(terms.size());
+            for (auto &term : terms)
+            {
+                by_df.push_back(std::make_pair(idx->GetInvertedList(term)->size(), term));
+            }
+            limit = std::min(limit, by_df.size());
+            std::partial_sort(by_df.begin(), by_df.begin() + limit, by_df.end(),
+                              [](const std::pair<std::size_t, std::string> &a, const std::pair<std::size_t, std::string> &b)
+                              { return a.first > b.first; });
+            by_df.resize(limit);
+            // 按字典序编号，保证i < j时词i就是key中较小的词
+            std::sort(by_df.begin(), by_df.end(),
+                      [](const std::pair<std::size_t, std::string> &a, const std::pair<std::size_t, std::string> &b)
+                      { return a.second < b.second; });
+
+            // 每个文档包含哪些候选词，再对文档内的候选词两两计数
+            const uint64_t doc_count = idx->TitleLens().size();
+            std::vector<std::vector<uint32_t>> doc_terms(doc_count);
+            for (std::size_t t = 0; t < limit; t++)
+            {
+                for (auto &elem : *idx->GetInvertedList(by_df[t].second))
+                {
+                    if (elem.doc_id < doc_count)
+                    {
+                        doc_terms[elem.doc_id].push_back(static_cast<uint32_t>(t));
+                    }
+                }
+            }
+            std::vector<uint32_t> counts(limit * limit, 0);
+            for (auto &ids : doc_terms)
+            {
+                for (std::size_t i = 0; i < ids.size(); i++)
+                {
+                    for (std::size_t j = i + 1; j < ids.size(); j++)
+                    {
+                        counts[ids[i] * limit + ids[j]]++;
+                    }
+                }
+            }
+            for (std::size_t i = 0; i < limit; i++)
+            {
+                for (std::size_t j = i + 1; j < limit; j++)
+                {
+                    if (counts[i * limit + j] > 0)
+                    {
+                        candidates->push_back(std::make_pair(static_cast<double>(counts[i * limit + j]),
+                                                             Key(by_df[i].second, by_df[j].second)));
+                    }
+                }
+            }
+        }
+    };
+}
@@ -3,17 +3,33 @@
 #include <vector>
 #include <fstream>
 #include <memory>
+#include <functional>
+#include <unordered_set>
+#include <cstdio>
 #include <boost/filesystem.hpp>
 #include <jsoncpp/json/json.h>
 #include "util.hpp"
 #include "mysql_operations.hpp"
+#include "simhash.hpp"
+#include "boilerplate.hpp"
+#include "record.hpp"
+#include "index.hpp"
+#include "manifest.hpp"
 #include <algorithm>
 #include <codecvt>
+#include <chrono>
+#include <thread>
 
 // 文件/数据处理
 const std::string url_head = "https://www.boost.org/doc/libs/1_83_0";
 const std::string src_path = "data/input";
-const std::string output = "data/raw_html/raw.txt";
+const std::string output = "data/raw_html/raw.bin";
+// 增量解析用到的状态，全量解析时重新生成
+const std::string manifest_path = "data/raw_html/manifest.txt";
+const std::string sketch_path = "data/raw_html/boilerplate.bin";
+// 增量解析输出、indextext update应用的变更集
+const std::string changes_path = "data/raw_html/changes.txt";
+const std::string changes_docs = "data/raw_html/changes.bin";
 // const std::string output = "mysql";
 
 typedef struct DocInfo
@@ -21,38 +37,212 @@ typedef struct DocInfo
     std::string title;   // 标题
     std::string content; // 内容
     std::string url;     // URL
+    std::vector<uint32_t> line_ends; // 源文件每行结束时content的长度，去模板文本时按行分块
+    std::string path;                // 源文件路径
+    ns_manifest::Entry file;         // 源文件的修改时间、大小和md5，写manifest用
 } DocInfo_t;
 
+// 解析阶段的吞吐统计
+struct ParseStats
+{
+    std::size_t files; // 枚举到的html文件数
+    uint64_t bytes;    // 这些文件的总字节数
+    double seconds;    // 枚举+读取+解析的总耗时
+    ParseStats() : files(0), bytes(0), seconds(0) {}
+};
+
+typedef std::function<void(DocInfo_t &)> DocSink; // 按枚举顺序逐个接收解析好的文档
+typedef ns_threadpool::BoundedQueue<std::vector<ns_index::DocInfo>> IndexQueue;
+
 bool EnumFile(const std::string &src_path, std::vector<std::string> *files_list);
-bool ParseHtml(const std::vector<std::string> &files_list, std::vector<DocInfo_t> *results);
-bool SaveHtml(const std::vector<DocInfo_t> &results, const std::string &output);
+bool ParseHtml(const std::vector<std::string> &files_list, std::vector<DocInfo_t> *results, std::vector<std::string> *skipped = nullptr);
+bool ParseHtmlParallel(const std::string &src_path, const DocSink &sink, ParseStats *stats, bool digest = false, std::vector<std::string> *skipped = nullptr);
+bool UpdateDocs();
+static bool DigestFile(const std::string &path, ns_manifest::Entry *entry);
+static void RecordSkipped(const std::string &path, ns_manifest::Manifest *manifest);
+bool BenchParse();
+bool BenchClean();
+bool StripAndFingerprint(const std::string &input, const std::string &stripped, const ns_boilerplate::Stripper &stripper, std::vector<uint64_t> *fps);
+bool SaveDocs(const std::string &stripped, const std::vector<uint32_t> &canonical, const std::string &output, IndexQueue *index_queue);
 
-int main()
+static void PrintStats(const std::string &name, const ParseStats &stats)
 {
-    std::vector<std::string> files_list;
-    // 第一步: 递归式吧每个html文件名带路径保存到file_list
-    if (!EnumFile(src_path, &files_list))
+    double mb = stats.bytes / 1048576.0;
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    std::cout << name << ": " << stats.files << " files, " << mb << " MB in " << stats.seconds << " s, "
+              << stats.files / seconds << " files/s, " << mb / seconds << " MB/s" << std::endl;
+}
+
+// ./parser         并行流水线解析，写出raw.bin和doc_info
+// ./parser serial  原先的串行解析（全部文档先读入内存），其余步骤相同
+// ./parser index   单进程模式：在上面的基础上，输出的文档经队列直接交给建索引线程，省去indextext
+// ./parser update  增量解析：只解析manifest中记录的修改时间、大小或md5变化的文件，生成变更集交给indextext update
+// ./parser bench   两种方式各解析一遍，比较吞吐并校验结果一致，不写出
+// ./parser bench-clean  比较原先的逐字节清洗和ns_utf8::Clean的吞吐
+int main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "bench")
+    {
+        return BenchParse() ? 0 : 2;
+    }
+    if (mode == "bench-clean")
+    {
+        return BenchClean() ? 0 : 2;
+    }
+    if (mode == "update")
+    {
+        return UpdateDocs() ? 0 : 4;
+    }
+    // 文档只在相邻两步之间流过，内存中不保存全部文档
+    // 去模板和去重都需要全量统计，所以中间结果先写入两个临时记录文件
+    const std::string parsed = output + ".parsed";
+    const std::string stripped = output + ".stripped";
+
+    // 第一步：枚举并解析html，写入临时文件，同时统计每个文本块出现在多少文档中
+    ns_boilerplate::Stripper stripper;
+    ns_record::Writer spool;
+    if (!spool.Open(parsed))
+    {
+        std::cerr << "open " << parsed << " failed!" << std::endl;
+        return 3;
+    }
+    bool spool_ok = true;
+    // 同时记录每个文件的状态，by_seq[i]对应临时文件中的第i条记录
+    ns_manifest::Manifest manifest;
+    std::vector<ns_manifest::Entry *> by_seq;
+    DocSink sink = [&stripper, &spool, &spool_ok, &manifest, &by_seq](DocInfo_t &doc)
+    {
+        stripper.Observe(doc.content, doc.line_ends);
+        spool_ok = spool.Write(doc.title, doc.content, doc.url, 0, doc.line_ends) && spool_ok;
+        by_seq.push_back(&manifest.Put(doc.path, doc.file));
+    };
+    ParseStats stats;
+    std::vector<std::string> skipped; // 读取或解析失败的文件
+    if (mode == "serial")
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> files_list;
+        // 递归式吧每个html文件名带路径保存到file_list
+        if (!EnumFile(src_path, &files_list))
+        {
+            std::cerr << "enum file name error!" << std::endl;
+            return 1;
+        }
+        // 按照files_file读取每个文件内容并解析
+        std::vector<DocInfo_t> results;
+        if (!ParseHtml(files_list, &results, &skipped))
+        {
+            std::cerr << "parse html error!" << std::endl;
+            return 2;
+        }
+        stats.files = files_list.size();
+        for (auto &file : files_list)
+        {
+            stats.bytes += boost::filesystem::file_size(file);
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        PrintStats("parse(serial)", stats);
+        for (auto &doc : results)
+        {
+            DigestFile(doc.path, &doc.file);
+            sink(doc);
+        }
+    }
+    else
+    {
+        // 枚举文件的同时多线程读取解析
+        if (!ParseHtmlParallel(src_path, sink, &stats, true, &skipped))
+        {
+            std::cerr << "parse html error!" << std::endl;
+            return 2;
+        }
+        PrintStats("parse", stats);
+    }
+    if (!spool.Close() || !spool_ok)
+    {
+        std::cerr << "write " << parsed << " failed!" << std::endl;
+        return 3;
+    }
+    for (auto &path : skipped)
+    {
+        RecordSkipped(path, &manifest);
+    }
+    stripper.Finish();
+    if (!stripper.Save(sketch_path))
+    {
+        std::cerr << "save " << sketch_path << " failed!" << std::endl;
+        return 3;
+    }
+
+    // 第二步：去掉在大量页面中重复出现的导航栏、页脚等模板文本，并计算SimHash指纹
+    std::vector<uint64_t> fps;
+    if (!StripAndFingerprint(parsed, stripped, stripper, &fps))
     {
-        std::cerr << "enum file name error!" << std::endl;
-        return 1;
+        std::cerr << "strip boilerplate error" << std::endl;
+        return 3;
     }
-    // 第二步: 按照files_file读取每个文件内容并解析
-    std::vector<DocInfo_t> results;
-    if (!ParseHtml(files_list, &results))
+    std::remove(parsed.c_str());
+
+    // 第三步：近重复聚类，只保留每组中最先出现的一篇
+    std::vector<uint32_t> canonical;
+    ns_simhash::Cluster(fps, &canonical);
+    uint64_t next_id = 0;
+    for (std::size_t i = 0; i < by_seq.size() && i < fps.size(); i++)
+    {
+        by_seq[i]->fp = fps[i];
+        by_seq[i]->state = canonical[i] == i ? ns_manifest::STATE_KEPT : ns_manifest::STATE_DUP;
+        by_seq[i]->doc_id = canonical[i] == i ? next_id++ : 0;
+    }
+
+    // 第四步：把代表文档写入output和数据库；单进程模式下同时交给建索引线程
+    std::unique_ptr<IndexQueue> index_queue;
+    std::thread indexer;
+    if (mode == "index")
     {
-        std::cerr << "parse html error!" << std::endl;
-        return 2;
+        index_queue.reset(new IndexQueue(4));
+        IndexQueue *queue = index_queue.get();
+        indexer = std::thread([queue]
+                              {
+                                  ns_index::Index *index = ns_index::Index::GetInstance();
+                                  std::vector<ns_index::DocInfo> batch;
+                                  while (queue->Pop(&batch))
+                                  {
+                                      index->BuildDocs(&batch);
+                                  }
+                                  index->FinishBuild();
+                                  if (!index->SaveInvertedIndex())
+                                  {
+                                      LOG(FATAL, "倒排索引保存失败. . . ");
+                                  }
+                              });
     }
-    // 第三步：把解析完的各个文件写入output,以\3作为分割符
-    if (!SaveHtml(results, output))
+    bool saved = SaveDocs(stripped, canonical, output, index_queue.get());
+    if (index_queue)
+    {
+        index_queue->Close();
+        indexer.join();
+    }
+    std::remove(stripped.c_str());
+    if (!saved)
     {
         std::cerr << "save html error" << std::endl;
         return 3;
     }
+    // 全量结果取代所有未应用的变更集；manifest最后写，之后即可增量解析
+    std::remove(changes_path.c_str());
+    std::remove(changes_docs.c_str());
+    if (!manifest.Save(manifest_path))
+    {
+        std::cerr << "save " << manifest_path << " failed!" << std::endl;
+        return 3;
+    }
     return 0;
 }
 
-bool EnumFile(const std::string &src_path, std::vector<std::string> *files_list)
+// 递归遍历src_path下的html文件，每找到一个调用一次func(路径, 文件大小)，func返回false时停止
+template <class Func>
+static bool ForEachHtml(const std::string &src_path, Func func)
 {
     namespace fs = boost::filesystem;
     fs::path root_path(src_path);
@@ -82,12 +272,24 @@ bool EnumFile(const std::string &src_path, std::vector<std::string> *files_list)
         // debug
         // std::cout << "debug:" << iter->path().string() << std::endl;
 
-        // 将html文件保存到files_list，方便后续进行文本分析
-        files_list->push_back(iter->path().string());
+        if (!func(iter->path().string(), fs::file_size(iter->path())))
+        {
+            break;
+        }
     }
     return true;
 }
 
+bool EnumFile(const std::string &src_path, std::vector<std::string> *files_list)
+{
+    return ForEachHtml(src_path, [files_list](const std::string &path, uintmax_t)
+                       {
+                           // 将html文件保存到files_list，方便后续进行文本分析
+                           files_list->push_back(path);
+                           return true;
+                       });
+}
+
 static bool ParseTitle(const std::string &file, std::string *title)
 {
     std::size_t begin = file.find("<title>");
@@ -112,7 +314,8 @@ static bool ParseTitle(const std::string &file, std::string *title)
     return true;
 }
 
-static bool ParseContent(const std::string &file, std::string *content)
+// file_ends为源文件每行在file中的结束位置，换算成content中的位置写入line_ends
+static bool ParseContent(const std::string &file, const std::vector<uint32_t> &file_ends, std::string *content, std::vector<uint32_t> *line_ends)
 {
     // 去标签
     enum status
@@ -122,8 +325,15 @@ static bool ParseContent(const std::string &file, std::string *content)
     };
 
     enum status s = LABLE;
-    for (char c : file)
+    std::size_t line = 0;
+    for (std::size_t i = 0; i < file.size(); i++)
     {
+        while (line < file_ends.size() && file_ends[line] == i)
+        {
+            line_ends->push_back(static_cast<uint32_t>(content->size()));
+            line++;
+        }
+        char c = file[i];
         switch (s)
         {
         case LABLE:
@@ -169,30 +379,81 @@ static void ShowDoc(const DocInfo_t &doc)
     std::cout << "url: " << doc.url << std::endl;
 }
 
-bool ParseHtml(const std::vector<std::string> &files_list, std::vector<DocInfo_t> *results)
+// 源文件的修改时间（纳秒）和大小，增量解析时两者都没变的文件不再读取
+static bool StatFile(const std::string &path, ns_manifest::Entry *entry)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        LOG(WARNING, "stat file " + path + " error");
+        return false;
+    }
+    entry->mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    entry->size = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+// 在StatFile的基础上计算原始内容的md5，只改了修改时间的文件据此跳过
+static bool DigestFile(const std::string &path, ns_manifest::Entry *entry)
+{
+    static thread_local std::string scratch;
+    ns_util::MappedFile file;
+    if (!StatFile(path, entry) || !file.Open(path, &scratch))
+    {
+        return false;
+    }
+    entry->md5 = MD5(std::string(file.data() == nullptr ? "" : file.data(), file.size())).toStr();
+    return true;
+}
+
+// 解析失败的文件也记入manifest，只有修改时间和大小，没有变化时增量解析不再重复读取
+static void RecordSkipped(const std::string &path, ns_manifest::Manifest *manifest)
+{
+    ns_manifest::Entry entry;
+    if (StatFile(path, &entry))
+    {
+        entry.state = ns_manifest::STATE_SKIPPED;
+        manifest->Put(path, entry);
+    }
+}
+
+// 解析一个已读入内存的文件，串行和并行两条路径共用
+static bool ParseDoc(const std::string &file, const std::string &result, const std::vector<uint32_t> &file_ends, DocInfo_t *doc)
+{
+    // 2.解析文件内容，提取title
+    if (!ParseTitle(result, &doc->title))
+    {
+        return false;
+    }
+    // 3.提取content
+    if (!ParseContent(result, file_ends, &doc->content, &doc->line_ends))
+    {
+        return false;
+    }
+    // 4.解析文件路径，构建url
+    if (!ParseUrl(file, &doc->url))
+    {
+        return false;
+    }
+    doc->path = file;
+    return true;
+}
+
+// skipped不为空时记录读取或解析失败的文件
+bool ParseHtml(const std::vector<std::string> &files_list, std::vector<DocInfo_t> *results, std::vector<std::string> *skipped)
 {
     for (const std::string &file : files_list)
     {
         // 1.读取文件：read()
         std::string result;
-        if (!ns_util::FileUtil::ReadFile(file, &result))
-        {
-            continue;
-        }
+        std::vector<uint32_t> file_ends;
         DocInfo_t doc;
-        // 2.解析文件内容，提取title
-        if (!ParseTitle(result, &doc.title))
-        {
-            continue;
-        }
-        // 3.提取content
-        if (!ParseContent(result, &doc.content))
-        {
-            continue;
-        }
-        // 4.解析文件路径，构建url
-        if (!ParseUrl(file, &doc.url))
+        if (!ns_util::FileUtil::ReadFile(file, &result, &file_ends) || !ParseDoc(file, result, file_ends, &doc))
         {
+            if (skipped != nullptr)
+            {
+                skipped->push_back(file);
+            }
             continue;
         }
 
@@ -206,45 +467,607 @@ bool ParseHtml(const std::vector<std::string> &files_list, std::vector<DocInfo_t
     return true;
 }
 
-bool SaveHtml(const std::vector<DocInfo_t> &results, const std::string &output)
+struct ParseResult
 {
-#define SEP '\3'
+    bool ok;
+    DocInfo_t doc;
+    ParseResult() : ok(false) {}
+};
 
-    std::unique_ptr<ns_operation::TableDoc> tb_doc(new ns_operation::TableDoc());
+// 解析结果按枚举顺序交给sink；工作线程乱序完成，先放在pending中
+class ParseReorder
+{
+private:
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::unordered_map<std::size_t, ParseResult> pending;
+    std::size_t next;
 
-    // 按照二进制方式进行写入
-    std::ofstream out(output, std::ios::out | std::ios::binary);
-    if (!out.is_open())
+public:
+    ParseReorder() : next(0) {}
+
+    void Put(std::size_t seq, ParseResult &&parsed)
     {
-        std::cerr << "open " << output << " failed!" << std::endl;
+        std::unique_lock<std::mutex> lock(mtx);
+        pending.emplace(seq, std::move(parsed));
+        if (seq == next)
+        {
+            cond.notify_one();
+        }
+    }
+
+    // 把已到达的连续结果交给sink，直到还没交出的不超过limit个；sink在调用线程上执行，不持有锁
+    // 失败的文件路径按顺序加入skipped（可为nullptr）
+    void Drain(std::size_t submitted, std::size_t limit, const DocSink &sink, std::vector<std::string> *skipped)
+    {
+        while (true)
+        {
+            ParseResult parsed;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                auto iter = pending.find(next);
+                if (iter == pending.end())
+                {
+                    if (submitted - next <= limit)
+                    {
+                        return;
+                    }
+                    cond.wait(lock, [this]
+                              { return pending.count(next) > 0; });
+                    iter = pending.find(next);
+                }
+                parsed = std::move(iter->second);
+                pending.erase(iter);
+                next++;
+            }
+            if (parsed.ok)
+            {
+                sink(parsed.doc);
+            }
+            else if (skipped != nullptr)
+            {
+                skipped->push_back(std::move(parsed.doc.path));
+            }
+        }
+    }
+};
+
+// 流水线：当前线程枚举文件，每个文件作为一个后台任务交给共享线程池读取并解析，工作线程复用自己的读缓冲
+// 当前线程按枚举顺序把结果交给sink，输出顺序与串行版本完全一致；已枚举但还没交给sink的文件数有上限，乱序等待的结果不会无限堆积
+// digest为true时同时计算每个文件的md5，供全量解析写manifest；skipped不为空时记录读取或解析失败的文件
+bool ParseHtmlParallel(const std::string &src_path, const DocSink &sink, ParseStats *stats, bool digest, std::vector<std::string> *skipped)
+{
+    auto start = std::chrono::steady_clock::now();
+    ns_threadpool::ThreadPool *pool = ns_threadpool::ThreadPool::GetInstance();
+    const std::size_t window = pool->Size() * 64;
+    ParseReorder reorder;
+    ns_threadpool::TaskGroup group(pool, ns_threadpool::PRIORITY_BACKGROUND);
+
+    uint64_t bytes = 0;
+    std::size_t seq = 0;
+    bool ok = ForEachHtml(src_path, [&](const std::string &path, uintmax_t size)
+                          {
+                              reorder.Drain(seq, window - 1, sink, skipped);
+                              bytes += size;
+                              std::size_t id = seq++;
+                              group.Run([&reorder, digest, id, path]
+                                        {
+                                            static thread_local std::string result;
+                                            static thread_local std::vector<uint32_t> file_ends;
+                                            ParseResult parsed;
+                                            parsed.ok = ns_util::FileUtil::ReadFileMapped(path, &result, &file_ends) &&
+                                                        ParseDoc(path, result, file_ends, &parsed.doc) &&
+                                                        (!digest || DigestFile(path, &parsed.doc.file));
+                                            if (!parsed.ok)
+                                            {
+                                                parsed.doc.path = path;
+                                            }
+                                            reorder.Put(id, std::move(parsed));
+                                        });
+                              return true;
+                          });
+    reorder.Drain(seq, 0, sink, skipped);
+    group.Wait();
+    stats->files = seq;
+    stats->bytes = bytes;
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+
+// 增量解析中有变化的文件
+struct ChangedFile
+{
+    std::string path;
+    ns_manifest::Entry file; // 新的状态
+    ns_manifest::Entry old;  // manifest中原来的状态
+    bool had_old;            // 新文件为false
+    bool ok;                 // 是否解析成功
+    bool kept;               // 解析成功且不是近重复
+    DocInfo_t doc;
+    ChangedFile() : had_old(false), ok(false), kept(false) {}
+};
+
+// 增量解析：按manifest跳过没有变化的文件，有变化的文件按全量解析保存的模板统计去模板，并与现有文档做近重复检测
+// raw.bin中删除和修改的文档换成空记录，新文档追加在末尾，记录位置始终等于doc_id
+// 近重复只判断新文档，已有文档的dup_count和被删文档的近重复文档要等下一次全量解析才会更新
+bool UpdateDocs()
+{
+    auto start = std::chrono::steady_clock::now();
+    ns_manifest::Manifest manifest;
+    if (!manifest.Load(manifest_path))
+    {
+        std::cerr << manifest_path << " not found, run a full parse first" << std::endl;
+        return false;
+    }
+    if (boost::filesystem::exists(changes_path))
+    {
+        std::cerr << changes_path << " has not been applied, run indextext update first" << std::endl;
+        return false;
+    }
+    ns_boilerplate::Stripper stripper;
+    if (!stripper.Load(sketch_path))
+    {
+        std::cerr << "load " << sketch_path << " failed, run a full parse first" << std::endl;
         return false;
     }
 
-    int i = 0;
-    for (auto &item : results)
+    // 1. 比较修改时间和大小，变化的再比较md5，md5也变了才重新解析
+    std::unordered_set<std::string> seen;
+    std::vector<ChangedFile> changed;
+    std::size_t touched = 0;
+    std::string result;
+    std::vector<uint32_t> file_ends;
+    bool enum_ok = ForEachHtml(src_path, [&](const std::string &path, uintmax_t)
+                               {
+                                   seen.insert(path);
+                                   ns_manifest::Entry *old = manifest.Find(path);
+                                   ns_manifest::Entry file;
+                                   if (!StatFile(path, &file))
+                                   {
+                                       return true;
+                                   }
+                                   if (old != nullptr && old->mtime == file.mtime && old->size == file.size)
+                                   {
+                                       return true;
+                                   }
+                                   // 读不出来的文件按解析失败处理，记为skipped，原来保留的文档被删除
+                                   bool readable = DigestFile(path, &file);
+                                   if (readable && old != nullptr && old->md5 == file.md5)
+                                   {
+                                       old->mtime = file.mtime; // 只是修改时间变了，内容相同
+                                       old->size = file.size;
+                                       touched++;
+                                       return true;
+                                   }
+                                   ChangedFile c;
+                                   c.path = path;
+                                   c.file = file;
+                                   c.had_old = old != nullptr;
+                                   if (old != nullptr)
+                                   {
+                                       c.old = *old;
+                                   }
+                                   c.ok = readable && ns_util::FileUtil::ReadFileMapped(path, &result, &file_ends) &&
+                                          ParseDoc(path, result, file_ends, &c.doc);
+                                   changed.push_back(std::move(c));
+                                   return true;
+                               });
+    if (!enum_ok)
     {
-        std::string out_string;
-        out_string = item.title;
-        out_string += SEP;
-        out_string += item.content;
-        out_string += SEP;
-        out_string += item.url;
-        out_string += '\n';
+        return false;
+    }
 
-        out.write(out_string.c_str(), out_string.size());
+    // 2. 去模板并计算指纹
+    ns_boilerplate::StripReport report;
+    std::unordered_set<std::string> changed_paths;
+    for (auto &c : changed)
+    {
+        changed_paths.insert(c.path);
+        if (c.ok)
+        {
+            stripper.Strip(c.doc.title, &c.doc.content, c.doc.line_ends, &report);
+            c.file.fp = ns_simhash::Fingerprint(c.doc.title, c.doc.content);
+            c.doc.line_ends.clear();
+        }
+    }
 
-        Json::Value tmp;
-        tmp["doc_id"] = i;
-        tmp["title"] = item.title;
-        tmp["content"] = item.content;
-        tmp["url"] = item.url;
-        if (tb_doc->Insert(tmp) == false)
+    // 3. 找出被删除的文件；没有变化的现有文档排在前面参与近重复检测，新文档只会被判为它们或更早的新文档的重复
+    std::vector<ns_manifest::Change> changes;
+    std::unordered_set<uint64_t> removed; // raw.bin中要换成空记录的doc_id
+    std::vector<std::string> gone;
+    std::vector<uint64_t> fps;
+    for (auto &item : manifest.Entries())
+    {
+        const ns_manifest::Entry &e = item.second;
+        if (seen.count(item.first) == 0)
+        {
+            gone.push_back(item.first);
+            if (e.state == ns_manifest::STATE_KEPT)
+            {
+                ns_manifest::Change del;
+                del.kind = ns_manifest::CHANGE_DELETE;
+                del.old_id = e.doc_id;
+                ParseUrl(item.first, &del.url);
+                changes.push_back(del);
+                removed.insert(e.doc_id);
+            }
+        }
+        else if (e.state == ns_manifest::STATE_KEPT && changed_paths.count(item.first) == 0)
+        {
+            fps.push_back(e.fp);
+        }
+    }
+    for (auto &path : gone)
+    {
+        manifest.Erase(path);
+    }
+    std::vector<std::size_t> slots(changed.size(), 0); // 新文档在fps中的位置
+    for (std::size_t i = 0; i < changed.size(); i++)
+    {
+        if (changed[i].ok)
+        {
+            slots[i] = fps.size();
+            fps.push_back(changed[i].file.fp);
+        }
+    }
+    std::vector<uint32_t> canonical;
+    ns_simhash::Cluster(fps, &canonical);
+
+    // 4. 重写raw.bin：删除和修改的文档换成空记录，新文档按顺序追加并分配doc_id
+    for (auto &c : changed)
+    {
+        if (c.had_old && c.old.state == ns_manifest::STATE_KEPT)
+        {
+            removed.insert(c.old.doc_id);
+        }
+    }
+    const std::string rewritten = output + ".tmp";
+    ns_record::Reader reader;
+    ns_record::Writer out, delta;
+    if (!reader.Open(output) || !out.Open(rewritten) || !delta.Open(changes_docs))
+    {
+        return false;
+    }
+    ns_record::Record record;
+    const ns_record::Record empty;
+    bool ok = true;
+    uint64_t next_id = 0;
+    for (; ok && reader.Next(&record); next_id++)
+    {
+        ok = out.Write(removed.count(next_id) ? empty : record);
+    }
+    ok = ok && !reader.Corrupted();
+    std::size_t dups = 0;
+    for (std::size_t i = 0; ok && i < changed.size(); i++)
+    {
+        ChangedFile &c = changed[i];
+        c.kept = c.ok && canonical[slots[i]] == slots[i];
+        dups += c.ok && !c.kept ? 1 : 0;
+        bool was_kept = c.had_old && c.old.state == ns_manifest::STATE_KEPT;
+        ns_manifest::Change change;
+        ParseUrl(c.path, &change.url);
+        change.old_id = c.old.doc_id;
+        if (c.kept)
+        {
+            change.kind = was_kept ? ns_manifest::CHANGE_UPDATE : ns_manifest::CHANGE_ADD;
+            change.new_id = next_id++;
+            ok = out.Write(c.doc.title, c.doc.content, c.doc.url, 0, c.doc.line_ends) &&
+                 delta.Write(c.doc.title, c.doc.content, c.doc.url, 0, c.doc.line_ends);
+            changes.push_back(change);
+        }
+        else if (was_kept)
+        {
+            change.kind = ns_manifest::CHANGE_DELETE;
+            changes.push_back(change);
+        }
+        c.file.state = !c.ok ? ns_manifest::STATE_SKIPPED : (c.kept ? ns_manifest::STATE_KEPT : ns_manifest::STATE_DUP);
+        c.file.doc_id = c.kept ? change.new_id : 0;
+        manifest.Put(c.path, c.file);
+    }
+    ok = out.Close() && delta.Close() && ok;
+    reader.Close();
+
+    // 5. 先写变更集再替换raw.bin，最后写manifest；没有变化时不留下变更集
+    if (ok && !changes.empty())
+    {
+        ok = ns_manifest::SaveChanges(changes_path, changes) && std::rename(rewritten.c_str(), output.c_str()) == 0;
+    }
+    else
+    {
+        std::remove(rewritten.c_str());
+        std::remove(changes_docs.c_str());
+    }
+    ok = ok && manifest.Save(manifest_path);
+    if (!ok)
+    {
+        std::cerr << "update failed" << std::endl;
+        return false;
+    }
+
+    std::size_t counts[3] = {0, 0, 0};
+    for (auto &c : changes)
+    {
+        counts[c.kind]++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG(NORMAL, "增量解析完成, 文件: " + std::to_string(seen.size()) + " 重新解析: " + std::to_string(changed.size()) +
+                    " 只改了修改时间: " + std::to_string(touched) + " 删除: " + std::to_string(gone.size()) +
+                    " 近重复: " + std::to_string(dups));
+    std::cout << "update: " << seen.size() << " files, " << changed.size() << " changed, " << touched << " touched, "
+              << gone.size() << " removed in " << seconds << " s -> "
+              << counts[ns_manifest::CHANGE_ADD] << " add, " << counts[ns_manifest::CHANGE_UPDATE] << " update, "
+              << counts[ns_manifest::CHANGE_DELETE] << " delete" << std::endl;
+    return true;
+}
+
+bool BenchParse()
+{
+    ParseStats serial;
+    std::vector<DocInfo_t> expected;
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> files_list;
+        if (!EnumFile(src_path, &files_list) || !ParseHtml(files_list, &expected))
         {
             return false;
         }
-        i++;
+        serial.files = files_list.size();
+        for (auto &file : files_list)
+        {
+            serial.bytes += boost::filesystem::file_size(file);
+        }
+        serial.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    ParseStats parallel;
+    std::vector<DocInfo_t> actual;
+    DocSink collect = [&actual](DocInfo_t &doc)
+    {
+        actual.push_back(std::move(doc));
+    };
+    if (!ParseHtmlParallel(src_path, collect, &parallel))
+    {
+        return false;
+    }
+    PrintStats("serial  ", serial);
+    PrintStats("parallel", parallel);
+    std::cout << "speedup: " << serial.seconds / (parallel.seconds > 0 ? parallel.seconds : 1e-9) << "x" << std::endl;
+
+    bool same = expected.size() == actual.size();
+    for (std::size_t i = 0; same && i < expected.size(); i++)
+    {
+        same = expected[i].title == actual[i].title && expected[i].content == actual[i].content &&
+               expected[i].url == actual[i].url && expected[i].line_ends == actual[i].line_ends;
+    }
+    std::cout << "results " << (same ? "identical" : "DIFFER") << ", docs: " << actual.size() << std::endl;
+    return same;
+}
+
+// 原先的FileUtil::removeInvalidCharacters，只用于对比：逐字节追加，只保留ASCII并为SQL转义引号
+static void LegacyClean(std::string &str)
+{
+    std::string validChars;
+    for (std::size_t i = 0; i < str.size(); ++i)
+    {
+        if (str[i] == '\\' || str[i] == '\'' || str[i] == '\"')
+        {
+            validChars += '\\';
+        }
+        if ((str[i] & 0x80) == 0)
+        {
+            validChars += str.substr(i, 1);
+        }
+    }
+    str = validChars;
+}
+
+bool BenchClean()
+{
+    std::vector<std::string> files_list;
+    if (!EnumFile(src_path, &files_list))
+    {
+        return false;
+    }
+    // 先把全部文件读入内存，只计清洗本身的时间
+    std::vector<std::string> files;
+    uint64_t bytes = 0, non_ascii = 0;
+    for (auto &path : files_list)
+    {
+        ns_util::MappedFile file;
+        if (!file.Open(path))
+        {
+            continue;
+        }
+        files.push_back(file.size() > 0 ? std::string(file.data(), file.size()) : std::string());
+        bytes += file.size();
+        for (char c : files.back())
+        {
+            non_ascii += (c & 0x80) != 0;
+        }
+    }
+
+    // 原先按getline切出的每一行分别清洗
+    auto start = std::chrono::steady_clock::now();
+    uint64_t legacy_out = 0;
+    for (auto &text : files)
+    {
+        std::size_t begin = 0;
+        while (begin < text.size())
+        {
+            std::size_t nl = text.find('\n', begin);
+            std::size_t end = nl == std::string::npos ? text.size() : nl;
+            std::string line = text.substr(begin, end - begin);
+            LegacyClean(line);
+            legacy_out += line.size();
+            begin = end + 1;
+        }
     }
-    out.close();
+    double legacy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
+    start = std::chrono::steady_clock::now();
+    uint64_t clean_out = 0;
+    for (auto &text : files)
+    {
+        ns_utf8::CleanInPlace(&text);
+        clean_out += text.size();
+    }
+    double clean = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double mb = bytes / 1048576.0;
+    std::cout << "files: " << files.size() << ", " << mb << " MB, non-ASCII bytes: " << non_ascii << std::endl;
+    std::cout << "legacy: " << legacy << " s, " << mb / (legacy > 0 ? legacy : 1e-9) << " MB/s, output " << legacy_out << " bytes" << std::endl;
+    std::cout << "utf8  : " << clean << " s, " << mb / (clean > 0 ? clean : 1e-9) << " MB/s, output " << clean_out << " bytes" << std::endl;
+    std::cout << "speedup: " << legacy / (clean > 0 ? clean : 1e-9) << "x" << std::endl;
     return true;
 }
+
+// 按批读取第一步的临时文件，批内并行去模板文本、计算指纹，按原顺序写入第二个临时文件
+bool StripAndFingerprint(const std::string &input, const std::string &stripped, const ns_boilerplate::Stripper &stripper, std::vector<uint64_t> *fps)
+{
+    ns_record::Reader reader;
+    ns_record::Writer writer;
+    if (!reader.Open(input) || !writer.Open(stripped))
+    {
+        return false;
+    }
+    const std::size_t batch = 256;
+    std::vector<ns_record::Record> records(batch);
+    ns_boilerplate::StripReport report;
+    std::mutex mtx;
+    bool ok = true;
+    while (ok)
+    {
+        std::size_t n = 0;
+        while (n < batch && reader.Next(&records[n]))
+        {
+            n++;
+        }
+        if (reader.Corrupted())
+        {
+            ok = false;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        std::size_t base = fps->size();
+        fps->resize(base + n);
+        ns_threadpool::ParallelFor(n, 16, [&records, &stripper, &report, &mtx, fps, base](std::size_t begin, std::size_t end)
+                                   {
+                                       ns_boilerplate::StripReport partial;
+                                       for (std::size_t i = begin; i < end; i++)
+                                       {
+                                           ns_record::Record &r = records[i];
+                                           stripper.Strip(r.title, &r.content, r.line_ends, &partial);
+                                           (*fps)[base + i] = ns_simhash::Fingerprint(r.title, r.content);
+                                       }
+                                       std::unique_lock<std::mutex> lock(mtx);
+                                       report.Add(partial);
+                                   });
+        for (std::size_t i = 0; i < n && ok; i++)
+        {
+            records[i].line_ends.clear(); // 行尾只在去模板时使用
+            ok = writer.Write(records[i]);
+        }
+        if (n < batch)
+        {
+            break;
+        }
+    }
+    stripper.Log(report);
+    std::cout << "boilerplate: removed " << report.bytes_removed << "/" << report.bytes_before << " bytes, "
+              << report.postings_removed << "/" << report.postings_before << " postings" << std::endl;
+    return writer.Close() && ok;
+}
+
+// 流式读取第二步的临时文件，只保留代表文档，dup_count为被合并到它的近重复文档数
+bool SaveDocs(const std::string &stripped, const std::vector<uint32_t> &canonical, const std::string &output, IndexQueue *index_queue)
+{
+    std::vector<uint32_t> dups(canonical.size(), 0);
+    for (std::size_t i = 0; i < canonical.size(); i++)
+    {
+        if (canonical[i] != i)
+        {
+            dups[canonical[i]]++;
+        }
+    }
+
+    std::unique_ptr<ns_operation::TableDoc> tb_doc(new ns_operation::TableDoc());
+    ns_record::Reader reader;
+    ns_record::Writer out;
+    if (!reader.Open(stripped))
+    {
+        return false;
+    }
+    // 全量解析重新分配doc_id，增量更新留下的空槽位和旧行一并清掉
+    if (!tb_doc->Clear())
+    {
+        return false;
+    }
+    // 文档由后台线程按批写入数据库，这里只负责攒批
+    ns_operation::BulkWriter doc_writer("doc_info", ns_operation::TableDoc::BulkColumns());
+    if (!doc_writer.Start())
+    {
+        return false;
+    }
+    if (!out.Open(output))
+    {
+        std::cerr << "open " << output << " failed!" << std::endl;
+        return false;
+    }
+
+    const std::size_t batch_size = 1024;
+    std::vector<ns_index::DocInfo> batch;
+    ns_record::Record record;
+    int doc_id = 0;
+    for (std::size_t i = 0; reader.Next(&record); i++)
+    {
+        if (i >= canonical.size())
+        {
+            LOG(WARNING, stripped + " has more records than fingerprints");
+            return false;
+        }
+        if (canonical[i] != i)
+        {
+            continue;
+        }
+        record.dup_count = dups[i];
+        if (!out.Write(record))
+        {
+            return false;
+        }
+
+        doc_writer.Value(doc_id).Value(record.title).Value(record.content).Value(record.url).Value(record.dup_count).EndRow();
+        doc_id++;
+
+        if (index_queue != nullptr)
+        {
+            ns_index::DocInfo doc;
+            doc.title = std::move(record.title);
+            doc.content = std::move(record.content);
+            doc.url = std::move(record.url);
+            doc.dup_count = record.dup_count;
+            batch.push_back(std::move(doc));
+            if (batch.size() >= batch_size)
+            {
+                index_queue->Push(std::move(batch));
+                batch.clear();
+            }
+        }
+    }
+    if (reader.Corrupted())
+    {
+        return false;
+    }
+    if (index_queue != nullptr && !batch.empty())
+    {
+        index_queue->Push(std::move(batch));
+    }
+    LOG(NORMAL, "近重复检测完成, 文档数: " + std::to_string(canonical.size()) + " 保留: " + std::to_string(doc_id) +
+                    " 去掉: " + std::to_string(canonical.size() - doc_id));
+    bool written = doc_writer.Finish();
+    const ns_operation::BulkStats &stats = doc_writer.Stats();
+    std::cout << "doc_info: " << stats.rows << " rows in " << stats.seconds << " s, "
+              << static_cast<uint64_t>(stats.RowsPerSecond()) << " rows/s" << std::endl;
+    return out.Close() && written;
+}
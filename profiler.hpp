@@ -0,0 +1,283 @@
+#pragma once
+// 采样CPU profiler：setitimer(ITIMER_PROF)按进程消耗的CPU时间定时发送SIGPROF，由正在运行的线程处理，
+// 信号处理函数从被打断处的寄存器出发沿帧指针链回溯，调用栈写入预先分配的数组；采样结束后在普通上下文中用dladdr和__cxa_demangle符号化，
+// 输出folded stacks（每行"根;...;叶 次数"），可直接交给flamegraph.pl等火焰图工具
+// 回溯不经过libgcc的unwinder（backtrace会进入dl_iterate_phdr和unwinder的锁，在信号处理函数中可能死锁），
+// 每次读栈都经过process_vm_readv，地址无效时返回错误而不是触发SIGSEGV；只用到系统调用和原子变量，可以常驻release版本
+// 需要以-fno-omit-frame-pointer编译，没有帧指针的库函数（libc等）处回溯会提前结束或跳过几层；
+// 可执行文件中的函数名需要链接时加-rdynamic，否则显示为"模块+偏移"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include "log.hpp"
+
+namespace ns_profiler
+{
+    const int kMaxFrames = 32;
+    const std::size_t kMaxSamples = 1 << 15; // 超出的采样丢弃并计数
+    const int kDefaultHz = 99;                 // 避开其他周期性任务的整数频率
+    const int kMaxHz = 1000;
+    const int kMaxSeconds = 60;
+    const uintptr_t kMaxFrameBytes = 1 << 20; // 相邻两帧的帧指针相差超过这么多视为链已损坏
+
+    struct Sample
+    {
+        int depth;
+        void *frames[kMaxFrames];
+    };
+
+    struct ProfileResult
+    {
+        std::size_t samples;
+        uint64_t lost;
+        std::string folded;
+    };
+
+    class Profiler
+    {
+    private:
+        std::atomic<bool> busy;  // 同一时间只允许一次采样
+        std::atomic<bool> armed; // 信号处理函数只在置位时采样
+        std::atomic<int> inflight; // 正在执行的信号处理函数个数，停止后等它归零再读取samples
+        std::atomic<std::size_t> next;
+        std::atomic<uint64_t> lost;
+        std::vector<Sample> samples;
+        bool installed;
+        pid_t pid;
+
+        Profiler() : busy(false), armed(false), inflight(0), next(0), lost(0), installed(false), pid(getpid()) {}
+
+        // 从本进程的addr处读取两个字，地址未映射时返回false；process_vm_readv是系统调用，可在信号处理函数中使用
+        bool ReadFrame(uintptr_t addr, uintptr_t words[2]) const
+        {
+            struct iovec local = {words, 2 * sizeof(uintptr_t)};
+            struct iovec remote = {reinterpret_cast<void *>(addr), 2 * sizeof(uintptr_t)};
+            return process_vm_readv(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(2 * sizeof(uintptr_t));
+        }
+
+        // 帧指针链：[fp]为上一帧的fp，[fp+8]为返回地址；要求fp对齐且严格向栈底方向增长，任何一步不满足就停止
+        int Walk(const ucontext_t *uc, void **frames) const
+        {
+            uintptr_t pc = 0, fp = 0;
+#if defined(__x86_64__)
+            pc = uc->uc_mcontext.gregs[REG_RIP];
+            fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+            pc = uc->uc_mcontext.pc;
+            fp = uc->uc_mcontext.regs[29];
+#else
+            (void)uc;
+            return 0;
+#endif
+            int depth = 0;
+            frames[depth++] = reinterpret_cast<void *>(pc);
+            while (depth < kMaxFrames && fp != 0 && fp % sizeof(uintptr_t) == 0)
+            {
+                uintptr_t words[2];
+                if (!ReadFrame(fp, words) || words[1] == 0)
+                {
+                    break;
+                }
+                frames[depth++] = reinterpret_cast<void *>(words[1]);
+                if (words[0] <= fp || words[0] - fp > kMaxFrameBytes)
+                {
+                    break;
+                }
+                fp = words[0];
+            }
+            return depth;
+        }
+
+        // 只调用异步信号安全的操作：原子变量和process_vm_readv
+        static void OnSignal(int, siginfo_t *, void *context)
+        {
+            int saved_errno = errno;
+            Profiler &p = Instance();
+            p.inflight.fetch_add(1);
+            if (p.armed.load())
+            {
+                std::size_t i = p.next.fetch_add(1, std::memory_order_relaxed);
+                if (i < kMaxSamples)
+                {
+                    p.samples[i].depth = p.Walk(static_cast<const ucontext_t *>(context), p.samples[i].frames);
+                }
+                else
+                {
+                    p.lost.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            p.inflight.fetch_sub(1);
+            errno = saved_errno;
+        }
+
+        // 处理函数安装后不再卸载：停止后仍可能有已经产生的SIGPROF送达，SIGPROF的默认动作是终止进程
+        bool Install()
+        {
+            if (installed)
+            {
+                return true;
+            }
+            // 容器的seccomp策略可能禁止process_vm_readv，此时不能安全地读栈，拒绝采样
+            uintptr_t probe[2] = {0, 0};
+            if (!ReadFrame(reinterpret_cast<uintptr_t>(probe), probe))
+            {
+                LOG(WARNING, std::string("process_vm_readv不可用: ") + std::strerror(errno));
+                return false;
+            }
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = OnSignal;
+            action.sa_flags = SA_RESTART | SA_SIGINFO; // 被打断的慢系统调用自动重启
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGPROF, &action, nullptr) != 0)
+            {
+                LOG(WARNING, std::string("安装SIGPROF处理函数失败: ") + std::strerror(errno));
+                return false;
+            }
+            installed = true;
+            return true;
+        }
+
+        static bool SetTimer(int hz)
+        {
+            struct itimerval timer;
+            std::memset(&timer, 0, sizeof(timer));
+            if (hz > 0)
+            {
+                // tv_usec须小于1000000，hz=1时间隔为整1秒
+                long us = 1000000 / hz;
+                timer.it_interval.tv_sec = us / 1000000;
+                timer.it_interval.tv_usec = us % 1000000;
+                timer.it_value = timer.it_interval;
+            }
+            return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+        }
+
+        // 函数名，取不到时用"模块+偏移"；返回地址减1落在call指令内，避免调用在函数末尾时算到下一个函数
+        static std::string Symbolize(void *addr, bool leaf)
+        {
+            void *pc = leaf ? addr : static_cast<char *>(addr) - 1;
+            Dl_info info;
+            if (dladdr(pc, &info) == 0 || info.dli_fname == nullptr)
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%p", addr);
+                return buf;
+            }
+            if (info.dli_sname != nullptr)
+            {
+                int status = 0;
+                char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                std::string name = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+                std::free(demangled);
+                return name;
+            }
+            const char *module = std::strrchr(info.dli_fname, '/');
+            char buf[32];
+            snprintf(buf, sizeof(buf), "+0x%lx", static_cast<unsigned long>(static_cast<char *>(pc) - static_cast<char *>(info.dli_fbase)));
+            return std::string(module != nullptr ? module + 1 : info.dli_fname) + buf;
+        }
+
+        // 相同调用栈合并计数，按字典序输出
+        void Fold(std::size_t count, std::string *out)
+        {
+            std::unordered_map<void *, std::string> names[2]; // [0]调用方的返回地址，[1]被打断处的pc
+            std::map<std::string, uint64_t> stacks;
+            std::string stack;
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const Sample &sample = samples[i];
+                stack.clear();
+                for (int f = sample.depth - 1; f >= 0; f--)
+                {
+                    bool leaf = f == 0;
+                    auto iter = names[leaf].find(sample.frames[f]);
+                    if (iter == names[leaf].end())
+                    {
+                        iter = names[leaf].insert(std::make_pair(sample.frames[f], Symbolize(sample.frames[f], leaf))).first;
+                    }
+                    if (!stack.empty())
+                    {
+                        stack.push_back(';');
+                    }
+                    stack.append(iter->second);
+                }
+                if (!stack.empty())
+                {
+                    stacks[stack]++;
+                }
+            }
+            out->clear();
+            for (auto &item : stacks)
+            {
+                out->append(item.first).push_back(' ');
+                out->append(std::to_string(item.second)).push_back('\n');
+            }
+        }
+
+    public:
+        static Profiler &Instance()
+        {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        // 在调用线程上阻塞seconds秒采样整个进程；已有采样在进行时返回false
+        bool Profile(int seconds, int hz, ProfileResult *result, std::string *error)
+        {
+            if (busy.exchange(true))
+            {
+                *error = "已有采样正在进行";
+                return false;
+            }
+            if (!Install())
+            {
+                busy = false;
+                *error = "安装信号处理函数失败或无法安全读取调用栈";
+                return false;
+            }
+            samples.resize(kMaxSamples);
+            next = 0;
+            lost = 0;
+            armed = true;
+            if (!SetTimer(hz))
+            {
+                armed = false;
+                busy = false;
+                *error = std::string("setitimer失败: ") + std::strerror(errno);
+                return false;
+            }
+            LOG(NORMAL, "开始CPU采样, " + std::to_string(seconds) + "秒, " + std::to_string(hz) + "Hz");
+            std::this_thread::sleep_for(std::chrono::seconds(seconds));
+            SetTimer(0);
+            armed = false;
+            while (inflight.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+
+            result->samples = std::min(next.load(), kMaxSamples);
+            result->lost = lost.load();
+            Fold(result->samples, &result->folded);
+            std::vector<Sample>().swap(samples); // 采样缓冲约8MB，用完即释放
+            LOG(NORMAL, "CPU采样结束, 样本数: " + std::to_string(result->samples) + " 丢弃: " + std::to_string(result->lost));
+            busy = false;
+            return true;
+        }
+    };
+}
@@ -0,0 +1,244 @@
+#pragma once
+// parser与indextext之间的二进制记录格式，取代以\3和\n分隔的raw.txt
+// 文件头: "BSR1"
+// 每条记录: u32 负载长度 | u32 标题长度 标题 | u32 正文长度 正文 | u32 URL长度 URL | u32 dup_count | u32 行尾个数 行尾...
+// 整数为小端序；字段按长度读取，文本中出现任何字节都不会与分隔符冲突，读取时也不需要切分拷贝
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "log.hpp"
+
+namespace ns_record
+{
+    const char kMagic[4] = {'B', 'S', 'R', '1'};
+    const uint32_t kMaxPayload = 1u << 30; // 单条记录的上限，超过视为文件损坏
+
+    struct Record
+    {
+        std::string title;
+        std::string content;
+        std::string url;
+        uint32_t dup_count;
+        std::vector<uint32_t> line_ends; // 只在parser的中间文件中使用，最终输出为空
+        Record() : dup_count(0) {}
+    };
+
+    // 判断文件是否为记录格式，用于兼容旧的raw.txt
+    inline bool IsRecordFile(const std::string &path)
+    {
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (fp == nullptr)
+        {
+            return false;
+        }
+        char magic[4];
+        bool ok = fread(magic, 1, 4, fp) == 4 && std::memcmp(magic, kMagic, 4) == 0;
+        fclose(fp);
+        return ok;
+    }
+
+    class Writer
+    {
+    private:
+        FILE *fp;
+        std::string buffer; // 复用的编码缓冲
+        uint64_t records;
+
+        void PutU32(uint32_t v)
+        {
+            char b[4] = {static_cast<char>(v), static_cast<char>(v >> 8), static_cast<char>(v >> 16), static_cast<char>(v >> 24)};
+            buffer.append(b, 4);
+        }
+        void PutBytes(const std::string &s)
+        {
+            PutU32(static_cast<uint32_t>(s.size()));
+            buffer.append(s);
+        }
+
+    public:
+        Writer() : fp(nullptr), records(0) {}
+        ~Writer() { Close(); }
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        bool Open(const std::string &path)
+        {
+            Close();
+            fp = fopen(path.c_str(), "wb");
+            if (fp == nullptr)
+            {
+                LOG(WARNING, "open " + path + " for write error");
+                return false;
+            }
+            setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+            records = 0;
+            return fwrite(kMagic, 1, 4, fp) == 4;
+        }
+
+        bool Write(const std::string &title, const std::string &content, const std::string &url,
+                   uint32_t dup_count, const std::vector<uint32_t> &line_ends)
+        {
+            buffer.clear();
+            PutU32(0); // 负载长度，编码完再回填
+            PutBytes(title);
+            PutBytes(content);
+            PutBytes(url);
+            PutU32(dup_count);
+            PutU32(static_cast<uint32_t>(line_ends.size()));
+            for (uint32_t e : line_ends)
+            {
+                PutU32(e);
+            }
+            uint32_t payload = static_cast<uint32_t>(buffer.size() - 4);
+            for (int i = 0; i < 4; i++)
+            {
+                buffer[i] = static_cast<char>(payload >> (8 * i));
+            }
+            records++;
+            return fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+        }
+
+        bool Write(const Record &r)
+        {
+            return Write(r.title, r.content, r.url, r.dup_count, r.line_ends);
+        }
+
+        bool Close()
+        {
+            bool ok = true;
+            if (fp != nullptr)
+            {
+                ok = fclose(fp) == 0;
+                fp = nullptr;
+            }
+            return ok;
+        }
+
+        uint64_t Records() const { return records; }
+    };
+
+    class Reader
+    {
+    private:
+        FILE *fp;
+        std::string buffer; // 复用的读缓冲，每次只保存一条记录
+        std::string path;
+        bool corrupted;
+
+        bool Corrupt(const char *what)
+        {
+            LOG(WARNING, path + " " + what);
+            corrupted = true;
+            return false;
+        }
+
+        static uint32_t GetU32(const char *p)
+        {
+            const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+            return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+        }
+        // 从buffer的pos处读一个带长度的字段
+        static bool GetBytes(const std::string &buf, std::size_t *pos, std::string *out)
+        {
+            if (*pos + 4 > buf.size())
+            {
+                return false;
+            }
+            uint32_t n = GetU32(buf.data() + *pos);
+            *pos += 4;
+            if (n > buf.size() - *pos)
+            {
+                return false;
+            }
+            out->assign(buf.data() + *pos, n);
+            *pos += n;
+            return true;
+        }
+
+    public:
+        Reader() : fp(nullptr), corrupted(false) {}
+        ~Reader() { Close(); }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        bool Open(const std::string &file_path)
+        {
+            Close();
+            path = file_path;
+            corrupted = false;
+            fp = fopen(path.c_str(), "rb");
+            if (fp == nullptr)
+            {
+                LOG(WARNING, "open " + path + " error");
+                return false;
+            }
+            setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+            char magic[4];
+            if (fread(magic, 1, 4, fp) != 4 || std::memcmp(magic, kMagic, 4) != 0)
+            {
+                LOG(WARNING, path + " is not a record file");
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        // 读下一条记录；到达文件末尾或记录损坏时返回false，二者用Corrupted()区分
+        bool Next(Record *r)
+        {
+            if (fp == nullptr)
+            {
+                return false;
+            }
+            char head[4];
+            std::size_t got = fread(head, 1, 4, fp);
+            if (got == 0)
+            {
+                return false;
+            }
+            uint32_t payload = got == 4 ? GetU32(head) : 0;
+            if (got != 4 || payload > kMaxPayload)
+            {
+                return Corrupt("corrupted record header");
+            }
+            buffer.resize(payload);
+            if (payload > 0 && fread(&buffer[0], 1, payload, fp) != payload)
+            {
+                return Corrupt("truncated record");
+            }
+            std::size_t pos = 0;
+            if (!GetBytes(buffer, &pos, &r->title) || !GetBytes(buffer, &pos, &r->content) ||
+                !GetBytes(buffer, &pos, &r->url) || pos + 8 > buffer.size())
+            {
+                return Corrupt("corrupted record");
+            }
+            r->dup_count = GetU32(buffer.data() + pos);
+            uint32_t n = GetU32(buffer.data() + pos + 4);
+            pos += 8;
+            if (n > (buffer.size() - pos) / 4)
+            {
+                return Corrupt("corrupted record");
+            }
+            r->line_ends.resize(n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                r->line_ends[i] = GetU32(buffer.data() + pos + 4 * i);
+            }
+            return true;
+        }
+
+        // Next因记录损坏（而不是到达文件末尾）返回过false
+        bool Corrupted() const { return corrupted; }
+
+        void Close()
+        {
+            if (fp != nullptr)
+            {
+                fclose(fp);
+                fp = nullptr;
+            }
+        }
+    };
+}
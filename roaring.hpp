@@ -0,0 +1,431 @@
+#pragma once
+// 压缩位图(Roaring)：按高16位分桶，桶内元素少时存有序数组，多时存65536位的位图
+// 用于文档过滤和分面统计，交集、计数都按桶进行
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <initializer_list>
+
+namespace ns_roaring
+{
+    class Bitmap
+    {
+    private:
+        static const uint32_t kArrayMax = 4096; // 超过该数量时数组桶转为位图桶，此时两者占用相同
+        static const uint32_t kWords = 1024;    // 位图桶的64位字数
+
+        struct Container
+        {
+            uint16_t key;
+            uint32_t card;
+            std::vector<uint16_t> array; // 有序数组，位图桶时为空
+            std::vector<uint64_t> bits;  // 位图，数组桶时为空
+            bool IsBitmap() const { return !bits.empty(); }
+        };
+        std::vector<Container> containers; // 按key升序
+
+    public:
+        // 逐个添加，按升序添加时只在末尾追加，不需要查找
+        void Add(uint32_t x)
+        {
+            uint16_t key = static_cast<uint16_t>(x >> 16);
+            uint16_t low = static_cast<uint16_t>(x & 0xFFFF);
+            Container *c = nullptr;
+            if (!containers.empty() && containers.back().key == key)
+            {
+                c = &containers.back();
+            }
+            else
+            {
+                auto iter = LowerBound(key);
+                if (iter == containers.end() || iter->key != key)
+                {
+                    Container tmp;
+                    tmp.key = key;
+                    tmp.card = 0;
+                    iter = containers.insert(iter, std::move(tmp));
+                }
+                c = &*iter;
+            }
+            if (c->IsBitmap())
+            {
+                uint64_t mask = uint64_t(1) << (low & 63);
+                if ((c->bits[low >> 6] & mask) == 0)
+                {
+                    c->bits[low >> 6] |= mask;
+                    c->card++;
+                }
+                return;
+            }
+            if (c->array.empty() || c->array.back() < low)
+            {
+                c->array.push_back(low);
+            }
+            else
+            {
+                auto pos = std::lower_bound(c->array.begin(), c->array.end(), low);
+                if (*pos == low)
+                {
+                    return;
+                }
+                c->array.insert(pos, low);
+            }
+            c->card++;
+            if (c->card > kArrayMax)
+            {
+                ToBitmap(c);
+            }
+        }
+
+        bool Contains(uint32_t x) const
+        {
+            uint16_t key = static_cast<uint16_t>(x >> 16);
+            auto iter = std::lower_bound(containers.begin(), containers.end(), key,
+                                         [](const Container &c, uint16_t k)
+                                         { return c.key < k; });
+            return iter != containers.end() && iter->key == key && ContainerHas(*iter, static_cast<uint16_t>(x & 0xFFFF));
+        }
+
+        uint64_t Cardinality() const
+        {
+            uint64_t n = 0;
+            for (auto &c : containers)
+            {
+                n += c.card;
+            }
+            return n;
+        }
+
+        bool Empty() const { return containers.empty(); }
+
+        std::size_t Bytes() const
+        {
+            std::size_t n = containers.capacity() * sizeof(Container);
+            for (auto &c : containers)
+            {
+                n += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+            }
+            return n;
+        }
+
+        void ShrinkToFit()
+        {
+            containers.shrink_to_fit();
+            for (auto &c : containers)
+            {
+                c.array.shrink_to_fit();
+            }
+        }
+
+        template <class Func>
+        void ForEach(Func func) const
+        {
+            for (auto &c : containers)
+            {
+                uint32_t high = static_cast<uint32_t>(c.key) << 16;
+                if (!c.IsBitmap())
+                {
+                    for (uint16_t low : c.array)
+                    {
+                        func(high | low);
+                    }
+                    continue;
+                }
+                for (uint32_t w = 0; w < kWords; w++)
+                {
+                    uint64_t word = c.bits[w];
+                    while (word != 0)
+                    {
+                        func(high | (w << 6) | static_cast<uint32_t>(__builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+
+        static Bitmap And(const Bitmap &a, const Bitmap &b)
+        {
+            Bitmap out;
+            std::size_t i = 0, j = 0;
+            while (i < a.containers.size() && j < b.containers.size())
+            {
+                const Container &ca = a.containers[i];
+                const Container &cb = b.containers[j];
+                if (ca.key < cb.key)
+                {
+                    i++;
+                }
+                else if (cb.key < ca.key)
+                {
+                    j++;
+                }
+                else
+                {
+                    Container c = AndContainer(ca, cb);
+                    if (c.card > 0)
+                    {
+                        out.containers.push_back(std::move(c));
+                    }
+                    i++;
+                    j++;
+                }
+            }
+            return out;
+        }
+
+        static Bitmap Or(const Bitmap &a, const Bitmap &b)
+        {
+            Bitmap out;
+            std::size_t i = 0, j = 0;
+            while (i < a.containers.size() || j < b.containers.size())
+            {
+                if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key))
+                {
+                    out.containers.push_back(a.containers[i++]);
+                }
+                else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key)
+                {
+                    out.containers.push_back(b.containers[j++]);
+                }
+                else
+                {
+                    out.containers.push_back(OrContainer(a.containers[i++], b.containers[j++]));
+                }
+            }
+            return out;
+        }
+
+        // 只计数不生成结果，分面统计用
+        static uint64_t AndCardinality(const Bitmap &a, const Bitmap &b)
+        {
+            uint64_t n = 0;
+            std::size_t i = 0, j = 0;
+            while (i < a.containers.size() && j < b.containers.size())
+            {
+                const Container &ca = a.containers[i];
+                const Container &cb = b.containers[j];
+                if (ca.key < cb.key)
+                {
+                    i++;
+                }
+                else if (cb.key < ca.key)
+                {
+                    j++;
+                }
+                else
+                {
+                    n += AndContainerCardinality(ca, cb);
+                    i++;
+                    j++;
+                }
+            }
+            return n;
+        }
+
+        // 按升序查询的游标：拉链按doc_id升序遍历时，桶和数组下标都只向前移动
+        class Cursor
+        {
+        private:
+            const Bitmap *bitmap;
+            std::size_t index; // 当前桶
+            std::size_t pos;   // 数组桶内的位置
+
+        public:
+            explicit Cursor(const Bitmap *bitmap) : bitmap(bitmap), index(0), pos(0) {}
+
+            // x需单调不减
+            bool Contains(uint32_t x)
+            {
+                const std::vector<Container> &cs = bitmap->containers;
+                uint16_t key = static_cast<uint16_t>(x >> 16);
+                while (index < cs.size() && cs[index].key < key)
+                {
+                    index++;
+                    pos = 0;
+                }
+                if (index == cs.size() || cs[index].key != key)
+                {
+                    return false;
+                }
+                const Container &c = cs[index];
+                uint16_t low = static_cast<uint16_t>(x & 0xFFFF);
+                if (c.IsBitmap())
+                {
+                    return (c.bits[low >> 6] >> (low & 63)) & 1;
+                }
+                while (pos < c.array.size() && c.array[pos] < low)
+                {
+                    pos++;
+                }
+                return pos < c.array.size() && c.array[pos] == low;
+            }
+        };
+
+    private:
+        std::vector<Container>::iterator LowerBound(uint16_t key)
+        {
+            return std::lower_bound(containers.begin(), containers.end(), key,
+                                    [](const Container &c, uint16_t k)
+                                    { return c.key < k; });
+        }
+
+        static bool ContainerHas(const Container &c, uint16_t low)
+        {
+            if (c.IsBitmap())
+            {
+                return (c.bits[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(c.array.begin(), c.array.end(), low);
+        }
+
+        static void ToBitmap(Container *c)
+        {
+            c->bits.assign(kWords, 0);
+            for (uint16_t low : c->array)
+            {
+                c->bits[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+            std::vector<uint16_t>().swap(c->array);
+        }
+
+        static void ToArray(Container *c)
+        {
+            c->array.clear();
+            c->array.reserve(c->card);
+            for (uint32_t w = 0; w < kWords; w++)
+            {
+                uint64_t word = c->bits[w];
+                while (word != 0)
+                {
+                    c->array.push_back(static_cast<uint16_t>((w << 6) | __builtin_ctzll(word)));
+                    word &= word - 1;
+                }
+            }
+            std::vector<uint64_t>().swap(c->bits);
+        }
+
+        static Container AndContainer(const Container &a, const Container &b)
+        {
+            Container out;
+            out.key = a.key;
+            out.card = 0;
+            if (a.IsBitmap() && b.IsBitmap())
+            {
+                out.bits.resize(kWords);
+                for (uint32_t w = 0; w < kWords; w++)
+                {
+                    out.bits[w] = a.bits[w] & b.bits[w];
+                    out.card += __builtin_popcountll(out.bits[w]);
+                }
+                if (out.card <= kArrayMax)
+                {
+                    ToArray(&out);
+                }
+                return out;
+            }
+            if (a.IsBitmap() || b.IsBitmap())
+            {
+                const Container &arr = a.IsBitmap() ? b : a;
+                const Container &bmp = a.IsBitmap() ? a : b;
+                for (uint16_t low : arr.array)
+                {
+                    if ((bmp.bits[low >> 6] >> (low & 63)) & 1)
+                    {
+                        out.array.push_back(low);
+                    }
+                }
+            }
+            else
+            {
+                std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                                      std::back_inserter(out.array));
+            }
+            out.card = static_cast<uint32_t>(out.array.size());
+            return out;
+        }
+
+        static uint64_t AndContainerCardinality(const Container &a, const Container &b)
+        {
+            uint64_t n = 0;
+            if (a.IsBitmap() && b.IsBitmap())
+            {
+                for (uint32_t w = 0; w < kWords; w++)
+                {
+                    n += __builtin_popcountll(a.bits[w] & b.bits[w]);
+                }
+                return n;
+            }
+            if (a.IsBitmap() || b.IsBitmap())
+            {
+                const Container &arr = a.IsBitmap() ? b : a;
+                const Container &bmp = a.IsBitmap() ? a : b;
+                for (uint16_t low : arr.array)
+                {
+                    n += (bmp.bits[low >> 6] >> (low & 63)) & 1;
+                }
+                return n;
+            }
+            std::size_t i = 0, j = 0;
+            while (i < a.array.size() && j < b.array.size())
+            {
+                if (a.array[i] < b.array[j])
+                {
+                    i++;
+                }
+                else if (b.array[j] < a.array[i])
+                {
+                    j++;
+                }
+                else
+                {
+                    n++;
+                    i++;
+                    j++;
+                }
+            }
+            return n;
+        }
+
+        static Container OrContainer(const Container &a, const Container &b)
+        {
+            Container out;
+            out.key = a.key;
+            out.card = 0;
+            if (!a.IsBitmap() && !b.IsBitmap())
+            {
+                std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                               std::back_inserter(out.array));
+                out.card = static_cast<uint32_t>(out.array.size());
+                if (out.card > kArrayMax)
+                {
+                    ToBitmap(&out);
+                }
+                return out;
+            }
+            out.bits.assign(kWords, 0);
+            for (const Container *c : {&a, &b})
+            {
+                if (c->IsBitmap())
+                {
+                    for (uint32_t w = 0; w < kWords; w++)
+                    {
+                        out.bits[w] |= c->bits[w];
+                    }
+                }
+                else
+                {
+                    for (uint16_t low : c->array)
+                    {
+                        out.bits[low >> 6] |= uint64_t(1) << (low & 63);
+                    }
+                }
+            }
+            for (uint32_t w = 0; w < kWords; w++)
+            {
+                out.card += __builtin_popcountll(out.bits[w]);
+            }
+            return out;
+        }
+    };
+}
@@ -0,0 +1,181 @@
+#pragma once
+// 打分策略：编译期选择，查询循环按策略实例化，无虚函数调用
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "index.hpp"
+
+namespace ns_scorer
+{
+    enum ScoreMode
+    {
+        SCORE_DEFAULT, // 使用Searcher上配置的默认策略
+        SCORE_RAW,     // 建索引时的原始权重
+        SCORE_TFIDF,
+        SCORE_BM25,
+        SCORE_BM25F
+    };
+
+    inline bool ParseScoreMode(const std::string &name, ScoreMode *mode)
+    {
+        if (name == "raw")
+            *mode = SCORE_RAW;
+        else if (name == "tfidf")
+            *mode = SCORE_TFIDF;
+        else if (name == "bm25")
+            *mode = SCORE_BM25;
+        else if (name == "bm25f")
+            *mode = SCORE_BM25F;
+        else
+            return false;
+        return true;
+    }
+
+    inline const char *ScoreModeName(ScoreMode mode)
+    {
+        switch (mode)
+        {
+        case SCORE_RAW:
+            return "raw";
+        case SCORE_TFIDF:
+            return "tfidf";
+        case SCORE_BM25:
+            return "bm25";
+        case SCORE_BM25F:
+            return "bm25f";
+        default:
+            return "default";
+        }
+    }
+
+    // 按请求调整的字段权重，1表示不调整
+    struct FieldBoosts
+    {
+        float title;
+        float content;
+        FieldBoosts() : title(1.0f), content(1.0f) {}
+    };
+
+    // 每个策略提供:
+    //   struct Term                        查询词级别的常量，遍历拉链前计算一次
+    //   static Term Prepare(stats, df, boosts)
+    //   static float Score(term, elem, title_len, content_len)   对单个倒排元素打分，需可内联
+
+    // 原始权重：(TITLE_WEIGHT - CONTENT_WEIGHT) * title_cnt + CONTENT_WEIGHT * content_cnt
+    // 不调整字段权重时与建索引时写入的weight相同
+    struct RawWeight
+    {
+        struct Term
+        {
+            float title_w;
+            float content_w;
+        };
+        static Term Prepare(const ns_index::CollectionStats &, std::size_t, const FieldBoosts &boosts = FieldBoosts())
+        {
+            Term term;
+            term.title_w = (ns_index::TITLE_WEIGHT - ns_index::CONTENT_WEIGHT) * boosts.title;
+            term.content_w = ns_index::CONTENT_WEIGHT * boosts.content;
+            return term;
+        }
+        static float Score(const Term &term, const ns_index::InvertedElem &elem, uint32_t, uint32_t)
+        {
+            return term.title_w * elem.title_cnt + term.content_w * elem.content_cnt;
+        }
+    };
+
+    // 对数词频 * idf，词频取原始权重
+    struct TfIdf
+    {
+        struct Term
+        {
+            RawWeight::Term raw;
+            float idf;
+        };
+        static Term Prepare(const ns_index::CollectionStats &stats, std::size_t df, const FieldBoosts &boosts = FieldBoosts())
+        {
+            Term term;
+            term.raw = RawWeight::Prepare(stats, df, boosts);
+            term.idf = static_cast<float>(std::log((stats.doc_count + 1.0) / (df + 1.0)) + 1.0);
+            return term;
+        }
+        static float Score(const Term &term, const ns_index::InvertedElem &elem, uint32_t title_len, uint32_t content_len)
+        {
+            return (1.0f + std::log(RawWeight::Score(term.raw, elem, title_len, content_len) + 1.0f)) * term.idf;
+        }
+    };
+
+    // BM25，单字段：解析出的正文包含标题文本，content_cnt已经计入标题中的出现，
+    // tf取正文次数，标题只按字段权重之差额外加权，与RawWeight相同；文档长度也只取正文长度
+    struct BM25
+    {
+        struct Term
+        {
+            float idf;
+            float k1;
+            float norm_a; // k1 * (1 - b)
+            float norm_b; // k1 * b / avgdl
+            float title_w, content_w;
+        };
+        static Term Prepare(const ns_index::CollectionStats &stats, std::size_t df, const FieldBoosts &boosts = FieldBoosts())
+        {
+            const float k1 = 1.2f;
+            const float b = 0.75f;
+            double avgdl = stats.avg_content_len;
+            Term term;
+            term.idf = static_cast<float>(std::log(1.0 + (static_cast<double>(stats.doc_count) - df + 0.5) / (df + 0.5)));
+            term.k1 = k1;
+            term.norm_a = k1 * (1 - b);
+            term.norm_b = avgdl > 0 ? static_cast<float>(k1 * b / avgdl) : 0.0f;
+            term.title_w = boosts.title;
+            term.content_w = boosts.content;
+            return term;
+        }
+        static float Score(const Term &term, const ns_index::InvertedElem &elem, uint32_t, uint32_t content_len)
+        {
+            // 去模板可能删掉正文中的标题，title_cnt大于content_cnt时差值不能为负
+            float tf = std::max(0.0f, (term.title_w - term.content_w) * elem.title_cnt + term.content_w * elem.content_cnt);
+            float norm = term.norm_a + term.norm_b * static_cast<float>(content_len);
+            return term.idf * tf * (term.k1 + 1) / (tf + norm);
+        }
+    };
+
+    // BM25F，标题与正文分别做长度归一化后加权合并
+    // 解析出的正文包含标题文本，正文字段取去掉标题后的部分：次数为content_cnt - title_cnt，长度为content_len - title_len
+    struct BM25F
+    {
+        struct Term
+        {
+            float idf;
+            float k1;
+            float title_a, title_b;     // title_w / (1 - b_t + b_t * len / avg)
+            float content_a, content_b; // 同上，正文字段
+            float title_w, content_w;
+        };
+        static Term Prepare(const ns_index::CollectionStats &stats, std::size_t df, const FieldBoosts &boosts = FieldBoosts())
+        {
+            const float k1 = 1.2f;
+            const float title_b = 0.5f;
+            const float content_b = 0.75f;
+            Term term;
+            term.idf = static_cast<float>(std::log(1.0 + (static_cast<double>(stats.doc_count) - df + 0.5) / (df + 0.5)));
+            term.k1 = k1;
+            term.title_a = 1 - title_b;
+            term.title_b = stats.avg_title_len > 0 ? static_cast<float>(title_b / stats.avg_title_len) : 0.0f;
+            term.content_a = 1 - content_b;
+            double avg_body_len = stats.avg_content_len - stats.avg_title_len;
+            term.content_b = avg_body_len > 0 ? static_cast<float>(content_b / avg_body_len) : 0.0f;
+            term.title_w = ns_index::TITLE_WEIGHT * boosts.title;
+            term.content_w = ns_index::CONTENT_WEIGHT * boosts.content;
+            return term;
+        }
+        static float Score(const Term &term, const ns_index::InvertedElem &elem, uint32_t title_len, uint32_t content_len)
+        {
+            // 去模板可能删掉正文中的标题，差值截到0
+            int body_cnt = std::max(0, elem.content_cnt - elem.title_cnt);
+            uint32_t body_len = content_len > title_len ? content_len - title_len : 0;
+            float tf = term.title_w * elem.title_cnt / (term.title_a + term.title_b * title_len) +
+                       term.content_w * body_cnt / (term.content_a + term.content_b * body_len);
+            return term.idf * tf * (term.k1 + 1) / (tf + term.k1);
+        }
+    };
+}
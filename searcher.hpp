@@ -2,7 +2,20 @@
 #include "index.hpp"
 #include "log.hpp"
 #include "mysql_operations.hpp"
+#include "arena.hpp"
+#include "scorer.hpp"
+#include "threadpool.hpp"
+#include "impact.hpp"
+#include "pairindex.hpp"
+#include "facet.hpp"
+#include "roaring.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <jsoncpp/json/json.h>
 // 搜素
 namespace ns_searcher
@@ -11,19 +24,154 @@ namespace ns_searcher
     struct InvertedElemPrint
     {
         uint64_t doc_id;
-        int weight;
-        std::vector<std::string> words;
+        float weight;
+        // 命中的查询词，指向本次查询分词结果中的字符串
+        std::vector<const std::string *, ns_arena::ArenaAllocator<const std::string *>> words;
         InvertedElemPrint() : doc_id(0), weight(0) {}
     };
 
+    // 查询期间的临时容器，均分配在请求级arena上
+    typedef std::vector<InvertedElemPrint, ns_arena::ArenaAllocator<InvertedElemPrint>> PrintList;
+    typedef std::unordered_map<uint64_t, InvertedElemPrint, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                               ns_arena::ArenaAllocator<std::pair<const uint64_t, InvertedElemPrint>>>
+        PrintMap;
+
+    // 单次请求的检索参数
+    struct SearchOptions
+    {
+        ns_scorer::ScoreMode mode; // 打分策略，SCORE_DEFAULT表示使用Searcher的默认策略
+        std::size_t top_k;         // 只返回得分最高的k条，0表示全部返回
+        bool early;                // 按影响力分层检索并提前终止，按BM25打分，需要top_k
+        bool pairs;                // 查询中包含已建立的词对时使用词对拉链
+        ns_scorer::FieldBoosts boosts; // 标题、正文的字段权重
+        std::vector<std::pair<ns_facet::FacetField, std::string>> filters; // 分面过滤，如lib=asio
+        bool facets;               // 返回结果集的分面计数，结果改为{"results":[...],"facets":{...}}
+        bool explain;              // 返回查询的执行细节，结果改为{"results":[...],"explain":{...}}
+        SearchOptions() : mode(ns_scorer::SCORE_DEFAULT), top_k(0), early(false), pairs(true), facets(false), explain(false) {}
+    };
+
+    // 一次查询的执行情况，供explain和慢查询日志使用；查询过程中只记录几个标量
+    struct QueryTrace
+    {
+        const char *path;   // 实际走的检索路径：exhaustive/parallel/pairs/early/filtered_out
+        int64_t filter_docs; // 过滤位图中的文档数，-1表示没有过滤
+        std::size_t scanned;    // 实际访问的倒排元素个数
+        std::size_t candidates; // 截取前k条之前的命中文档数
+        std::size_t results;
+        ns_metrics::Timings timings;
+        QueryTrace() : path("exhaustive"), filter_docs(-1), scanned(0), candidates(0), results(0) {}
+    };
+
+    // 查询语法中的字段限定，fields与分词结果一一对应
+    //   title:词   只在标题中匹配，走标题拉链
+    //   url:词     URL中必须包含该词，多个url:同时满足，只过滤不参与打分
+    struct QueryFields
+    {
+        std::vector<ns_index::Field> fields;
+        std::vector<std::string> urls;
+        // 没有任何限定时可以走不区分字段的优化路径（影响力分层、词对）
+        bool Plain() const
+        {
+            return urls.empty() && std::count(fields.begin(), fields.end(), ns_index::FIELD_TITLE) == 0;
+        }
+    };
+
+    // 并行检索时单个分片的命中结果，由池内线程写入
+    struct ShardHit
+    {
+        uint64_t doc_id;
+        float weight;
+        uint32_t word; // 首个命中的查询词下标
+    };
+
+    const double kSlowQueryMs = 100; // 慢查询日志的默认阈值，环境变量SLOW_QUERY_MS可覆盖，0表示关闭
+
+    // 查询词对应的倒排拉链
+    typedef std::vector<ns_index::ListView, ns_arena::ArenaAllocator<ns_index::ListView>> ListRefs;
+
+    // 命中文档的稠密位图，按doc_id置位，供分面计数；只在请求分面时分配
+    typedef std::vector<uint64_t, ns_arena::ArenaAllocator<uint64_t>> HitBits;
+
+    // 各收集函数共用的参数
+    struct CollectParams
+    {
+        ns_scorer::FieldBoosts boosts;
+        const ns_roaring::Bitmap *allow; // 允许的文档，nullptr表示不过滤
+        uint64_t *hits;                  // 不为空时在收集循环中标记每个命中文档
+
+        void Mark(uint64_t doc_id) const
+        {
+            if (hits != nullptr)
+            {
+                hits[doc_id >> 6] |= uint64_t(1) << (doc_id & 63);
+            }
+        }
+    };
+
+    // 按doc_id升序遍历拉链时判断文档是否通过过滤
+    class DocFilter
+    {
+    private:
+        ns_roaring::Bitmap::Cursor cursor;
+        bool on;
+
+    public:
+        explicit DocFilter(const ns_roaring::Bitmap *allow) : cursor(allow), on(allow != nullptr) {}
+        bool Pass(uint64_t doc_id) { return !on || cursor.Contains(static_cast<uint32_t>(doc_id)); }
+    };
+
     class Searcher
     {
     private:
         ns_index::Index *index; // 供系统进行查找的索引
+        ns_scorer::ScoreMode default_mode; // 整个集合默认的打分策略
+        // 查询涉及的倒排元素总数达到该值才拆分到线程池，廉价查询始终留在调用线程
+        std::size_t parallel_threshold;
+        uint64_t slow_query_ns; // 超过该耗时的查询连同执行细节写入日志，0表示关闭
+
+        static const std::size_t kMinShardPostings = 32 * 1024; // 每个分片至少分到的倒排元素数
+        static const std::size_t kEarlyDefaultK = 10;           // 提前终止模式未指定k时使用
+        static const std::size_t kImpactMinDf = 1024;           // 文档频率达到该值的词才建立影响力层
+
+        ns_impact::ImpactIndex impact_index;
+        ns_pair::PairOptions pair_options;
+        ns_pair::PairIndex pair_index;
+        ns_facet::FacetIndex facet_index;
+
     public:
-        Searcher() {}
+        Searcher() : index(nullptr), default_mode(ns_scorer::SCORE_RAW), parallel_threshold(200000)
+        {
+            const char *env = std::getenv("SLOW_QUERY_MS");
+            SetSlowQueryThreshold(env != nullptr ? std::atof(env) : kSlowQueryMs);
+        }
         ~Searcher() {}
 
+        // 0表示关闭查询内并行
+        void SetParallelThreshold(std::size_t postings) { parallel_threshold = postings; }
+
+        // 单位毫秒，0表示关闭慢查询日志
+        void SetSlowQueryThreshold(double ms) { slow_query_ns = ms > 0 ? static_cast<uint64_t>(ms * 1e6) : 0; }
+        double GetSlowQueryThreshold() const { return slow_query_ns / 1e6; }
+
+        void SetScoreMode(ns_scorer::ScoreMode mode)
+        {
+            if (mode != ns_scorer::SCORE_DEFAULT)
+            {
+                default_mode = mode;
+            }
+        }
+        ns_scorer::ScoreMode GetScoreMode() const { return default_mode; }
+
+        // 需在InitSearcher之前调用；之后修改可调用BuildPairs重建
+        void SetPairOptions(const ns_pair::PairOptions &options) { pair_options = options; }
+        const ns_pair::PairIndex &GetPairIndex() const { return pair_index; }
+
+        void BuildPairs(const ns_pair::PairOptions &options)
+        {
+            pair_options = options;
+            pair_index.Build(index, pair_options);
+        }
+
     public:
         void InitSearcher(const std::string &input)
         { 
@@ -48,55 +196,964 @@ namespace ns_searcher
             {
                 LOG(FATAL, "加载索引失败. . . ");
             }
+            // 服务期间索引只读，冻结为完美哈希词典；失败时继续使用哈希表
+            if (!index->Freeze())
+            {
+                LOG(WARNING, "词典冻结失败, 使用哈希表查找. . . ");
+            }
+            index->BuildFieldIndex();
+            impact_index.Build(index, kImpactMinDf);
+            pair_index.Build(index, pair_options);
+            facet_index.Build(index);
             LOG(NORMAL, "建立正排和倒排索引成功. . . ");
         }
         // query : 搜素关键字
         // json_string : 返回给客户端浏览器的搜素结果
         void Search(const std::string &query, std::string *json_string)
         {
+            Search(query, SearchOptions(), json_string);
+        }
+
+        void Search(const std::string &query, const SearchOptions &options, std::string *json_string)
+        {
+            // 本次查询的临时容器全部分配在线程本地的arena上，函数返回时一次性释放
+            ns_arena::ArenaScope arena_scope;
+            // 各阶段耗时记入ns_metrics的直方图，Lap把距上一次Lap的时间记到对应阶段
+            // 需要explain或开启了慢查询日志时，即使关闭了统计也要计时
+            ns_metrics::Begin(options.explain || slow_query_ns > 0);
+            QueryTrace trace;
+
             // 第一步：分词，对我们的query进行按照searcher的要求进行分词
             std::vector<std::string> words;
-            ns_util::JiebaUtil::CutString(query, &words);
-            // 第二步：触发，根据分词的结果进行index查找
-            // ns_index::InvertedList inverted_list_all;
+            QueryFields fields;
+            ParseQuery(query, &words, &fields);
+            ns_metrics::Lap(ns_metrics::STAGE_SEGMENT);
+            // 第二步：触发，根据分词的结果进行index查找并打分
+            SearchOptions opts = options;
+            if (opts.early && opts.top_k == 0)
+            {
+                opts.top_k = kEarlyDefaultK;
+            }
+            PrintList inverted_list_all;
+            ns_roaring::Bitmap facet_docs;
+            trace.scanned = Retrieve(words, opts, &inverted_list_all, &fields, &trace, &facet_docs);
+            trace.candidates = inverted_list_all.size();
+            ns_metrics::Lap(ns_metrics::STAGE_SCORE);
+
+            // 分面按全部命中文档计数，位图在收集循环中标记，返回的列表仍只保留前k条
+            ns_facet::FacetCounts counts[ns_facet::FACET_FIELDS];
+            if (opts.facets)
+            {
+                facet_index.Count(facet_docs, counts);
+                ns_metrics::Lap(ns_metrics::STAGE_FACETS);
+            }
 
-            std::vector<InvertedElemPrint> inverted_list_all;
-            std::unordered_map<uint64_t, InvertedElemPrint> tokens_map;
+            // 第三步：合并排序，汇总查找结果，按照相关性weight(降序)排序
+            auto by_weight = [](const InvertedElemPrint &e1, const InvertedElemPrint &e2)
+            { return e1.weight > e2.weight; };
+            if (opts.top_k > 0 && inverted_list_all.size() > opts.top_k)
+            {
+                std::partial_sort(inverted_list_all.begin(), inverted_list_all.begin() + opts.top_k,
+                                  inverted_list_all.end(), by_weight);
+                inverted_list_all.resize(opts.top_k);
+            }
+            else
+            {
+                std::sort(inverted_list_all.begin(), inverted_list_all.end(), by_weight);
+            }
+            trace.results = inverted_list_all.size();
+            ns_metrics::Lap(ns_metrics::STAGE_SORT);
 
-            for (std::string word : words)
+            // 第四部：构建，根据查找结果直接拼接json串，不再经过Json::Value中转
+            bool object = opts.facets || opts.explain;
+            if (object)
+            {
+                BuildObjectJson(inverted_list_all, opts.facets ? counts : nullptr, json_string);
+            }
+            else
+            {
+                BuildJson(inverted_list_all, json_string);
+            }
+            ns_metrics::Lap(ns_metrics::STAGE_SERIALIZE);
+            ns_metrics::End(&trace.timings);
+
+            // 执行细节在计时结束后才生成，查询词的拉链长度此时重新查一遍，正常查询不承担这部分开销
+            bool slow = slow_query_ns > 0 && trace.timings.Total() >= slow_query_ns;
+            std::string explain;
+            if (opts.explain || slow)
+            {
+                AppendExplain(query, words, fields, opts, trace, &explain);
+            }
+            if (slow)
+            {
+                LOG(WARNING, "慢查询: " + explain);
+            }
+            if (opts.explain)
+            {
+                json_string->append(",\"explain\":");
+                json_string->append(explain);
+            }
+            if (object)
+            {
+                json_string->append("}\n");
+            }
+        }
+
+        // 分词并统一转小写
+        void CutQuery(const std::string &query, std::vector<std::string> *words)
+        {
+            ns_util::JiebaUtil::CutString(query, words);
+            for (std::string &word : *words)
             {
                 boost::to_lower(word);
+            }
+        }
+
+        // 解析title:、url:限定，其余部分正常分词；title:后的内容分词后每个词都限定在标题
+        void ParseQuery(const std::string &query, std::vector<std::string> *words, QueryFields *fields)
+        {
+            std::string text;
+            std::vector<std::string> parts;
+            ns_util::StringUtil::Split(query, &parts, " \t");
+            for (auto &part : parts)
+            {
+                if (part.compare(0, 6, "title:") == 0 && part.size() > 6)
+                {
+                    std::vector<std::string> title_words;
+                    CutQuery(part.substr(6), &title_words);
+                    for (auto &word : title_words)
+                    {
+                        words->push_back(std::move(word));
+                        fields->fields.push_back(ns_index::FIELD_TITLE);
+                    }
+                }
+                else if (part.compare(0, 4, "url:") == 0 && part.size() > 4)
+                {
+                    std::string url = part.substr(4);
+                    boost::to_lower(url);
+                    fields->urls.push_back(url);
+                }
+                else if (!part.empty())
+                {
+                    text += text.empty() ? part : " " + part;
+                }
+            }
+            std::vector<std::string> text_words;
+            CutQuery(text, &text_words);
+            for (auto &word : text_words)
+            {
+                words->push_back(std::move(word));
+                fields->fields.push_back(ns_index::FIELD_ANY);
+            }
+        }
+
+        // 按打分策略检索，结果追加到out，返回扫描过的倒排元素个数
+        // out中的InvertedElemPrint引用了words中的字符串，words需比out活得久
+        // 设置了top_k时，out中至少包含全局前k条，但不保证只有k条
+        // fields为nullptr表示不限定字段
+        // 设置了facets且facet_docs不为空时，全部命中文档写入facet_docs，供分面计数
+        // trace不为空时记录实际走的检索路径和过滤位图大小
+        std::size_t Retrieve(const std::vector<std::string> &words, const SearchOptions &options, PrintList *out,
+                             const QueryFields *fields = nullptr, QueryTrace *trace = nullptr, ns_roaring::Bitmap *facet_docs = nullptr)
+        {
+            if (fields != nullptr && fields->Plain())
+            {
+                fields = nullptr;
+            }
+            // 打分前先确定允许的文档集合，遍历拉链时跳过其余文档
+            ns_roaring::Bitmap allow;
+            bool filtered = BuildFilter(options, fields, &allow);
+            if (filtered && trace != nullptr)
+            {
+                trace->filter_docs = static_cast<int64_t>(allow.Cardinality());
+            }
+            if (filtered && allow.Empty())
+            {
+                SetPath(trace, "filtered_out");
+                return 0;
+            }
+            // 影响力层按默认字段权重量化，调整了字段权重、限定了字段或需要完整结果集时走穷举
+            bool default_boosts = options.boosts.title == 1.0f && options.boosts.content == 1.0f;
+            if (options.early && options.top_k > 0 && fields == nullptr && default_boosts && !filtered && !options.facets)
+            {
+                SetPath(trace, "early");
+                return EarlyRetrieve(words, options.top_k, out);
+            }
+            CollectParams params = {options.boosts, filtered ? &allow : nullptr, nullptr};
+            HitBits hits;
+            if (options.facets && facet_docs != nullptr)
+            {
+                hits.assign((index->TitleLens().size() + 63) / 64, 0);
+                params.hits = hits.data();
+            }
+            ns_scorer::ScoreMode mode = options.mode;
+            if (mode == ns_scorer::SCORE_DEFAULT)
+            {
+                mode = default_mode;
+            }
+            // 运行期选择预先实例化好的查询循环
+            std::size_t scanned = 0;
+            switch (mode)
+            {
+            case ns_scorer::SCORE_TFIDF:
+                scanned = RetrieveWith<ns_scorer::TfIdf>(words, options, out, fields, params, trace);
+                break;
+            case ns_scorer::SCORE_BM25:
+                scanned = RetrieveWith<ns_scorer::BM25>(words, options, out, fields, params, trace);
+                break;
+            case ns_scorer::SCORE_BM25F:
+                scanned = RetrieveWith<ns_scorer::BM25F>(words, options, out, fields, params, trace);
+                break;
+            default:
+                scanned = RetrieveWith<ns_scorer::RawWeight>(words, options, out, fields, params, trace);
+                break;
+            }
+            if (params.hits != nullptr)
+            {
+                // 按doc_id升序加入，每个容器只追加不插入
+                for (std::size_t w = 0; w < hits.size(); w++)
+                {
+                    for (uint64_t word = hits[w]; word != 0; word &= word - 1)
+                    {
+                        facet_docs->Add(static_cast<uint32_t>(w * 64 + __builtin_ctzll(word)));
+                    }
+                }
+            }
+            return scanned;
+        }
+
+    private:
+
+        static void SetPath(QueryTrace *trace, const char *path)
+        {
+            if (trace != nullptr)
+            {
+                trace->path = path;
+            }
+        }
+
+        // url:限定和分面过滤合成一张位图，没有任何过滤条件返回false
+        bool BuildFilter(const SearchOptions &options, const QueryFields *fields, ns_roaring::Bitmap *allow)
+        {
+            bool filtered = facet_index.Filter(options.filters, allow);
+            if (fields == nullptr)
+            {
+                return filtered;
+            }
+            for (auto &url : fields->urls)
+            {
+                const ns_roaring::Bitmap *docs = index->GetUrlDocs(url);
+                if (docs == nullptr)
+                {
+                    *allow = ns_roaring::Bitmap();
+                    return true;
+                }
+                *allow = filtered ? ns_roaring::Bitmap::And(*allow, *docs) : *docs;
+                filtered = true;
+            }
+            return filtered;
+        }
+
+    public:
+
+        std::string GetDesc(const std::string &html_content, const std::string &word)
+        {
+            std::size_t start = 0, len = 0;
+            const char *none = FindDesc(html_content, word, &start, &len);
+            if (none != nullptr)
+            {
+                return none;
+            }
+            return html_content.substr(start, len) + ". . . . . .";
+        }
+
+    private:
+        // 影响力优先的检索(score-at-a-time)：
+        // 1. 没有影响力层的低频词直接遍历整条拉链，累加量化得分
+        // 2. 高频词的影响力层按段处理，每次取当前影响力最大的一段
+        // 3. 剩余段的影响力之和R不超过第k名时，尚未出现的文档已不可能进入前k名；
+        //    已出现的文档只可能在还没命中的层上继续得分，候选集收缩为 累加值 + 这些层的剩余影响力 >= 第k名 的文档，
+        //    候选集足够小时停止扫描
+        // 4. 对候选文档在按doc_id排序的原拉链上二分查找，精确计算BM25，排序沿用普通路径
+        // 量化误差可能让个别文档进出候选集，相对穷举BM25的召回率用./debug bench-early评估
+        // 返回实际访问的倒排元素个数（扫描 + 二分查找）
+        std::size_t EarlyRetrieve(const std::vector<std::string> &words, std::size_t top_k, PrintList *out)
+        {
+            struct Cursor
+            {
+                const ns_impact::ImpactList *tier;
+                std::size_t run;
+            };
+            // seen记录文档已在哪些影响力层中出现，超过32个高频词时多出的层按未出现处理，上界偏大但仍然安全
+            struct Acc
+            {
+                float score;
+                uint32_t seen;
+                Acc() : score(0), seen(0) {}
+            };
+            typedef std::unordered_map<uint64_t, Acc, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                       ns_arena::ArenaAllocator<std::pair<const uint64_t, Acc>>>
+                AccMap;
+            std::vector<Cursor, ns_arena::ArenaAllocator<Cursor>> cursors;
+            std::vector<const ns_index::InvertedList *, ns_arena::ArenaAllocator<const ns_index::InvertedList *>> lists(words.size(), nullptr);
+            AccMap acc;
+            std::size_t scanned = 0;
 
-                ns_index::InvertedList *inverted_list = index->GetInvertedList(word);
-                if (inverted_list == nullptr)
+            const ns_index::CollectionStats &stats = index->GetStats();
+            const uint32_t *title_lens = index->TitleLens().data();
+            const uint32_t *content_lens = index->ContentLens().data();
+            const uint64_t doc_count = index->TitleLens().size();
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                lists[i] = index->GetInvertedList(words[i]);
+                if (lists[i] == nullptr)
                 {
                     continue;
                 }
-                // inverted_list_all.insert(inverted_list_all.end(), inverted_list->begin(), inverted_list->end());
-                for (const auto &elem : *inverted_list)
+                const ns_impact::ImpactList *tier = impact_index.Get(lists[i]);
+                if (tier != nullptr)
+                {
+                    Cursor cursor = {tier, 0};
+                    cursors.push_back(cursor);
+                    continue;
+                }
+                ns_scorer::BM25::Term term = ns_scorer::BM25::Prepare(stats, lists[i]->size());
+                for (const auto &elem : *lists[i])
+                {
+                    if (elem.doc_id < doc_count)
+                    {
+                        acc[elem.doc_id].score += impact_index.Quantize(ns_scorer::BM25::Score(term, elem, title_lens[elem.doc_id], content_lens[elem.doc_id]));
+                    }
+                }
+                scanned += lists[i]->size();
+            }
+
+            std::vector<float, ns_arena::ArenaAllocator<float>> scores;
+            std::vector<uint64_t, ns_arena::ArenaAllocator<uint64_t>> candidates;
+            // 求第k名需要遍历全部累加器，间隔至少与累加器数量相当，均摊到每个倒排元素上是常数
+            std::size_t since_check = 0;
+            while (true)
+            {
+                // 选出当前影响力最大的一段，同时计算剩余上界和剩余倒排元素个数
+                Cursor *best = nullptr;
+                float remaining = 0;
+                std::size_t rest = 0;
+                for (auto &cursor : cursors)
+                {
+                    if (cursor.run >= cursor.tier->runs.size())
+                    {
+                        continue;
+                    }
+                    uint8_t impact = cursor.tier->runs[cursor.run].impact;
+                    remaining += impact;
+                    rest += cursor.tier->docs.size() - (cursor.run == 0 ? 0 : cursor.tier->runs[cursor.run - 1].end);
+                    if (best == nullptr || impact > best->tier->runs[best->run].impact)
+                    {
+                        best = &cursor;
+                    }
+                }
+                if (best == nullptr)
+                {
+                    float kth = acc.size() >= top_k ? KthScore(acc, top_k, &scores) : 0;
+                    Candidates(acc, cursors, kth, &candidates);
+                    break;
+                }
+                if (acc.size() >= top_k && since_check >= std::max<std::size_t>(4096, acc.size()))
+                {
+                    since_check = 0;
+                    float kth = KthScore(acc, top_k, &scores);
+                    // 二分查找的代价按每个候选每个词约16次比较估算，比扫完剩余段便宜才停
+                    if (kth >= remaining && Candidates(acc, cursors, kth, &candidates) * words.size() * 16 < rest)
+                    {
+                        break;
+                    }
+                }
+
+                const ns_impact::ImpactRun &run = best->tier->runs[best->run];
+                std::size_t begin = best->run == 0 ? 0 : best->tier->runs[best->run - 1].end;
+                uint32_t bit = Bit(best - cursors.data());
+                for (std::size_t k = begin; k < run.end; k++)
+                {
+                    Acc &item = acc[best->tier->docs[k]];
+                    item.score += run.impact;
+                    item.seen |= bit;
+                }
+                scanned += run.end - begin;
+                since_check += run.end - begin;
+                best->run++;
+            }
+
+            // 精确打分
+            std::vector<ns_scorer::BM25::Term, ns_arena::ArenaAllocator<ns_scorer::BM25::Term>> terms(words.size());
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                if (lists[i] != nullptr)
+                {
+                    terms[i] = ns_scorer::BM25::Prepare(stats, lists[i]->size());
+                }
+            }
+            auto by_doc = [](const ns_index::InvertedElem &elem, uint64_t doc_id)
+            { return elem.doc_id < doc_id; };
+            out->reserve(out->size() + candidates.size());
+            for (uint64_t doc_id : candidates)
+            {
+                InvertedElemPrint item;
+                item.doc_id = doc_id;
+                for (std::size_t i = 0; i < words.size(); i++)
+                {
+                    if (lists[i] == nullptr)
+                    {
+                        continue;
+                    }
+                    auto iter = std::lower_bound(lists[i]->begin(), lists[i]->end(), doc_id, by_doc);
+                    scanned++;
+                    if (iter != lists[i]->end() && iter->doc_id == doc_id)
+                    {
+                        item.weight += ns_scorer::BM25::Score(terms[i], *iter, title_lens[doc_id], content_lens[doc_id]);
+                        item.words.push_back(&words[i]);
+                    }
+                }
+                out->push_back(std::move(item));
+            }
+            return scanned;
+        }
+
+        template <class Acc, class Scores>
+        static float KthScore(const Acc &acc, std::size_t top_k, Scores *scores)
+        {
+            scores->clear();
+            for (auto &item : acc)
+            {
+                scores->push_back(item.second.score);
+            }
+            std::nth_element(scores->begin(), scores->begin() + (top_k - 1), scores->end(), std::greater<float>());
+            return (*scores)[top_k - 1];
+        }
+
+        static uint32_t Bit(std::size_t cursor)
+        {
+            return cursor < 32 ? (1u << cursor) : 0;
+        }
+
+        // 累加值加上未命中层的剩余影响力不低于kth的文档，返回个数
+        template <class Acc, class Cursors, class Docs>
+        static std::size_t Candidates(const Acc &acc, const Cursors &cursors, float kth, Docs *docs)
+        {
+            // 剩余影响力只与seen有关，按掩码缓存；掩码种类很少
+            std::unordered_map<uint32_t, float> bounds;
+            docs->clear();
+            for (auto &item : acc)
+            {
+                auto iter = bounds.find(item.second.seen);
+                if (iter == bounds.end())
+                {
+                    float bound = 0;
+                    for (std::size_t c = 0; c < cursors.size(); c++)
+                    {
+                        if ((item.second.seen & Bit(c)) == 0 && cursors[c].run < cursors[c].tier->runs.size())
+                        {
+                            bound += cursors[c].tier->runs[cursors[c].run].impact;
+                        }
+                    }
+                    iter = bounds.insert(std::make_pair(item.second.seen, bound)).first;
+                }
+                if (item.second.score + iter->second >= kth)
+                {
+                    docs->push_back(item.first);
+                }
+            }
+            return docs->size();
+        }
+
+        template <class Policy>
+        std::size_t RetrieveWith(const std::vector<std::string> &words, const SearchOptions &options, PrintList *out,
+                                 const QueryFields *fields, const CollectParams &params, QueryTrace *trace)
+        {
+            ListRefs lists;
+            lists.reserve(words.size());
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                // title:限定的词只遍历标题拉链
+                ns_index::ListView view;
+                if (fields != nullptr && fields->fields[i] == ns_index::FIELD_TITLE)
+                {
+                    view = index->GetTitleList(words[i]);
+                }
+                else
+                {
+                    view = ns_index::ListView(index->GetInvertedList(words[i]));
+                }
+                lists.push_back(view);
+                total += view.Empty() ? 0 : view.size();
+            }
+            // 之前的过滤位图也计入查找阶段，之后到Search中的下一次Lap为合并打分
+            ns_metrics::Lap(ns_metrics::STAGE_LOOKUP);
+            std::size_t top_k = options.top_k;
+
+            // 词对拉链优先：合并后的拉链比两条原拉链短，且每个文档只累加一次
+            std::size_t scanned = 0;
+            if (options.pairs && !pair_index.Empty() && words.size() >= 2)
+            {
+                bool hit = CollectPairs<Policy>(words, lists, fields, params, out, &scanned);
+                pair_index.Record(hit);
+                if (hit)
+                {
+                    SetPath(trace, "pairs");
+                    return scanned;
+                }
+            }
+
+            // 只有代价足够大的查询才值得拆分
+            if (parallel_threshold > 0 && total >= parallel_threshold)
+            {
+                ns_threadpool::ThreadPool *pool = ns_threadpool::ThreadPool::GetInstance();
+                std::size_t shards = std::min(pool->Size() + 1, total / kMinShardPostings);
+                if (shards > 1)
+                {
+                    ParallelCollect<Policy>(words, lists, params, shards, top_k, out);
+                    SetPath(trace, "parallel");
+                    return total;
+                }
+            }
+
+            PrintMap tokens_map;
+            Collect<Policy>(words, lists, params, &tokens_map);
+            out->reserve(out->size() + tokens_map.size());
+            for (auto &item : tokens_map)
+            {
+                out->push_back(std::move(item.second));
+            }
+            return total;
+        }
+
+        // 查询主循环，按打分策略实例化，Policy::Score可完全内联
+        template <class Policy>
+        void Collect(const std::vector<std::string> &words, const ListRefs &lists, const CollectParams &params, PrintMap *tokens_map)
+        {
+            const ns_index::CollectionStats &stats = index->GetStats();
+            const uint32_t *title_lens = index->TitleLens().data();
+            const uint32_t *content_lens = index->ContentLens().data();
+            const uint64_t doc_count = index->TitleLens().size();
+
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                const ns_index::ListView &view = lists[i];
+                if (view.Empty())
                 {
-                    auto &item = tokens_map[elem.doc_id];
+                    continue;
+                }
+                typename Policy::Term term = Policy::Prepare(stats, view.size(), params.boosts);
+                tokens_map->reserve(tokens_map->size() + view.size());
+                DocFilter filter(params.allow);
+                const std::string *word = &words[i];
+                view.ForEach([&](const ns_index::InvertedElem &elem)
+                             {
+                    if (elem.doc_id >= doc_count || !filter.Pass(elem.doc_id))
+                    {
+                        return;
+                    }
+                    params.Mark(elem.doc_id);
+                    auto &item = (*tokens_map)[elem.doc_id];
                     // item一定是doc_id相同的print节点
                     item.doc_id = elem.doc_id;
-                    item.weight += elem.doc_id;
-                    item.words.push_back(std::move(elem.word));
+                    item.weight += Policy::Score(term, elem, title_lens[elem.doc_id], content_lens[elem.doc_id]);
+                    item.words.push_back(word); });
+            }
+        }
+
+        // 按查询词顺序贪心匹配词对，没有匹配到返回false
+        // 只有一个词对且没有其他词时直接输出，否则词对和剩余的词一起在哈希表中累加
+        template <class Policy>
+        bool CollectPairs(const std::vector<std::string> &words, const ListRefs &lists, const QueryFields *fields,
+                          const CollectParams &params, PrintList *out, std::size_t *scanned)
+        {
+            struct Match
+            {
+                const ns_pair::PairList *list;
+                std::size_t first;  // 对应PairPosting::first的查询词下标
+                std::size_t second; // 对应PairPosting::second的查询词下标
+            };
+            std::vector<Match, ns_arena::ArenaAllocator<Match>> matches;
+            ListRefs rest(lists);
+            // 词对由全量拉链求交而来，只匹配不限定字段的词
+            auto plain = [fields](std::size_t i)
+            { return fields == nullptr || fields->fields[i] == ns_index::FIELD_ANY; };
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                for (std::size_t j = i + 1; j < words.size() && !rest[i].Empty() && plain(i); j++)
+                {
+                    bool swapped = false;
+                    const ns_pair::PairList *list = nullptr;
+                    if (!rest[j].Empty() && plain(j) && (list = pair_index.Find(words[i], words[j], &swapped)) != nullptr)
+                    {
+                        Match match = {list, swapped ? j : i, swapped ? i : j};
+                        matches.push_back(match);
+                        rest[i] = rest[j] = ns_index::ListView();
+                    }
                 }
             }
-            for (const auto &item : tokens_map)
+            if (matches.empty())
             {
-                inverted_list_all.push_back(std::move(item.second));
+                return false;
             }
 
-            // 第三步：合并排序，汇总查找结果，按照相关性weight(降序)排序
-            // std::sort(inverted_list_all.begin(), inverted_list_all.end(),
-            //           [](const ns_index::InvertedElem &e1, const ns_index::InvertedElem &e2)
-            //           { return e1.weight > e2.weight; });
-            std::sort(inverted_list_all.begin(), inverted_list_all.end(),
-                      [](const InvertedElemPrint &e1, const InvertedElemPrint &e2)
-                      { return e1.weight > e2.weight; });
-
-            // 第四部：构建，根据查找结果，构建json串 -- jsoncpp
-            Json::Value root;
+            const ns_index::CollectionStats &stats = index->GetStats();
+            const uint32_t *title_lens = index->TitleLens().data();
+            const uint32_t *content_lens = index->ContentLens().data();
+            bool alone = matches.size() == 1 && std::all_of(rest.begin(), rest.end(), [](const ns_index::ListView &view)
+                                                             { return view.Empty(); });
+            PrintMap tokens_map;
+            const uint64_t doc_count = index->TitleLens().size();
+            for (auto &match : matches)
+            {
+                typename Policy::Term first = Policy::Prepare(stats, lists[match.first].size(), params.boosts);
+                typename Policy::Term second = Policy::Prepare(stats, lists[match.second].size(), params.boosts);
+                const ns_index::InvertedList &a = *lists[match.first].list;
+                const ns_index::InvertedList &b = *lists[match.second].list;
+                // 命中词按查询中的顺序记录，与逐词累加的结果一致
+                std::size_t lo = std::min(match.first, match.second);
+                if (alone)
+                {
+                    out->reserve(out->size() + a.size() + b.size() - match.list->size());
+                }
+                else
+                {
+                    tokens_map.reserve(tokens_map.size() + a.size() + b.size() - match.list->size());
+                }
+                DocFilter filter(params.allow);
+                // x、y为该文档在两条拉链中的元素，只含一个词时另一个为nullptr
+                auto emit = [&](const ns_index::InvertedElem *x, const ns_index::InvertedElem *y)
+                {
+                    uint64_t doc_id = x != nullptr ? x->doc_id : y->doc_id;
+                    if (doc_id >= doc_count || !filter.Pass(doc_id))
+                    {
+                        return;
+                    }
+                    params.Mark(doc_id);
+                    InvertedElemPrint tmp;
+                    InvertedElemPrint &item = alone ? tmp : tokens_map[doc_id];
+                    item.doc_id = doc_id;
+                    uint32_t title_len = title_lens[doc_id];
+                    uint32_t content_len = content_lens[doc_id];
+                    if (x != nullptr && y != nullptr)
+                    {
+                        item.weight += Policy::Score(first, *x, title_len, content_len) + Policy::Score(second, *y, title_len, content_len);
+                        item.words.push_back(&words[lo]);
+                        item.words.push_back(&words[lo == match.first ? match.second : match.first]);
+                    }
+                    else if (x != nullptr)
+                    {
+                        item.weight += Policy::Score(first, *x, title_len, content_len);
+                        item.words.push_back(&words[match.first]);
+                    }
+                    else
+                    {
+                        item.weight += Policy::Score(second, *y, title_len, content_len);
+                        item.words.push_back(&words[match.second]);
+                    }
+                    if (alone)
+                    {
+                        out->push_back(std::move(tmp));
+                    }
+                };
+                // 交集给出两条拉链中同一文档的位置，两个位置之间的元素只含其中一个词，不需要再比较doc_id
+                std::size_t i = 0, j = 0;
+                for (const ns_pair::PairPosting &posting : *match.list)
+                {
+                    for (; i < posting.first; i++)
+                    {
+                        emit(&a[i], nullptr);
+                    }
+                    for (; j < posting.second; j++)
+                    {
+                        emit(nullptr, &b[j]);
+                    }
+                    emit(&a[i++], &b[j++]);
+                }
+                for (; i < a.size(); i++)
+                {
+                    emit(&a[i], nullptr);
+                }
+                for (; j < b.size(); j++)
+                {
+                    emit(nullptr, &b[j]);
+                }
+                *scanned += a.size() + b.size();
+            }
+            if (alone)
+            {
+                return true;
+            }
+
+            Collect<Policy>(words, rest, params, &tokens_map);
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                *scanned += rest[i].Empty() ? 0 : rest[i].size();
+            }
+            out->reserve(out->size() + tokens_map.size());
+            for (auto &item : tokens_map)
+            {
+                // words中的指针指向同一个数组，按地址排序即恢复查询词顺序
+                if (!std::is_sorted(item.second.words.begin(), item.second.words.end()))
+                {
+                    std::sort(item.second.words.begin(), item.second.words.end());
+                }
+                out->push_back(std::move(item.second));
+            }
+            return true;
+        }
+
+        // 按doc_id区间把查询拆成若干分片，分片之间文档不重叠，合并时直接拼接
+        // 第0个分片在调用线程上执行，其余提交到共享线程池
+        template <class Policy>
+        void ParallelCollect(const std::vector<std::string> &words, const ListRefs &lists, const CollectParams &params,
+                             std::size_t shards, std::size_t top_k, PrintList *out)
+        {
+            const ns_index::CollectionStats &stats = index->GetStats();
+            std::vector<typename Policy::Term> terms(words.size());
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                if (!lists[i].Empty())
+                {
+                    terms[i] = Policy::Prepare(stats, lists[i].size(), params.boosts);
+                }
+            }
+
+            const uint64_t doc_count = index->TitleLens().size();
+            // 分片边界按64对齐，各分片标记命中位图时不会写到同一个字
+            const uint64_t step = ((doc_count + shards - 1) / shards + 63) / 64 * 64;
+            std::vector<std::vector<ShardHit>> results(shards);
+            ns_trace::Context context = ns_trace::Current(); // 池内线程上的span归到本次请求
+            {
+                ns_threadpool::TaskGroup group(ns_threadpool::ThreadPool::GetInstance());
+                for (std::size_t s = 1; s < shards; s++)
+                {
+                    group.Run([&, s]
+                              {
+                                  ns_trace::Adopt adopt(context);
+                                  CollectRange<Policy>(lists, terms, params, std::min(s * step, doc_count),
+                                                       std::min((s + 1) * step, doc_count), top_k, &results[s]);
+                              });
+                }
+                CollectRange<Policy>(lists, terms, params, 0, std::min(step, doc_count), top_k, &results[0]);
+                group.Wait();
+            }
+
+            std::size_t hits = 0;
+            for (auto &shard : results)
+            {
+                hits += shard.size();
+            }
+            out->reserve(out->size() + hits);
+            for (auto &shard : results)
+            {
+                for (auto &hit : shard)
+                {
+                    InvertedElemPrint item;
+                    item.doc_id = hit.doc_id;
+                    item.weight = hit.weight;
+                    item.words.push_back(&words[hit.word]);
+                    out->push_back(std::move(item));
+                }
+            }
+        }
+
+        // 处理[begin, end)区间内的文档，使用稠密数组累加得分，不经过哈希表
+        template <class Policy>
+        void CollectRange(const ListRefs &lists, const std::vector<typename Policy::Term> &terms, const CollectParams &params,
+                          uint64_t begin, uint64_t end, std::size_t top_k, std::vector<ShardHit> *hits)
+        {
+            if (begin >= end)
+            {
+                return;
+            }
+            ns_trace::Span span("collect_range", "search");
+            const uint32_t *title_lens = index->TitleLens().data();
+            const uint32_t *content_lens = index->ContentLens().data();
+            // 每个线程复用自己的累加缓冲区
+            static thread_local std::vector<float> acc;
+            static thread_local std::vector<uint32_t> first; // 首个命中词下标+1，0表示未命中
+            acc.assign(end - begin, 0.0f);
+            first.assign(end - begin, 0);
+
+            for (std::size_t i = 0; i < lists.size(); i++)
+            {
+                const ns_index::ListView &view = lists[i];
+                if (view.Empty())
+                {
+                    continue;
+                }
+                DocFilter filter(params.allow);
+                for (std::size_t k = view.LowerBound(begin); k < view.size() && view[k].doc_id < end; k++)
+                {
+                    const ns_index::InvertedElem &elem = view[k];
+                    if (!filter.Pass(elem.doc_id))
+                    {
+                        continue;
+                    }
+                    uint64_t slot = elem.doc_id - begin;
+                    acc[slot] += Policy::Score(terms[i], elem, title_lens[elem.doc_id], content_lens[elem.doc_id]);
+                    if (first[slot] == 0)
+                    {
+                        first[slot] = i + 1;
+                    }
+                }
+            }
+
+            for (uint64_t slot = 0; slot < end - begin; slot++)
+            {
+                if (first[slot] != 0)
+                {
+                    params.Mark(begin + slot);
+                    ShardHit hit;
+                    hit.doc_id = begin + slot;
+                    hit.weight = acc[slot];
+                    hit.word = first[slot] - 1;
+                    hits->push_back(hit);
+                }
+            }
+            // 分片内先截取前k条，合并后的全局前k条一定在其中
+            if (top_k > 0 && hits->size() > top_k)
+            {
+                std::nth_element(hits->begin(), hits->begin() + top_k, hits->end(),
+                                 [](const ShardHit &h1, const ShardHit &h2)
+                                 { return h1.weight > h2.weight; });
+                hits->resize(top_k);
+            }
+        }
+
+        void BuildJson(const PrintList &inverted_list_all, std::string *json_string)
+        {
+            json_string->clear();
+            if (inverted_list_all.empty())
+            {
+                json_string->append("null\n"); // 与Json::FastWriter对空结果的输出保持一致
+                return;
+            }
+            AppendResults(inverted_list_all, json_string);
+            json_string->push_back('\n');
+        }
+
+        // {"results":[...],"facets":{"lib":{"asio":12,...},"section":{...},"version":{...}}
+        // counts为空时不输出facets；右花括号由调用方在追加explain之后补上
+        void BuildObjectJson(const PrintList &inverted_list_all, const ns_facet::FacetCounts *counts, std::string *json_string)
+        {
+            json_string->clear();
+            json_string->append("{\"results\":");
+            AppendResults(inverted_list_all, json_string);
+            if (counts == nullptr)
+            {
+                return;
+            }
+            json_string->append(",\"facets\":{");
+            for (int f = 0; f < ns_facet::FACET_FIELDS; f++)
+            {
+                if (f > 0)
+                {
+                    json_string->push_back(',');
+                }
+                json_string->push_back('\"');
+                json_string->append(ns_facet::FacetName(f));
+                json_string->append("\":{");
+                for (std::size_t i = 0; i < counts[f].size(); i++)
+                {
+                    if (i > 0)
+                    {
+                        json_string->push_back(',');
+                    }
+                    ns_util::JsonUtil::AppendQuoted(json_string, counts[f][i].first.data(), counts[f][i].first.size());
+                    json_string->push_back(':');
+                    json_string->append(std::to_string(counts[f][i].second));
+                }
+                json_string->push_back('}');
+            }
+            json_string->push_back('}');
+        }
+
+        // {"request_id":42,"query":"...","options":{...},"terms":[{"word":"asio","field":"any","postings":1234},...],"urls":[...],
+        //  "path":"exhaustive","filter_docs":100,"postings":5678,"scanned":5678,"skipped":0,"candidates":900,"results":10,
+        //  "stages_us":{"segment":3.1,...},"total_us":812.5}
+        // postings为各查询词拉链长度之和；skipped = postings - scanned，提前终止、词对拉链会使其大于0
+        // 提前终止的scanned包含二分查找次数，可能超过postings，此时skipped记0
+        void AppendExplain(const std::string &query, const std::vector<std::string> &words, const QueryFields &fields,
+                           const SearchOptions &options, const QueryTrace &trace, std::string *out)
+        {
+            ns_scorer::ScoreMode mode = options.mode == ns_scorer::SCORE_DEFAULT ? default_mode : options.mode;
+            out->append("{\"request_id\":").append(std::to_string(ns_trace::RequestId()));
+            out->append(",\"query\":");
+            ns_util::JsonUtil::AppendQuoted(out, query.data(), query.size());
+            out->append(",\"options\":{\"score\":\"");
+            out->append(ns_scorer::ScoreModeName(mode));
+            out->append("\",\"k\":").append(std::to_string(options.top_k));
+            out->append(",\"early\":").append(options.early ? "true" : "false");
+            out->append(",\"facets\":").append(options.facets ? "true" : "false");
+            out->append(",\"filters\":").append(std::to_string(options.filters.size()));
+            out->append("},\"terms\":[");
+            std::size_t postings = 0;
+            for (std::size_t i = 0; i < words.size(); i++)
+            {
+                bool title = i < fields.fields.size() && fields.fields[i] == ns_index::FIELD_TITLE;
+                ns_index::ListView view = title ? index->GetTitleList(words[i]) : ns_index::ListView(index->GetInvertedList(words[i]));
+                std::size_t size = view.Empty() ? 0 : view.size();
+                postings += size;
+                out->append(i > 0 ? ",{\"word\":" : "{\"word\":");
+                ns_util::JsonUtil::AppendQuoted(out, words[i].data(), words[i].size());
+                out->append(title ? ",\"field\":\"title\"" : ",\"field\":\"any\"");
+                out->append(",\"postings\":").append(std::to_string(size)).push_back('}');
+            }
+            out->append("],\"urls\":[");
+            for (std::size_t i = 0; i < fields.urls.size(); i++)
+            {
+                if (i > 0)
+                {
+                    out->push_back(',');
+                }
+                ns_util::JsonUtil::AppendQuoted(out, fields.urls[i].data(), fields.urls[i].size());
+            }
+            out->append("],\"path\":\"").append(trace.path).push_back('\"');
+            if (trace.filter_docs >= 0)
+            {
+                out->append(",\"filter_docs\":").append(std::to_string(trace.filter_docs));
+            }
+            out->append(",\"postings\":").append(std::to_string(postings));
+            out->append(",\"scanned\":").append(std::to_string(trace.scanned));
+            out->append(",\"skipped\":").append(std::to_string(postings > trace.scanned ? postings - trace.scanned : 0));
+            out->append(",\"candidates\":").append(std::to_string(trace.candidates));
+            out->append(",\"results\":").append(std::to_string(trace.results));
+            out->append(",\"stages_us\":{");
+            bool first = true;
+            char buf[32];
+            for (int s = 0; s < ns_metrics::STAGE_COUNT; s++)
+            {
+                if (!(trace.timings.touched & (1u << s)))
+                {
+                    continue;
+                }
+                out->append(first ? "\"" : ",\"").append(ns_metrics::StageName(s)).append("\":");
+                first = false;
+                int n = snprintf(buf, sizeof(buf), "%.1f", trace.timings.ns[s] / 1e3);
+                out->append(buf, n);
+            }
+            int n = snprintf(buf, sizeof(buf), "%.1f", trace.timings.Total() / 1e3);
+            out->append("},\"total_us\":").append(buf, n).push_back('}');
+        }
+
+        // 一条结果的摘要位置，none不为空时输出提示文本
+        struct Snippet
+        {
+            const InvertedElemPrint *item;
+            const ns_index::DocInfo *doc;
+            const char *none;
+            std::size_t start;
+            std::size_t len;
+        };
+
+        // 先为全部结果定位摘要，再统一拼接json，摘要和拼接两个阶段每次请求各计时一次
+        void AppendResults(const PrintList &inverted_list_all, std::string *json_string)
+        {
+            std::vector<Snippet, ns_arena::ArenaAllocator<Snippet>> snippets;
+            snippets.reserve(inverted_list_all.size());
             for (auto &item : inverted_list_all)
             {
                 ns_index::DocInfo *doc = index->GetForwardIndex(item.doc_id);
@@ -104,24 +1161,63 @@ namespace ns_searcher
                 {
                     continue;
                 }
-                Json::Value elem;
-                elem["title"] = doc->title;
-                elem["desc"] = GetDesc(doc->content, item.words[0]); // 对content进行取关键词上下文内容的操作
-                elem["url"] = doc->url;
-                // for debug
-                elem["id"] = (int)item.doc_id;
-                elem["weight"] = item.weight; // int自动转string
+                Snippet snippet = {&item, doc, nullptr, 0, 0};
+                // 对content进行取关键词上下文内容的操作
+                snippet.none = FindDesc(doc->content, *item.words[0], &snippet.start, &snippet.len);
+                snippets.push_back(snippet);
+            }
+            ns_metrics::Lap(ns_metrics::STAGE_SNIPPET);
 
-                root.append(elem);
+            json_string->reserve(json_string->size() + snippets.size() * 512);
+            json_string->push_back('[');
+            bool first = true;
+            for (auto &snippet : snippets)
+            {
+                const ns_index::DocInfo *doc = snippet.doc;
+                if (!first)
+                {
+                    json_string->push_back(',');
+                }
+                first = false;
+                // 字段顺序与原先FastWriter的输出保持一致
+                json_string->append("{\"desc\":");
+                AppendDesc(snippet, json_string);
+                if (doc->dup_count > 0)
+                {
+                    json_string->append(",\"dup\":");
+                    json_string->append(std::to_string(doc->dup_count));
+                }
+                json_string->append(",\"id\":"); // for debug
+                json_string->append(std::to_string(snippet.item->doc_id));
+                json_string->append(",\"title\":");
+                ns_util::JsonUtil::AppendQuoted(json_string, doc->title.data(), doc->title.size());
+                json_string->append(",\"url\":");
+                ns_util::JsonUtil::AppendQuoted(json_string, doc->url.data(), doc->url.size());
+                json_string->append(",\"weight\":");
+                char weight[32];
+                int n = snprintf(weight, sizeof(weight), "%g", snippet.item->weight);
+                json_string->append(weight, n);
+                json_string->push_back('}');
             }
-            // Json::StyledWriter writer;
-            Json::FastWriter writer;
-            *json_string = writer.write(root);
+            json_string->push_back(']');
         }
-        
-        std::string GetDesc(const std::string &html_content, const std::string &word)
+
+        // 直接把摘要写入输出，避免substr产生的临时串
+        void AppendDesc(const Snippet &snippet, std::string *out)
+        {
+            if (snippet.none != nullptr)
+            {
+                ns_util::JsonUtil::AppendQuoted(out, snippet.none, std::strlen(snippet.none));
+                return;
+            }
+            ns_util::JsonUtil::AppendQuoted(out, snippet.doc->content.data() + snippet.start, snippet.len);
+            out->insert(out->size() - 1, ". . . . . ."); // 插入到右引号之前
+        }
+
+        // 找到word在html_content首次出现的位置，计算相近上下文的区间
+        // 成功返回nullptr，失败返回提示文本
+        const char *FindDesc(const std::string &html_content, const std::string &word, std::size_t *out_start, std::size_t *out_len)
         {
-            // 找到word在html_content首次出现的位置，截取相近的上下文
             const std::size_t prev_step = 128;
             const std::size_t next_step = 256;
             auto iter = std::search(html_content.begin(), html_content.end(), word.begin(), word.end(),
@@ -138,11 +1234,23 @@ namespace ns_searcher
             start = (pos > start + prev_step) ? pos - prev_step : start;
             end = (pos + next_step < end) ? pos + next_step : end;
 
+            // 避免从UTF-8多字节字符中间截断，输出非法的json字符串
+            while (start < end && (html_content[start] & 0xC0) == 0x80)
+            {
+                start++;
+            }
+            while (end > start && end < html_content.size() && (html_content[end] & 0xC0) == 0x80)
+            {
+                end--;
+            }
+
             if (end <= start)
             {
                 return "None 2";
             }
-            return html_content.substr(start, end - start) + ". . . . . .";
+            *out_start = start;
+            *out_len = end - start;
+            return nullptr;
         }
     };
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+#pragma once
+// 会话缓存：登录成功后发放不透明的随机token，token -> 用户资料保存在内存中
+// 按token哈希分片，每片一把锁；过期时间随访问顺延；用户资料修改或删除时按账号失效
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include "log.hpp"
+
+namespace ns_session
+{
+    const std::size_t kShards = 16;
+    const int kSessionTtlSeconds = 30 * 60;
+    const std::size_t kTokenBytes = 16;
+
+    struct Session
+    {
+        std::string account;
+        std::string profile; // 序列化好的用户资料json，校验时直接返回
+        std::chrono::steady_clock::time_point expire;
+    };
+
+    struct SessionStats
+    {
+        std::size_t sessions;
+        uint64_t hits;
+        uint64_t misses; // 不存在或已过期
+        uint64_t invalidated;
+    };
+
+    class SessionCache
+    {
+    private:
+        struct Shard
+        {
+            std::mutex mtx;
+            std::unordered_map<std::string, Session> sessions;
+            std::size_t inserts; // 每插入一定数量顺带清理一次过期会话
+            Shard() : inserts(0) {}
+        };
+
+        Shard shards[kShards];
+        std::chrono::seconds ttl;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> invalidated;
+
+        Shard &ShardOf(const std::string &token)
+        {
+            return shards[std::hash<std::string>()(token) % kShards];
+        }
+
+        // 调用方持有shard.mtx
+        static void Sweep(Shard &shard, std::chrono::steady_clock::time_point now)
+        {
+            for (auto iter = shard.sessions.begin(); iter != shard.sessions.end();)
+            {
+                iter = iter->second.expire <= now ? shard.sessions.erase(iter) : std::next(iter);
+            }
+        }
+
+        // 128位随机数的十六进制串；random_device读取系统熵源，不可由已发放的token推测
+        static std::string NewToken()
+        {
+            static const char hex[] = "0123456789abcdef";
+            thread_local std::random_device rd;
+            std::string token;
+            token.reserve(kTokenBytes * 2);
+            for (std::size_t i = 0; i < kTokenBytes; i += 4)
+            {
+                uint32_t r = rd();
+                for (int b = 0; b < 4; b++)
+                {
+                    token.push_back(hex[(r >> (b * 8 + 4)) & 0xF]);
+                    token.push_back(hex[(r >> (b * 8)) & 0xF]);
+                }
+            }
+            return token;
+        }
+
+    public:
+        explicit SessionCache(int ttl_seconds = kSessionTtlSeconds) : ttl(ttl_seconds), hits(0), misses(0), invalidated(0) {}
+
+        // 新建会话，返回token
+        std::string Create(const std::string &account, const std::string &profile)
+        {
+            std::string token = NewToken();
+            auto now = std::chrono::steady_clock::now();
+            Shard &shard = ShardOf(token);
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            if (++shard.inserts % 256 == 0)
+            {
+                Sweep(shard, now);
+            }
+            Session &session = shard.sessions[token];
+            session.account = account;
+            session.profile = profile;
+            session.expire = now + ttl;
+            return token;
+        }
+
+        // 命中时取出用户资料并顺延过期时间
+        bool Lookup(const std::string &token, std::string *profile)
+        {
+            auto now = std::chrono::steady_clock::now();
+            Shard &shard = ShardOf(token);
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            auto iter = shard.sessions.find(token);
+            if (iter == shard.sessions.end() || iter->second.expire <= now)
+            {
+                if (iter != shard.sessions.end())
+                {
+                    shard.sessions.erase(iter);
+                }
+                misses++;
+                return false;
+            }
+            iter->second.expire = now + ttl;
+            *profile = iter->second.profile;
+            hits++;
+            return true;
+        }
+
+        void Remove(const std::string &token)
+        {
+            Shard &shard = ShardOf(token);
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            shard.sessions.erase(token);
+        }
+
+        // 删除该账号的全部会话；只在修改、删除用户时调用，逐片扫描
+        void InvalidateAccount(const std::string &account)
+        {
+            std::size_t removed = 0;
+            for (Shard &shard : shards)
+            {
+                std::unique_lock<std::mutex> lock(shard.mtx);
+                for (auto iter = shard.sessions.begin(); iter != shard.sessions.end();)
+                {
+                    if (iter->second.account == account)
+                    {
+                        iter = shard.sessions.erase(iter);
+                        removed++;
+                    }
+                    else
+                    {
+                        ++iter;
+                    }
+                }
+            }
+            invalidated += removed;
+            if (removed > 0)
+            {
+                LOG(NORMAL, "account: " + account + " 的" + std::to_string(removed) + "个会话已失效");
+            }
+        }
+
+        SessionStats Stats()
+        {
+            SessionStats stats;
+            stats.sessions = 0;
+            for (Shard &shard : shards)
+            {
+                std::unique_lock<std::mutex> lock(shard.mtx);
+                stats.sessions += shard.sessions.size();
+            }
+            stats.hits = hits.load();
+            stats.misses = misses.load();
+            stats.invalidated = invalidated.load();
+            return stats;
+        }
+    };
+}
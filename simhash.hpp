@@ -0,0 +1,160 @@
+#pragma once
+// 近重复检测：每个文档对词级shingle计算64位SimHash，汉明距离不超过阈值视为近重复
+// 多表汉明索引：64位分成4段，距离<=3的两个指纹至少有一段完全相同，按段分桶只比较同桶的候选
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include "mphf.hpp"
+#include "threadpool.hpp"
+#include "log.hpp"
+
+namespace ns_simhash
+{
+    const int kShingle = 3;     // 每个shingle包含的词数
+    const int kMaxDistance = 3; // 近重复的汉明距离上限，需小于分段数
+    const std::size_t kMinTokens = 8; // 正文词数少于这么多时SimHash没有区分度，空文档的指纹全部相同
+
+    // 词：连续的ASCII字母数字或非ASCII字节，ASCII统一转小写
+    // 正文太短时改用标题和正文的精确哈希：标题和正文都相同的短页面（不同版本的副本、跳转页）归为一组，标题不同的空页面仍然分开
+    // url每个文件都不同，不参与哈希，否则短页面永远不会被判为重复
+    inline uint64_t Fingerprint(const std::string &title, const std::string &text)
+    {
+        // 每个线程复用缓冲区，避免逐文档分配
+        static thread_local std::vector<uint64_t> tokens;
+        static thread_local std::string word;
+        tokens.clear();
+        word.clear();
+        for (std::size_t i = 0; i <= text.size(); i++)
+        {
+            unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+            if (c >= 0x80 || std::isalnum(c))
+            {
+                word.push_back(static_cast<char>(std::tolower(c)));
+                continue;
+            }
+            if (!word.empty())
+            {
+                tokens.push_back(ns_mphf::Hash64(word.data(), word.size(), 0));
+                word.clear();
+            }
+        }
+
+        if (tokens.size() < kMinTokens)
+        {
+            uint64_t h = ns_mphf::Hash64(title.data(), title.size(), 1);
+            return ns_mphf::Hash64(text.data(), text.size(), h);
+        }
+
+        int counts[64] = {0};
+        std::size_t shingles = tokens.size() - kShingle + 1;
+        for (std::size_t i = 0; i < shingles; i++)
+        {
+            uint64_t h = 0;
+            for (std::size_t j = i; j < i + kShingle && j < tokens.size(); j++)
+            {
+                h = ns_mphf::Mix64(h ^ tokens[j]);
+            }
+            for (int b = 0; b < 64; b++)
+            {
+                counts[b] += static_cast<int>((h >> b) & 1) * 2 - 1; // 无分支，编译器可向量化
+            }
+        }
+        uint64_t fp = 0;
+        for (int b = 0; b < 64; b++)
+        {
+            if (counts[b] > 0)
+            {
+                fp |= uint64_t(1) << b;
+            }
+        }
+        return fp;
+    }
+
+    inline int Distance(uint64_t a, uint64_t b)
+    {
+        return __builtin_popcountll(a ^ b);
+    }
+
+    class HammingIndex
+    {
+    private:
+        static const int kTables = 4; // 64位分4段，每段16位
+        const std::vector<uint64_t> *fps;
+        std::vector<std::vector<uint32_t>> tables[kTables]; // 段值 -> 文档下标，下标升序
+
+        static uint32_t Block(uint64_t fp, int t) { return static_cast<uint32_t>((fp >> (16 * t)) & 0xFFFF); }
+
+    public:
+        HammingIndex() : fps(nullptr) {}
+
+        void Build(const std::vector<uint64_t> &fingerprints)
+        {
+            fps = &fingerprints;
+            for (int t = 0; t < kTables; t++)
+            {
+                tables[t].assign(1 << 16, std::vector<uint32_t>());
+                for (std::size_t i = 0; i < fingerprints.size(); i++)
+                {
+                    tables[t][Block(fingerprints[i], t)].push_back(static_cast<uint32_t>(i));
+                }
+            }
+        }
+
+        // 下标小于i的文档中与i距离不超过max_distance的最小下标，没有返回i；只读，可并发调用
+        uint32_t FirstNear(uint32_t i, int max_distance) const
+        {
+            uint64_t fp = (*fps)[i];
+            uint32_t best = i;
+            for (int t = 0; t < kTables; t++)
+            {
+                for (uint32_t j : tables[t][Block(fp, t)])
+                {
+                    if (j >= best)
+                    {
+                        break; // 桶内下标升序
+                    }
+                    if (Distance(fp, (*fps)[j]) <= max_distance)
+                    {
+                        best = j;
+                        break;
+                    }
+                }
+            }
+            return best;
+        }
+    };
+
+    // 聚类：每个文档指向之前最早的近重复文档，沿链找到的第一个文档即为代表文档
+    // canonical[i]为文档i的代表文档下标；近邻查找在线程池上分块并行，结果与线程数无关
+    // 流式处理时调用方只需保存每个文档8字节的指纹
+    inline void Cluster(const std::vector<uint64_t> &fps, std::vector<uint32_t> *canonical)
+    {
+        const std::size_t n = fps.size();
+        const std::size_t chunk = 256;
+        ns_threadpool::ThreadPool *pool = ns_threadpool::ThreadPool::GetInstance();
+        HammingIndex index;
+        index.Build(fps);
+        canonical->resize(n);
+        {
+            ns_threadpool::TaskGroup group(pool, ns_threadpool::PRIORITY_BACKGROUND);
+            for (std::size_t begin = 0; begin < n; begin += chunk)
+            {
+                std::size_t end = std::min(begin + chunk, n);
+                group.Run([&index, canonical, begin, end]
+                          {
+                              for (std::size_t i = begin; i < end; i++)
+                              {
+                                  (*canonical)[i] = index.FirstNear(static_cast<uint32_t>(i), kMaxDistance);
+                              }
+                          });
+            }
+            group.Wait();
+        }
+        // 指向的文档下标更小，顺序扫描一遍即可压缩成代表文档
+        for (std::size_t i = 0; i < n; i++)
+        {
+            (*canonical)[i] = (*canonical)[(*canonical)[i]];
+        }
+    }
+}
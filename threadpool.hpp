@@ -0,0 +1,418 @@
+#pragma once
+// 线程池：工作窃取调度，查询内并行、建索引、后台任务共用一套线程，避免超额占用CPU
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include "log.hpp"
+
+namespace ns_threadpool
+{
+    // 任务优先级：交互式查询优先于后台的合并、重建
+    enum Priority
+    {
+        PRIORITY_INTERACTIVE = 0,
+        PRIORITY_BACKGROUND = 1,
+        PRIORITY_LEVELS = 2
+    };
+
+    struct PoolOptions
+    {
+        std::size_t threads; // 0表示与CPU核数一致
+        bool pin_cpus;       // 是否把第i个线程绑定到第i个核
+        PoolOptions() : threads(0), pin_cpus(false) {}
+    };
+
+    // 运行指标
+    struct PoolStats
+    {
+        std::size_t threads;
+        uint64_t submitted;
+        uint64_t executed;
+        uint64_t steals;
+        std::vector<std::size_t> queue_depth[PRIORITY_LEVELS]; // 每个线程各优先级队列的当前长度
+    };
+
+    class ThreadPool
+    {
+    private:
+        // 每个线程一组双端队列：自己从尾部取（后进先出，缓存友好），其他线程从头部偷
+        struct Worker
+        {
+            std::mutex mtx;
+            std::deque<std::function<void()>> tasks[PRIORITY_LEVELS];
+            std::atomic<std::size_t> depth[PRIORITY_LEVELS];
+            std::atomic<uint64_t> executed;
+            std::atomic<uint64_t> steals;
+            Worker() : executed(0)
+            {
+                steals = 0;
+                for (int p = 0; p < PRIORITY_LEVELS; p++)
+                {
+                    depth[p] = 0;
+                }
+            }
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::atomic<std::size_t> queued; // 所有队列中的任务总数
+        std::atomic<std::size_t> next;   // 外部线程提交时轮询选择队列
+        std::atomic<uint64_t> submitted;
+        std::mutex sleep_mtx;
+        std::condition_variable cond;
+        bool stop;
+
+    private: // 单例模型
+        explicit ThreadPool(const PoolOptions &options) : queued(0), next(0), submitted(0), stop(false)
+        {
+            std::size_t n = options.threads;
+            if (n == 0)
+            {
+                n = std::thread::hardware_concurrency();
+                n = n == 0 ? 1 : n;
+            }
+            for (std::size_t i = 0; i < n; i++)
+            {
+                workers.emplace_back(new Worker());
+            }
+            for (std::size_t i = 0; i < n; i++)
+            {
+                threads.emplace_back(&ThreadPool::Routine, this, i);
+                if (options.pin_cpus)
+                {
+                    PinThread(threads.back(), i);
+                }
+            }
+        }
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        static ThreadPool *instance;
+        static std::mutex mtx;
+
+        static PoolOptions &Options()
+        {
+            static PoolOptions options;
+            return options;
+        }
+
+        // 当前线程在池中的编号，非池内线程为-1
+        static int &WorkerIndex()
+        {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        static void PinThread(std::thread &thread, std::size_t i)
+        {
+            std::size_t cpus = std::thread::hardware_concurrency();
+            if (cpus == 0)
+            {
+                return;
+            }
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+            {
+                LOG(WARNING, "线程绑核失败, cpu: " + std::to_string(i % cpus));
+            }
+        }
+
+        bool PopLocal(std::size_t self, int priority, std::function<void()> *task)
+        {
+            Worker &w = *workers[self];
+            std::unique_lock<std::mutex> lock(w.mtx);
+            if (w.tasks[priority].empty())
+            {
+                return false;
+            }
+            *task = std::move(w.tasks[priority].back());
+            w.tasks[priority].pop_back();
+            w.depth[priority]--;
+            return true;
+        }
+
+        bool Steal(std::size_t self, int priority, std::function<void()> *task)
+        {
+            std::size_t n = workers.size();
+            for (std::size_t k = 1; k < n; k++)
+            {
+                Worker &victim = *workers[(self + k) % n];
+                if (victim.depth[priority].load(std::memory_order_relaxed) == 0)
+                {
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(victim.mtx);
+                if (victim.tasks[priority].empty())
+                {
+                    continue;
+                }
+                *task = std::move(victim.tasks[priority].front());
+                victim.tasks[priority].pop_front();
+                victim.depth[priority]--;
+                workers[self]->steals++;
+                return true;
+            }
+            return false;
+        }
+
+        // 按优先级从高到低，先取自己的再去偷
+        bool FindTask(std::size_t self, std::function<void()> *task)
+        {
+            for (int p = 0; p < PRIORITY_LEVELS; p++)
+            {
+                if (PopLocal(self, p, task) || Steal(self, p, task))
+                {
+                    queued--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Execute(std::size_t self, std::function<void()> &task)
+        {
+            task();
+            workers[self]->executed++;
+        }
+
+        void Routine(std::size_t self)
+        {
+            WorkerIndex() = static_cast<int>(self);
+            while (true)
+            {
+                std::function<void()> task;
+                if (FindTask(self, &task))
+                {
+                    Execute(self, task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mtx);
+                cond.wait(lock, [this]
+                          { return stop || queued.load() > 0; });
+                if (stop && queued.load() == 0)
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        ~ThreadPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(sleep_mtx);
+                stop = true;
+            }
+            cond.notify_all();
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        // 需在第一次GetInstance之前调用
+        static void Configure(const PoolOptions &options)
+        {
+            Options() = options;
+        }
+
+        static ThreadPool *GetInstance()
+        {
+            if (nullptr == instance)
+            {
+                mtx.lock();
+                if (nullptr == instance)
+                {
+                    instance = new ThreadPool(Options());
+                    LOG(NORMAL, "线程池启动, 线程数: " + std::to_string(instance->Size()));
+                }
+                mtx.unlock();
+            }
+            return instance;
+        }
+
+        std::size_t Size() const { return workers.size(); }
+
+        // 池内线程提交的任务放入自己的队列，外部线程轮询分发
+        void Submit(std::function<void()> task, Priority priority = PRIORITY_INTERACTIVE)
+        {
+            int self = WorkerIndex();
+            std::size_t target = self >= 0 ? static_cast<std::size_t>(self) : next++ % workers.size();
+            Worker &w = *workers[target];
+            {
+                // 先计数再入队，保证queued不会小于实际任务数；加锁与Routine中的判断同步，避免丢失唤醒
+                std::unique_lock<std::mutex> lock(sleep_mtx);
+                queued++;
+            }
+            {
+                std::unique_lock<std::mutex> lock(w.mtx);
+                w.tasks[priority].push_back(std::move(task));
+                w.depth[priority]++;
+            }
+            submitted++;
+            cond.notify_one();
+        }
+
+        // 在池内线程上执行一个待处理任务，用于等待时帮忙干活；非池内线程直接返回false
+        bool RunPendingTask()
+        {
+            int self = WorkerIndex();
+            if (self < 0)
+            {
+                return false;
+            }
+            std::function<void()> task;
+            if (!FindTask(self, &task))
+            {
+                return false;
+            }
+            Execute(self, task);
+            return true;
+        }
+
+        PoolStats Stats() const
+        {
+            PoolStats stats;
+            stats.threads = workers.size();
+            stats.submitted = submitted.load();
+            stats.executed = 0;
+            stats.steals = 0;
+            for (auto &w : workers)
+            {
+                stats.executed += w->executed.load();
+                stats.steals += w->steals.load();
+                for (int p = 0; p < PRIORITY_LEVELS; p++)
+                {
+                    stats.queue_depth[p].push_back(w->depth[p].load());
+                }
+            }
+            return stats;
+        }
+    };
+    ThreadPool *ThreadPool::instance = nullptr;
+    std::mutex ThreadPool::mtx;
+
+    // 一组任务的汇合点：Run提交任务，Wait等待全部完成
+    // 池内线程调用Wait时会顺带执行队列中的任务，不会因为线程全部阻塞而死锁
+    class TaskGroup
+    {
+    private:
+        ThreadPool *pool;
+        Priority priority;
+        std::mutex mtx;
+        std::condition_variable cond;
+        std::atomic<std::size_t> pending;
+
+    public:
+        explicit TaskGroup(ThreadPool *pool, Priority priority = PRIORITY_INTERACTIVE)
+            : pool(pool), priority(priority), pending(0) {}
+        ~TaskGroup() { Wait(); }
+
+        void Run(std::function<void()> task)
+        {
+            pending++;
+            pool->Submit([this, task]
+                         {
+                             task();
+                             std::unique_lock<std::mutex> lock(mtx);
+                             if (--pending == 0)
+                             {
+                                 cond.notify_all();
+                             }
+                         },
+                         priority);
+        }
+
+        void Wait()
+        {
+            while (pending.load() != 0 && pool->RunPendingTask())
+            {
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            cond.wait(lock, [this]
+                      { return pending.load() == 0; });
+        }
+    };
+}
+
+namespace ns_threadpool
+{
+    // 把[0, n)按chunk分块在线程池上执行func(begin, end)，返回时全部完成
+    template <class Func>
+    void ParallelFor(std::size_t n, std::size_t chunk, Func func, Priority priority = PRIORITY_BACKGROUND)
+    {
+        TaskGroup group(ThreadPool::GetInstance(), priority);
+        for (std::size_t begin = 0; begin < n; begin += chunk)
+        {
+            std::size_t end = std::min(begin + chunk, n);
+            group.Run([&func, begin, end]
+                      { func(begin, end); });
+        }
+        group.Wait();
+    }
+
+    // 有界阻塞队列：生产者在队列满时等待，限制流水线中暂存的数据量
+    // Close之后Push失败，Pop取完剩余元素后返回false
+    template <class T>
+    class BoundedQueue
+    {
+    private:
+        std::deque<T> items;
+        std::size_t capacity;
+        bool closed;
+        std::mutex mtx;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+
+    public:
+        explicit BoundedQueue(std::size_t capacity) : capacity(capacity == 0 ? 1 : capacity), closed(false) {}
+
+        bool Push(T item)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            not_full.wait(lock, [this]
+                          { return closed || items.size() < capacity; });
+            if (closed)
+            {
+                return false;
+            }
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+            return true;
+        }
+
+        bool Pop(T *item)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            not_empty.wait(lock, [this]
+                           { return closed || !items.empty(); });
+            if (items.empty())
+            {
+                return false;
+            }
+            *item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+
+        void Close()
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            closed = true;
+            not_full.notify_all();
+            not_empty.notify_all();
+        }
+    };
+}
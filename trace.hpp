@@ -0,0 +1,272 @@
+#pragma once
+// 请求追踪：每个请求分配一个id，按采样率决定是否记录；被采样的请求在各处的作用域span写入本线程的环形缓冲
+// 未被采样时span只检查一次线程局部变量；导出为Chrome trace-event格式，可在chrome://tracing或Perfetto中打开
+// 后台线程（日志刷盘等）不属于任何请求，只在开启追踪时记录耗时超过kBackgroundMinNs的span
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+namespace ns_trace
+{
+    const std::size_t kThreadEvents = 4096;     // 每个线程保留最近的span数
+    const int kMaxSpansPerRequest = 1024;       // 单个请求在一个线程上最多记录的span数，超出的丢弃并计数
+    const uint32_t kDefaultSampleEvery = 64;    // 默认每64个请求采样1个，环境变量TRACE_SAMPLE可覆盖，0表示关闭
+    const int64_t kBackgroundMinNs = 1000000;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Event
+    {
+        const char *name; // 只保存指针，须为字符串字面量等静态存储
+        const char *cat;
+        uint64_t request_id;
+        int64_t start_ns; // 相对Tracer创建时刻
+        int64_t dur_ns;
+    };
+
+    // 当前线程正在处理的请求
+    struct Context
+    {
+        uint64_t request_id; // 0表示不在请求中
+        bool sampled;
+        int spans;
+    };
+
+    inline Context &Current()
+    {
+        thread_local Context context = Context();
+        return context;
+    }
+
+    inline bool Sampled() { return Current().sampled; }
+    inline uint64_t RequestId() { return Current().request_id; }
+
+    class Tracer
+    {
+    private:
+        // 所属线程写入，导出时读取；锁只在导出时有竞争
+        struct ThreadEvents
+        {
+            std::mutex mtx;
+            uint32_t tid;
+            std::vector<Event> events;
+            std::size_t next;
+            ThreadEvents(uint32_t tid) : tid(tid), events(kThreadEvents), next(0) {}
+        };
+
+        std::mutex mtx; // 保护threads，只在线程第一次记录和导出时加锁
+        std::vector<std::unique_ptr<ThreadEvents>> threads; // 线程退出后保留，最后的span仍可导出
+        std::atomic<uint32_t> sample_every;
+        std::atomic<uint64_t> next_id;
+        std::atomic<uint64_t> dropped;
+        Clock::time_point origin;
+
+        Tracer() : sample_every(kDefaultSampleEvery), next_id(1), dropped(0), origin(Clock::now())
+        {
+            const char *env = std::getenv("TRACE_SAMPLE");
+            if (env != nullptr)
+            {
+                sample_every = static_cast<uint32_t>(std::strtoul(env, nullptr, 10));
+            }
+        }
+
+        ThreadEvents *Local()
+        {
+            thread_local ThreadEvents *local = nullptr;
+            if (local == nullptr)
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                threads.emplace_back(new ThreadEvents(static_cast<uint32_t>(threads.size() + 1)));
+                local = threads.back().get();
+            }
+            return local;
+        }
+
+        static void AppendMicros(std::string *out, int64_t ns)
+        {
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%.3f", ns / 1e3);
+            out->append(buf, n);
+        }
+
+    public:
+        static Tracer &Instance()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        uint32_t SampleEvery() const { return sample_every.load(std::memory_order_relaxed); }
+        void SetSampleEvery(uint32_t every) { sample_every = every; }
+        uint64_t Dropped() const { return dropped.load(); }
+
+        // 分配请求id，force为true时一定采样
+        Context NewRequest(bool force)
+        {
+            Context context;
+            context.request_id = next_id.fetch_add(1, std::memory_order_relaxed);
+            uint32_t every = SampleEvery();
+            context.sampled = force || (every > 0 && context.request_id % every == 0);
+            context.spans = 0;
+            return context;
+        }
+
+        void Emit(const char *name, const char *cat, uint64_t request_id, Clock::time_point start, Clock::time_point end)
+        {
+            Event event;
+            event.name = name;
+            event.cat = cat;
+            event.request_id = request_id;
+            event.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+            event.dur_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            ThreadEvents *local = Local();
+            std::unique_lock<std::mutex> lock(local->mtx);
+            local->events[local->next % kThreadEvents] = event;
+            local->next++;
+        }
+
+        void Drop() { dropped.fetch_add(1, std::memory_order_relaxed); }
+
+        // {"traceEvents":[...],"displayTimeUnit":"ms"}，每个span是一个"ph":"X"的完整事件，ts、dur单位为微秒
+        void Dump(std::string *out)
+        {
+            std::vector<std::pair<uint32_t, Event>> events;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                for (auto &t : threads)
+                {
+                    std::unique_lock<std::mutex> thread_lock(t->mtx);
+                    std::size_t count = std::min(t->next, kThreadEvents);
+                    for (std::size_t i = t->next - count; i < t->next; i++)
+                    {
+                        events.push_back(std::make_pair(t->tid, t->events[i % kThreadEvents]));
+                    }
+                }
+            }
+            std::sort(events.begin(), events.end(), [](const std::pair<uint32_t, Event> &e1, const std::pair<uint32_t, Event> &e2)
+                      { return e1.second.start_ns < e2.second.start_ns; });
+
+            out->clear();
+            out->reserve(events.size() * 128 + 64);
+            out->append("{\"traceEvents\":[");
+            std::vector<uint32_t> tids;
+            for (std::size_t i = 0; i < events.size(); i++)
+            {
+                const Event &event = events[i].second;
+                out->append(i > 0 ? ",{\"name\":\"" : "{\"name\":\"").append(event.name);
+                out->append("\",\"cat\":\"").append(event.cat);
+                out->append("\",\"ph\":\"X\",\"pid\":1,\"tid\":").append(std::to_string(events[i].first));
+                out->append(",\"ts\":");
+                AppendMicros(out, event.start_ns);
+                out->append(",\"dur\":");
+                AppendMicros(out, event.dur_ns);
+                out->append(",\"args\":{\"request_id\":").append(std::to_string(event.request_id)).append("}}");
+                tids.push_back(events[i].first);
+            }
+            // 线程名元数据，时间线上按编号显示
+            std::sort(tids.begin(), tids.end());
+            tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+            for (uint32_t tid : tids)
+            {
+                out->append(",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":").append(std::to_string(tid));
+                out->append(",\"args\":{\"name\":\"thread ").append(std::to_string(tid)).append("\"}}");
+            }
+            out->append("],\"displayTimeUnit\":\"ms\"}\n");
+        }
+    };
+
+    // 本线程开始处理一个请求，析构时恢复之前的上下文
+    class RequestScope
+    {
+    private:
+        Context saved;
+
+    public:
+        explicit RequestScope(bool force = false) : saved(Current())
+        {
+            Current() = Tracer::Instance().NewRequest(force);
+        }
+        ~RequestScope() { Current() = saved; }
+        RequestScope(const RequestScope &) = delete;
+        RequestScope &operator=(const RequestScope &) = delete;
+    };
+
+    // 在线程池任务中沿用提交方的请求上下文
+    class Adopt
+    {
+    private:
+        Context saved;
+
+    public:
+        explicit Adopt(const Context &context) : saved(Current())
+        {
+            Current() = context;
+            Current().spans = 0;
+        }
+        ~Adopt() { Current() = saved; }
+        Adopt(const Adopt &) = delete;
+        Adopt &operator=(const Adopt &) = delete;
+    };
+
+    // 记录[start, end)为当前请求的一个span；未被采样时直接返回
+    inline void Emit(const char *name, const char *cat, Clock::time_point start, Clock::time_point end)
+    {
+        Context &context = Current();
+        if (!context.sampled)
+        {
+            return;
+        }
+        if (++context.spans > kMaxSpansPerRequest)
+        {
+            Tracer::Instance().Drop();
+            return;
+        }
+        Tracer::Instance().Emit(name, cat, context.request_id, start, end);
+    }
+
+    // 作用域span；background为true时不要求在请求中，开启追踪且耗时超过kBackgroundMinNs才记录
+    class Span
+    {
+    private:
+        const char *name;
+        const char *cat;
+        bool on;
+        bool background;
+        Clock::time_point start;
+
+    public:
+        Span(const char *name, const char *cat, bool background = false)
+            : name(name), cat(cat), on(Sampled() || (background && Tracer::Instance().SampleEvery() > 0)), background(background)
+        {
+            if (on)
+            {
+                start = Clock::now();
+            }
+        }
+        ~Span()
+        {
+            if (!on)
+            {
+                return;
+            }
+            Clock::time_point end = Clock::now();
+            if (Sampled())
+            {
+                Emit(name, cat, start, end);
+            }
+            else if (background && end - start >= std::chrono::nanoseconds(kBackgroundMinNs))
+            {
+                Tracer::Instance().Emit(name, cat, 0, start, end);
+            }
+        }
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+    };
+}
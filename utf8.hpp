@@ -0,0 +1,120 @@
+#pragma once
+// UTF-8清洗：保留合法的UTF-8字符，丢弃非法字节（截断的序列、多余的后续字节、超长编码、代理区、超出U+10FFFF）
+// 纯ASCII的16字节块用SSE2一次判断并整块搬运，只有遇到非ASCII字节才逐字符校验
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ns_utf8
+{
+    // 从p开始的一个非ASCII字符的合法长度，非法返回0；按Unicode标准表3-7检查第二个字节的范围
+    inline std::size_t SequenceLength(const unsigned char *p, const unsigned char *end)
+    {
+        unsigned char c = p[0];
+        std::size_t n;
+        unsigned char lo = 0x80, hi = 0xBF; // 第二个字节的范围
+        if (c >= 0xC2 && c <= 0xDF)
+        {
+            n = 2;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            n = 3;
+            lo = c == 0xE0 ? 0xA0 : 0x80; // 超长编码
+            hi = c == 0xED ? 0x9F : 0xBF; // 代理区
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            n = 4;
+            lo = c == 0xF0 ? 0x90 : 0x80;
+            hi = c == 0xF4 ? 0x8F : 0xBF; // 不超过U+10FFFF
+        }
+        else
+        {
+            return 0;
+        }
+        if (static_cast<std::size_t>(end - p) < n || p[1] < lo || p[1] > hi)
+        {
+            return 0;
+        }
+        for (std::size_t i = 2; i < n; i++)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+        }
+        return n;
+    }
+
+    // 把src中合法的部分写到dst，返回写入的字节数；dst可以等于src（原地清洗），输出不会比输入长
+    inline std::size_t Clean(const char *src, std::size_t len, char *dst)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(src);
+        const unsigned char *end = p + len;
+        unsigned char *out = reinterpret_cast<unsigned char *>(dst);
+        while (p < end)
+        {
+#ifdef __SSE2__
+            // ASCII快速路径：16字节中没有最高位为1的字节即可整块保留
+            while (end - p >= 16)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                int mask = _mm_movemask_epi8(block);
+                if (mask != 0)
+                {
+                    // 第一个非ASCII字节之前的部分照常搬运
+                    int ascii = __builtin_ctz(static_cast<unsigned>(mask));
+                    if (out != p)
+                    {
+                        std::memmove(out, p, ascii);
+                    }
+                    out += ascii;
+                    p += ascii;
+                    break;
+                }
+                if (out != p)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), block);
+                }
+                out += 16;
+                p += 16;
+            }
+            if (p == end)
+            {
+                break;
+            }
+#endif
+            if (*p < 0x80)
+            {
+                *out++ = *p++;
+                continue;
+            }
+            std::size_t n = SequenceLength(p, end);
+            if (n == 0)
+            {
+                p++; // 丢弃这个字节，从下一个字节重新同步
+                continue;
+            }
+            if (out != p)
+            {
+                std::memmove(out, p, n);
+            }
+            out += n;
+            p += n;
+        }
+        return out - reinterpret_cast<unsigned char *>(dst);
+    }
+
+    inline void CleanInPlace(std::string *str)
+    {
+        if (!str->empty())
+        {
+            str->resize(Clean(&(*str)[0], str->size(), &(*str)[0]));
+        }
+    }
+}
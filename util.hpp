@@ -8,21 +8,117 @@
 #include <sstream>
 #include <mutex>
 #include <regex>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <mysql/mysql.h>
 #include <jsoncpp/json/json.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include "cppjieba/include/cppjieba/Jieba.hpp"
 #include "log.hpp"
+#include "trace.hpp"
+#include "utf8.hpp"
 
 // 操作合集
 namespace ns_util
 {
 
+    // 只读映射整个文件，析构时解除映射；空文件不映射，data()为nullptr
+    // 传入scratch时，小文件直接read到scratch中：几KB的文件mmap/munmap和缺页的开销比一次read还大
+    // advice交给madvise，顺序读取文件用默认值，随机查找（如ns_mphf::PerfectHashDict::Attach）传MADV_RANDOM
+    class MappedFile
+    {
+    private:
+        static const std::size_t kSmallFile = 256 << 10;
+        const char *addr;
+        std::size_t len;
+        bool mapped;
+
+    public:
+        MappedFile() : addr(nullptr), len(0), mapped(false) {}
+        ~MappedFile() { Close(); }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool Open(const std::string &file_path, std::string *scratch = nullptr, int advice = MADV_SEQUENTIAL)
+        {
+            Close();
+            int fd = open(file_path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                LOG(WARNING, "open file " + file_path + "error");
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+            {
+                LOG(WARNING, "stat file " + file_path + "error");
+                close(fd);
+                return false;
+            }
+            std::size_t size = static_cast<std::size_t>(st.st_size);
+            if (size > 0 && scratch != nullptr && size < kSmallFile)
+            {
+                scratch->resize(size);
+                std::size_t done = 0;
+                while (done < size)
+                {
+                    ssize_t n = read(fd, &(*scratch)[done], size - done);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+                    done += static_cast<std::size_t>(n);
+                }
+                addr = scratch->data();
+                len = done;
+            }
+            else if (size > 0)
+            {
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    LOG(WARNING, "mmap file " + file_path + "error");
+                    close(fd);
+                    return false;
+                }
+                madvise(p, st.st_size, advice);
+                addr = static_cast<const char *>(p);
+                len = size;
+                mapped = true;
+            }
+            close(fd); // 映射建立后即可关闭描述符
+            return true;
+        }
+
+        void Close()
+        {
+            if (mapped)
+            {
+                munmap(const_cast<char *>(addr), len);
+            }
+            addr = nullptr;
+            len = 0;
+            mapped = false;
+        }
+
+        const char *data() const { return addr; }
+        std::size_t size() const { return len; }
+    };
+
     class FileUtil
     {
     public:
         static bool ReadFile(const std::string &file_path, std::string *out)
+        {
+            return ReadFile(file_path, out, nullptr);
+        }
+
+        // line_ends不为空时记录每行读完后out的长度
+        static bool ReadFile(const std::string &file_path, std::string *out, std::vector<uint32_t> *line_ends)
         {
             std::ifstream in(file_path.c_str(), std::ios::in);
             if (!in.is_open())
@@ -36,72 +132,65 @@ namespace ns_util
             {
                 removeInvalidCharacters(line);
                 *out += line;
+                if (line_ends != nullptr)
+                {
+                    line_ends->push_back(static_cast<uint32_t>(out->size()));
+                }
             }
             in.close();
             return true;
         }
 
-        static bool isUTF8ContinuationByte(char ch)
+        // 与ReadFile结果相同：按行去掉换行符，每行经removeInvalidCharacters处理后拼接
+        // 换行符是ASCII，会截断跨行的非法序列，所以整体清洗一遍再去掉换行与逐行处理等价
+        // out和line_ends会被清空，调用方可复用它们的容量；小文件经由每个线程复用的缓冲区读入
+        static bool ReadFileMapped(const std::string &file_path, std::string *out, std::vector<uint32_t> *line_ends)
         {
-            // 判断是否是UTF-8的继续字节（高位是10）
-            return (ch & 0xC0) == 0x80;
-        }
-
-        static bool isUTF8StartByte(char ch)
-        {
-            // 判断是否是UTF-8的起始字节
-            return (ch & 0x80) == 0;
-        }
-
-        static void removeInvalidCharacters(std::string &str)
-        {
-            std::string validChars;
-            for (std::size_t i = 0; i < str.size(); ++i)
+            static thread_local std::string scratch;
+            MappedFile file;
+            if (!file.Open(file_path, &scratch))
+            {
+                return false;
+            }
+            out->clear();
+            line_ends->clear();
+            if (file.size() == 0)
+            {
+                return true;
+            }
+            out->resize(file.size());
+            char *base = &(*out)[0];
+            char *end = base + ns_utf8::Clean(file.data(), file.size(), base);
+            char *dst = base;
+            for (char *p = base; p < end;)
             {
-                if (str[i] == '\\' || str[i] == '\'' || str[i] == '\"')
+                char *nl = static_cast<char *>(std::memchr(p, '\n', end - p));
+                char *stop = nl == nullptr ? end : nl;
+                if (dst != p)
                 {
-                    validChars += '\\';
+                    std::memmove(dst, p, stop - p);
                 }
-                if (isUTF8StartByte(str[i]))
+                dst += stop - p;
+                if (nl == nullptr)
                 {
-                    // 当找到UTF-8的起始字节时，尝试提取整个UTF-8字符
-                    int charLength = 1;
-                    if ((str[i] & 0xE0) == 0xC0)
-                    {
-                        charLength = 2;
-                    }
-                    else if ((str[i] & 0xF0) == 0xE0)
-                    {
-                        charLength = 3;
-                    }
-                    else if ((str[i] & 0xF8) == 0xF0)
-                    {
-                        charLength = 4;
-                    }
-
-                    if (i + charLength <= str.size())
-                    {
-                        // 检查后续字节是否合法
-                        bool validChar = true;
-                        for (int j = 1; j < charLength; ++j)
-                        {
-                            if (!isUTF8ContinuationByte(str[i + j]))
-                            {
-                                validChar = false;
-                                break;
-                            }
-                        }
-
-                        if (validChar)
-                        {
-                            // 将合法的UTF-8字符添加到结果中
-                            validChars += str.substr(i, charLength);
-                            i += charLength - 1; // 跳过已处理的字节
-                        }
-                    }
+                    break;
                 }
+                line_ends->push_back(static_cast<uint32_t>(dst - base));
+                p = nl + 1;
             }
-            str = validChars;
+            // getline对没有换行结尾的最后一行同样算一行
+            if (file.data()[file.size() - 1] != '\n')
+            {
+                line_ends->push_back(static_cast<uint32_t>(dst - base));
+            }
+            out->resize(dst - base);
+            return true;
+        }
+
+        // 原地去掉非法的UTF-8字节，合法的多字节字符保留；SQL转义由数据库层负责
+        static void removeInvalidCharacters(std::string &str)
+        {
+            ns_utf8::CleanInPlace(&str);
         }
     };
 
@@ -144,8 +233,10 @@ namespace ns_util
                 mtx.lock();
                 if (nullptr == instance)
                 {
-                    instance = new JiebaUtil();
-                    instance->InitJiebaUtil();
+                    // 停用词加载完毕后再发布实例，其他线程不会看到未初始化完的对象
+                    JiebaUtil *tmp = new JiebaUtil();
+                    tmp->InitJiebaUtil();
+                    instance = tmp;
                 }
                 mtx.unlock();
             }
@@ -223,8 +314,20 @@ namespace ns_util
             }
         }
 
+        // 转义后加上单引号，作为SQL中的字符串字面量；按连接的字符集转义
+        static std::string Quote(MYSQL *mysql, const std::string &value)
+        {
+            std::string out(value.size() * 2 + 3, '\0');
+            out[0] = '\'';
+            unsigned long n = mysql_real_escape_string(mysql, &out[1], value.data(), value.size());
+            out[n + 1] = '\'';
+            out.resize(n + 2);
+            return out;
+        }
+
         static bool MysqlQuery(MYSQL *mysql, const std::string &sql)
         {
+            ns_trace::Span span("mysql.query", "mysql");
             if (mysql_query(mysql, sql.c_str()) != 0)
             {
                 LOG(FATAL, "mysql query error:" + sql);
@@ -253,6 +356,49 @@ namespace ns_util
             return true;
         }
 
+        // 将data转义为json字符串追加到out末尾（含两侧引号），非ASCII字符按UTF-8原样输出
+        static void AppendQuoted(std::string *out, const char *data, std::size_t len)
+        {
+            static const char hex[] = "0123456789abcdef";
+            out->push_back('\"');
+            std::size_t run = 0; // 无需转义的连续区间起点，整段追加
+            for (std::size_t i = 0; i < len; ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c >= 0x20 && c != '\"' && c != '\\')
+                {
+                    continue;
+                }
+                out->append(data + run, i - run);
+                run = i + 1;
+                switch (c)
+                {
+                case '\"':
+                    out->append("\\\"");
+                    break;
+                case '\\':
+                    out->append("\\\\");
+                    break;
+                case '\n':
+                    out->append("\\n");
+                    break;
+                case '\r':
+                    out->append("\\r");
+                    break;
+                case '\t':
+                    out->append("\\t");
+                    break;
+                default:
+                    out->append("\\u00");
+                    out->push_back(hex[c >> 4]);
+                    out->push_back(hex[c & 0xF]);
+                    break;
+                }
+            }
+            out->append(data + run, len - run);
+            out->push_back('\"');
+        }
+
         static bool UnSerialize(const std::string &str, Json::Value &root)
         {
             Json::CharReaderBuilder crb;